@@ -29,6 +29,10 @@
     - support for multi-line values (values with embedded newline characters)
     - optional support for multiple keys with the same name
     - optional case-insensitive sections and keys (for ASCII characters only)
+    - optional hash index for constant time lookup of sections and keys
+    - optional arena allocation of strings and map nodes
+    - compact read-only copy of loaded data (CSimpleIniFrozenTempl)
+    - optional binary cache files to load unchanged files without parsing
     - saves files with sections and keys in the same order as they were loaded
     - preserves comments on the file, section and keys where possible.
     - supports both char or wchar_t programming interfaces
@@ -83,6 +87,9 @@
             <tr><td>GetAllSections  <td>Return all section names
             <tr><td>GetAllKeys      <td>Return all key names within a section
             <tr><td>GetAllValues    <td>Return all values within a section & key
+            <tr><td>VisitSections   <td>Call a function for each section, in place
+            <tr><td>VisitKeys       <td>Call a function for each key in a section, in place
+            <tr><td>VisitValues     <td>Call a function for each value of a key, in place
             <tr><td>GetSection      <td>Return all key names and values in a section
             <tr><td>GetSectionSize  <td>Return the number of keys in a section
             <tr><td>GetValue        <td>Return a value for a section & key
@@ -99,6 +106,62 @@
     ofstream) then the flag ios_base::binary has been used when the file was
     opened.
 
+    @section mmap MEMORY MAPPED FILES
+
+    Files may be loaded by mapping them into memory with LoadFileMapped().
+    Enable this by defining SI_SUPPORT_MMAP before including the SimpleIni.h
+    header file. The file is parsed in place without being copied, so this
+    is only available for SI_CHAR == char with the SI_ConvertA converter.
+
+    @section threads PARALLEL LOADING
+
+    Large files may be parsed by several threads at once. Enable this by
+    defining SI_SUPPORT_THREADS before including the SimpleIni.h header file
+    and calling SetParallelLoad(). The data is split at the start of section
+    lines and each piece is parsed by its own thread before the results are
+    merged in file order. Data that is smaller than SI_PARALLEL_MIN_CHUNK
+    characters per thread, data containing multi-line values, data that
+    is loaded into an object that already holds file data and data loaded
+    into an object that uses an arena allocator is always parsed by a single
+    thread.
+
+    @section incremental INCREMENTAL LOADING
+
+    Data that arrives in pieces (e.g. from a pipe or a socket) can be loaded
+    without first collecting it into a single buffer. Call BeginLoad(), then
+    Feed() with each chunk of data as it arrives, and finally EndLoad().
+    Chunks may be split anywhere, including in the middle of a line or a
+    multi-line value. Entries are added as soon as they are complete, so only
+    the incomplete tail of the data is buffered. Lines are found by looking
+    for the ASCII characters '\\n', '\\r', '[', ']' and '=', so the file
+    encoding must be UTF-8 or an MBCS encoding that does not use these
+    values as trailing bytes.
+
+    @section arena ARENA ALLOCATION
+
+    Each string copy and each map node is normally a separate heap
+    allocation. Objects that are updated often can instead allocate them
+    from an arena owned by the object by using SI_ArenaAllocator as the
+    SI_ALLOC template parameter, as the CSimpleIniArenaA and
+    CSimpleIniArenaW typedefs do. Most allocations are then taken from
+    blocks of 64 KB, deleted strings and nodes are reused by later
+    allocations of the same size, and Reset() frees the blocks at once
+    rather than each string and node.
+
+    @section cache CACHE FILES
+
+    Files that are loaded often but rarely change can be loaded through a
+    binary cache file with LoadFileCached(). The first load parses the INI
+    file and saves the parsed sections, keys and strings with SaveCache().
+    Later loads use the cache without parsing the file, as long as the file
+    has the same size and either the same modification time or the same
+    contents. The contents are always compared when the time can't tell
+    versions of the file apart: when it has no fraction of a second, or
+    the file was changed just before the cache was saved. The cache file is
+    mapped into memory if SI_SUPPORT_MMAP is defined, except on Windows
+    where a mapped file can't be replaced. Cache files are only valid for
+    the object type and platform that saved them.
+
     @section multiline MULTI-LINE VALUES
 
     Values that span multiple lines are created using the following format.
@@ -161,6 +224,12 @@
       SI_STRLESS class, or by sorting the strings external to this library.
     - Usage of the <mbstring.h> header on Windows can be disabled by defining
       SI_NO_MBCS. This is defined automatically on Windows CE platforms.
+    - The parser uses SSE2 to find the end of lines, keys and section names
+      of 1 and 2 byte characters when the compiler targets x86 or x64, and
+      the scalar loop for 4 byte characters. 32-bit x86 builds check for
+      SSE2 support at runtime. Define SI_NO_SSE2 to always use the scalar
+      loop. AVX2 is not used, as the lines of an INI file are too short for
+      it to gain anything over SSE2.
 
     @section contrib CONTRIBUTIONS
     
@@ -216,8 +285,14 @@
 #include <string>
 #include <map>
 #include <list>
+#include <deque>
+#include <vector>
 #include <algorithm>
+#include <memory>
+#include <new>
 #include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
 
 #ifdef SI_SUPPORT_IOSTREAMS
 # include <iostream>
@@ -265,228 +340,1438 @@ enum SI_Error {
 # define SI_WCHAR_T     UChar
 #endif
 
+// SSE2 is used to find the end of lines, keys and section names while
+// parsing 1 and 2 byte characters. Define SI_NO_SSE2 to force the scalar loop.
+#if !defined(SI_NO_SSE2) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+# define SI_HAS_SSE2
+# include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
 
 // ---------------------------------------------------------------------------
-//                              MAIN TEMPLATE CLASS
+//                              STRUCTURAL SCANNER
 // ---------------------------------------------------------------------------
 
-/** Simple INI file reader.
-
-    This can be instantiated with the choice of unicode or native characterset,
-    and case sensitive or insensitive comparisons of section and key names.
-    The supported combinations are pre-defined with the following typedefs:
+/** Vector instructions that the scanner can use on this CPU */
+enum SI_ScanLevel {
+    SI_SCAN_SCALAR  = 0,    //!< No vector instructions
+    SI_SCAN_SSE2    = 1     //!< SSE2 for 1 and 2 byte characters
+};
 
-    <table>
-        <tr><th>Interface   <th>Case-sensitive  <th>Typedef
-        <tr><td>char        <td>No              <td>CSimpleIniA
-        <tr><td>char        <td>Yes             <td>CSimpleIniCaseA
-        <tr><td>wchar_t     <td>No              <td>CSimpleIniW
-        <tr><td>wchar_t     <td>Yes             <td>CSimpleIniCaseW
-    </table>
+/** The best SI_ScanLevel for this CPU. The CPU is only asked once. */
+inline int SI_GetScanLevel() {
+    static int s_nLevel = -1;
+    if (s_nLevel >= 0) {
+        return s_nLevel;
+    }
+    int nLevel = SI_SCAN_SCALAR;
+#ifdef SI_HAS_SSE2
+# if defined(_M_IX86) && !defined(__SSE2__) && !(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[3] >> 26) & 1) {
+        nLevel = SI_SCAN_SSE2;
+    }
+# else
+    nLevel = SI_SCAN_SSE2;
+# endif
+#endif
+    s_nLevel = nLevel;
+    return nLevel;
+}
 
-    Note that using other types for the SI_CHAR is supported. For instance,
-    unsigned char, unsigned short, etc. Note that where the alternative type
-    is a different size to char/wchar_t you may need to supply new helper
-    classes for SI_STRLESS and SI_CONVERTER.
+/**
+ * Scalar scanner. Returns a pointer to the first character that is either
+ * NULL, a newline character or a_cStop. a_pEnd is the end of the memory
+ * that may be read, or a_pData if that isn't known. This is used for all
+ * character sizes that have no vectorised specialisation, and for the tail
+ * of the data that is too short for a vector.
  */
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-class CSimpleIniTempl
-{
-public:
-    /** key entry */
-    struct Entry {
-        const SI_CHAR * pItem;
-        const SI_CHAR * pComment;
-        int             nOrder;
-
-        Entry(const SI_CHAR * a_pszItem = NULL, int a_nOrder = 0)
-            : pItem(a_pszItem)
-            , pComment(NULL)
-            , nOrder(a_nOrder)
-        { }
-        Entry(const SI_CHAR * a_pszItem, const SI_CHAR * a_pszComment, int a_nOrder)
-            : pItem(a_pszItem)
-            , pComment(a_pszComment)
-            , nOrder(a_nOrder)
-        { }
-        Entry(const Entry & rhs) { operator=(rhs); }
-        Entry & operator=(const Entry & rhs) {
-            pItem    = rhs.pItem;
-            pComment = rhs.pComment;
-            nOrder   = rhs.nOrder;
-            return *this;
+template<class SI_CHAR, size_t SI_CHAR_SIZE>
+struct SI_Scanner {
+    static SI_CHAR * FindLineEnd(
+        SI_CHAR *   a_pData,
+        SI_CHAR *   /*a_pEnd*/,
+        SI_CHAR     a_cStop)
+    {
+        while (*a_pData && *a_pData != a_cStop
+            && *a_pData != '\r' && *a_pData != '\n')
+        {
+            ++a_pData;
         }
+        return a_pData;
+    }
+};
 
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-        /** STL of VC6 doesn't allow me to specify my own comparator for list::sort() */
-        bool operator<(const Entry & rhs) const { return LoadOrder()(*this, rhs); }
-        bool operator>(const Entry & rhs) const { return LoadOrder()(rhs, *this); }
-#endif
+#ifdef SI_HAS_SSE2
 
-        /** Strict less ordering by name of key only */
-        struct KeyOrder : std::binary_function<Entry, Entry, bool> {
-            bool operator()(const Entry & lhs, const Entry & rhs) const {
-                const static SI_STRLESS isLess = SI_STRLESS();
-                return isLess(lhs.pItem, rhs.pItem);
-            }
-        };
+/**
+ * Per-width SSE2 comparisons for 1 and 2 byte characters. 16 characters
+ * take SI_CHAR_SIZE registers, and Pack() turns the comparisons of all of
+ * them into one register for _mm_movemask_epi8() with a bit per character.
+ * 4 byte characters are left to the scalar loop, which is faster than
+ * packing four registers for every 16 characters.
+ */
+template<size_t SI_CHAR_SIZE> struct SI_Sse2Lanes;
+template<> struct SI_Sse2Lanes<1> {
+    static __m128i Set(int c) { return _mm_set1_epi8((char) c); }
+    static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+    static __m128i Pack(const __m128i * a) { return a[0]; }
+};
+template<> struct SI_Sse2Lanes<2> {
+    static __m128i Set(int c) { return _mm_set1_epi16((short) c); }
+    static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+    static __m128i Pack(const __m128i * a) { return _mm_packs_epi16(a[0], a[1]); }
+};
 
-        /** Strict less ordering by order, and then name of key */
-        struct LoadOrder : std::binary_function<Entry, Entry, bool> {
-            bool operator()(const Entry & lhs, const Entry & rhs) const {
-                if (lhs.nOrder != rhs.nOrder) {
-                    return lhs.nOrder < rhs.nOrder;
+/** Index of the lowest set bit of a non-zero mask */
+inline unsigned SI_LowestBit(unsigned a_uMask) {
+#if defined(_MSC_VER)
+    unsigned long uIndex;
+    _BitScanForward(&uIndex, (unsigned long) a_uMask);
+    return (unsigned) uIndex;
+#elif defined(__GNUC__)
+    return (unsigned) __builtin_ctz(a_uMask);
+#else
+    unsigned uIndex = 0;
+    for ( ; !(a_uMask & 1); a_uMask >>= 1) {
+        ++uIndex;
+    }
+    return uIndex;
+#endif
+}
+
+/**
+ * SSE2 scanner. The data is read with unaligned loads only while 16 whole
+ * characters remain before a_pEnd, and the scalar loop finishes the rest, so
+ * nothing outside of the buffer is ever read.
+ */
+template<class SI_CHAR, size_t SI_CHAR_SIZE>
+struct SI_Sse2Scanner {
+    static SI_CHAR * FindLineEnd(
+        SI_CHAR *   a_pData,
+        SI_CHAR *   a_pEnd,
+        SI_CHAR     a_cStop)
+    {
+        if (a_pEnd - a_pData >= 16 && SI_GetScanLevel() >= SI_SCAN_SSE2) {
+            typedef SI_Sse2Lanes<SI_CHAR_SIZE> Lanes;
+            const __m128i xNull = _mm_setzero_si128();
+            const __m128i xCR   = Lanes::Set('\r');
+            const __m128i xLF   = Lanes::Set('\n');
+            const __m128i xStop = Lanes::Set((int) a_cStop);
+            do {
+                __m128i xHits[SI_CHAR_SIZE];
+                for (size_t n = 0; n < SI_CHAR_SIZE; ++n) {
+                    __m128i xData = _mm_loadu_si128((const __m128i *) a_pData + n);
+                    xHits[n] = _mm_or_si128(
+                        _mm_or_si128(Lanes::Equal(xData, xNull), Lanes::Equal(xData, xCR)),
+                        _mm_or_si128(Lanes::Equal(xData, xLF), Lanes::Equal(xData, xStop)));
                 }
-                return KeyOrder()(lhs.pItem, rhs.pItem);
+                unsigned uMask = (unsigned) _mm_movemask_epi8(Lanes::Pack(xHits));
+                if (uMask) {
+                    return a_pData + SI_LowestBit(uMask);
+                }
+                a_pData += 16;
             }
-        };
-    };
-
-    /** map keys to values */
-    typedef std::multimap<Entry,const SI_CHAR *,typename Entry::KeyOrder> TKeyVal;
-
-    /** map sections to key/value map */
-    typedef std::map<Entry,TKeyVal,typename Entry::KeyOrder> TSection;
-
-    /** set of dependent string pointers. Note that these pointers are
-        dependent on memory owned by CSimpleIni.
-    */
-    typedef std::list<Entry> TNamesDepend;
+            while (a_pEnd - a_pData >= 16);
+        }
+        return SI_Scanner<SI_CHAR,0>::FindLineEnd(a_pData, a_pEnd, a_cStop);
+    }
+};
 
-    /** interface definition for the OutputWriter object to pass to Save()
-        in order to output the INI file data.
-    */
-    class OutputWriter {
-    public:
-        OutputWriter() { }
-        virtual ~OutputWriter() { }
-        virtual void Write(const char * a_pBuf) = 0;
-    private:
-        OutputWriter(const OutputWriter &);             // disable
-        OutputWriter & operator=(const OutputWriter &); // disable
-    };
+template<class SI_CHAR> struct SI_Scanner<SI_CHAR,1> : SI_Sse2Scanner<SI_CHAR,1> { };
+template<class SI_CHAR> struct SI_Scanner<SI_CHAR,2> : SI_Sse2Scanner<SI_CHAR,2> { };
 
-    /** OutputWriter class to write the INI data to a file */
-    class FileWriter : public OutputWriter {
-        FILE * m_file;
-    public:
-        FileWriter(FILE * a_file) : m_file(a_file) { }
-        void Write(const char * a_pBuf) {
-            fputs(a_pBuf, m_file);
-        }
-    private:
-        FileWriter(const FileWriter &);             // disable
-        FileWriter & operator=(const FileWriter &); // disable
-    };
+#endif // SI_HAS_SSE2
 
-    /** OutputWriter class to write the INI data to a string */
-    class StringWriter : public OutputWriter {
-        std::string & m_string;
-    public:
-        StringWriter(std::string & a_string) : m_string(a_string) { }
-        void Write(const char * a_pBuf) {
-            m_string.append(a_pBuf);
-        }
-    private:
-        StringWriter(const StringWriter &);             // disable
-        StringWriter & operator=(const StringWriter &); // disable
-    };
+/**
+ * The part of the buffer that the scanner may read while it is being
+ * parsed. Pointers outside of [begin, end) are scanned with no end, by the
+ * scalar loop alone.
+ */
+template<class SI_CHAR>
+class SI_ScanBounds
+{
+public:
+    SI_ScanBounds() : m_pBegin(NULL), m_pEnd(NULL) { }
 
-#ifdef SI_SUPPORT_IOSTREAMS
-    /** OutputWriter class to write the INI data to an ostream */
-    class StreamWriter : public OutputWriter {
-        std::ostream & m_ostream;
-    public:
-        StreamWriter(std::ostream & a_ostream) : m_ostream(a_ostream) { }
-        void Write(const char * a_pBuf) {
-            m_ostream << a_pBuf;
-        }
-    private:
-        StreamWriter(const StreamWriter &);             // disable
-        StreamWriter & operator=(const StreamWriter &); // disable
-    };
-#endif // SI_SUPPORT_IOSTREAMS
+    class Range;
+    friend class Range;
 
-    /** Characterset conversion utility class to convert strings to the
-        same format as is used for the storage.
-    */
-    class Converter : private SI_CONVERTER {
+    /** Scan [a_pBegin, a_pEnd) for as long as this object is in scope.
+        The data must contain a NULL before a_pEnd. */
+    class Range {
     public:
-        Converter(bool a_bStoreIsUtf8) : SI_CONVERTER(a_bStoreIsUtf8) {
-            m_scratch.resize(1024);
-        }
-        Converter(const Converter & rhs) { operator=(rhs); }
-        Converter & operator=(const Converter & rhs) {
-            m_scratch = rhs.m_scratch;
-            return *this;
+        Range(SI_ScanBounds & a_bounds, SI_CHAR * a_pBegin, SI_CHAR * a_pEnd)
+            : m_bounds(a_bounds), m_pBegin(a_bounds.m_pBegin), m_pEnd(a_bounds.m_pEnd)
+        {
+            a_bounds.m_pBegin = a_pBegin;
+            a_bounds.m_pEnd = a_pEnd;
         }
-        bool ConvertToStore(const SI_CHAR * a_pszString) {
-            size_t uLen = SizeToStore(a_pszString);
-            if (uLen == (size_t)(-1)) {
-                return false;
-            }
-            while (uLen > m_scratch.size()) {
-                m_scratch.resize(m_scratch.size() * 2);
-            }
-            return SI_CONVERTER::ConvertToStore(
-                a_pszString,
-                const_cast<char*>(m_scratch.data()),
-                m_scratch.size());
+        ~Range() {
+            m_bounds.m_pBegin = m_pBegin;
+            m_bounds.m_pEnd = m_pEnd;
         }
-        const char * Data() { return m_scratch.data(); }
     private:
-        std::string m_scratch;
+        Range(const Range &);
+        Range & operator=(const Range &);
+        SI_ScanBounds & m_bounds;
+        SI_CHAR *       m_pBegin;
+        SI_CHAR *       m_pEnd;
     };
 
-public:
-    /*-----------------------------------------------------------------------*/
+    /** Find the first NULL or newline character, or a_cStop if supplied */
+    SI_CHAR * FindLineEnd(SI_CHAR * a_pData, SI_CHAR a_cStop) const {
+        SI_CHAR * pEnd = (a_pData >= m_pBegin && a_pData < m_pEnd) ? m_pEnd : a_pData;
+        return SI_Scanner<SI_CHAR,sizeof(SI_CHAR)>::FindLineEnd(a_pData, pEnd, a_cStop);
+    }
 
-    /** Default constructor.
+private:
+    SI_ScanBounds(const SI_ScanBounds &);
+    SI_ScanBounds & operator=(const SI_ScanBounds &);
 
-        @param a_bIsUtf8     See the method SetUnicode() for details.
-        @param a_bMultiKey   See the method SetMultiKey() for details.
-        @param a_bMultiLine  See the method SetMultiLine() for details.
-     */
-    CSimpleIniTempl(
-        bool a_bIsUtf8    = false,
-        bool a_bMultiKey  = false,
-        bool a_bMultiLine = false
-        );
+    SI_CHAR *   m_pBegin;
+    SI_CHAR *   m_pEnd;
+};
 
-    /** Destructor */
-    ~CSimpleIniTempl();
 
-    /** Deallocate all memory stored by this object */
-    void Reset();
+// ---------------------------------------------------------------------------
+//                              MEMORY MAPPED FILES
+// ---------------------------------------------------------------------------
+#ifdef SI_SUPPORT_MMAP
 
-    /** Has any data been loaded */
-    bool IsEmpty() const { return m_data.empty(); }
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
 
-    /*-----------------------------------------------------------------------*/
-    /** @{ @name Settings */
+/** Size of a virtual memory page */
+inline size_t SI_MapPageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t) info.dwPageSize;
+#else
+    return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
 
-    /** Set the storage format of the INI data. This affects both the loading
-        and saving of the INI data using all of the Load/Save API functions.
-        This value cannot be changed after any INI data has been loaded.
+/** Identity of a file, which is the same for every path to it */
+struct SI_FileId {
+#ifdef _WIN32
+    DWORD   dwVolume;
+    DWORD   dwIndexHigh;
+    DWORD   dwIndexLow;
+#else
+    dev_t   dev;
+    ino_t   ino;
+#endif
+};
 
-        If the file is not set to Unicode (UTF-8), then the data encoding is
-        assumed to be the OS native encoding. This encoding is the system
-        locale on Linux/Unix and the legacy MBCS encoding on Windows NT/2K/XP.
-        If the storage format is set to Unicode then the file will be loaded
-        as UTF-8 encoded data regardless of the native file encoding. If
-        SI_CHAR == char then all of the char* parameters take and return UTF-8
-        encoded data regardless of the system locale.
+#ifdef _WIN32
+inline bool SI_GetFileId(HANDLE a_hFile, SI_FileId & a_id) {
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(a_hFile, &info)) {
+        return false;
+    }
+    a_id.dwVolume = info.dwVolumeSerialNumber;
+    a_id.dwIndexHigh = info.nFileIndexHigh;
+    a_id.dwIndexLow = info.nFileIndexLow;
+    return true;
+}
 
-        \param a_bIsUtf8     Assume UTF-8 encoding for the source?
-     */
-    void SetUnicode(bool a_bIsUtf8 = true) {
-        if (!m_pData) m_bStoreIsUtf8 = a_bIsUtf8;
+inline bool SI_GetFileId(const wchar_t * a_pwszFile, SI_FileId & a_id) {
+    HANDLE hFile = CreateFileW(a_pwszFile, 0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
     }
+    bool bOk = SI_GetFileId(hFile, a_id);
+    CloseHandle(hFile);
+    return bOk;
+}
+#endif // _WIN32
 
-    /** Get the storage format of the INI data. */
-    bool IsUnicode() const { return m_bStoreIsUtf8; }
+/** Get the identity of a file. Returns false if it doesn't exist. */
+inline bool SI_GetFileId(const char * a_pszFile, SI_FileId & a_id) {
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(a_pszFile, 0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool bOk = SI_GetFileId(hFile, a_id);
+    CloseHandle(hFile);
+    return bOk;
+#else
+    struct stat st;
+    if (stat(a_pszFile, &st) != 0) {
+        return false;
+    }
+    a_id.dev = st.st_dev;
+    a_id.ino = st.st_ino;
+    return true;
+#endif
+}
 
-    /** Should multiple identical keys be permitted in the file. If set to false
+/** Are two identities of the same file? */
+inline bool SI_IsSameFile(const SI_FileId & a_id1, const SI_FileId & a_id2) {
+#ifdef _WIN32
+    return a_id1.dwVolume == a_id2.dwVolume
+        && a_id1.dwIndexHigh == a_id2.dwIndexHigh
+        && a_id1.dwIndexLow == a_id2.dwIndexLow;
+#else
+    return a_id1.dev == a_id2.dev && a_id1.ino == a_id2.ino;
+#endif
+}
+
+/**
+ * Map an entire file into memory as a private copy-on-write view. Writes to
+ * the view are never seen by the file or by other processes. Returns NULL
+ * if the file could not be mapped or is empty. a_id is set to the identity
+ * of the file that was mapped.
+ *
+ * The view still reads the file, so it changes when the file is rewritten
+ * and faults (SIGBUS on POSIX) when the file is truncated. See
+ * SI_UnshareView().
+ */
+inline void * SI_MapFile(
+    const char *    a_pszFile,
+    size_t &        a_uSize,
+    SI_FileId &     a_id)
+{
+    void * pView = NULL;
+    a_uSize = 0;
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(a_pszFile, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0
+        && (unsigned __int64) size.QuadPart < (size_t) -1)
+    {
+        HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (hMap) {
+            pView = MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(hMap);
+        }
+        if (pView && !SI_GetFileId(hFile, a_id)) {
+            UnmapViewOfFile(pView);
+            pView = NULL;
+        }
+        if (pView) {
+            a_uSize = (size_t) size.QuadPart;
+        }
+    }
+    CloseHandle(hFile);
+#else // !_WIN32
+    int fd = open(a_pszFile, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        pView = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, fd, 0);
+        if (pView == MAP_FAILED) {
+            pView = NULL;
+        }
+        else {
+            a_uSize = (size_t) st.st_size;
+            a_id.dev = st.st_dev;
+            a_id.ino = st.st_ino;
+        }
+    }
+    close(fd);
+#endif // _WIN32
+    return pView;
+}
+
+/** Release a view returned by SI_MapFile */
+inline void SI_UnmapFile(void * a_pView, size_t a_uSize) {
+#ifdef _WIN32
+    (void) a_uSize;
+    UnmapViewOfFile(a_pView);
+#else
+    munmap(a_pView, a_uSize);
+#endif
+}
+
+/**
+ * Replace a view returned by SI_MapFile with memory that has the same
+ * address and contents, so that the file can then be rewritten or truncated
+ * without the view changing or faulting. Writing to a page of the view isn't
+ * enough, as truncating the file discards the copies that were made of its
+ * pages as well. This isn't possible on Windows, where a file that is mapped
+ * can't be truncated or replaced, and false is returned.
+ */
+inline bool SI_UnshareView(void * a_pView, size_t a_uSize) {
+#ifdef _WIN32
+    (void) a_pView;
+    (void) a_uSize;
+    return false;
+#else
+    char * pCopy = new char[a_uSize];
+    if (!pCopy) {
+        return false;
+    }
+    memcpy(pCopy, a_pView, a_uSize);
+    void * pView = mmap(a_pView, a_uSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (pView == a_pView) {
+        memcpy(a_pView, pCopy, a_uSize);
+    }
+    delete[] pCopy;
+    return pView == a_pView;
+#endif
+}
+
+#endif // SI_SUPPORT_MMAP
+
+// ---------------------------------------------------------------------------
+//                                  CACHE FILES
+// ---------------------------------------------------------------------------
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+/** Version of the cache file format, increased whenever it changes */
+#define SI_CACHE_VERSION    2
+
+/** Flags of a cache file, the settings of the object that saved it */
+enum SI_CacheFlags {
+    SI_CACHE_UTF8       = 1,
+    SI_CACHE_MULTIKEY   = 2,
+    SI_CACHE_MULTILINE  = 4
+};
+
+/**
+ * Header of a binary cache file. It is followed by uSections SI_CacheSection,
+ * uKeys SI_CacheKey and uStrings characters of string data. Strings are
+ * referred to by their offset in the string data, where 0 means NULL. The
+ * values of 64 bits are stored as two halves, the low half first.
+ */
+struct SI_CacheHeader {
+    char            szMagic[8];     //!< "SICACHE"
+    unsigned int    uVersion;       //!< SI_CACHE_VERSION
+    unsigned int    uCharSize;      //!< sizeof(SI_CHAR)
+    unsigned int    uFlags;         //!< SI_CacheFlags
+    unsigned int    uSourceSize[2]; //!< size of the source file
+    unsigned int    uSourceTime[3]; //!< modification time of the source file
+    unsigned int    uSourceHash;    //!< FNV-1a hash of the source file
+    unsigned int    uHashAlways;    //!< 1 if the time can't identify the source
+    unsigned int    uSections;      //!< number of sections
+    unsigned int    uKeys;          //!< number of keys of all sections
+    unsigned int    uStrings;       //!< number of characters of string data
+    unsigned int    uFileComment;   //!< the file comment
+    int             nOrder;         //!< next load order value
+};
+
+/** Section of a cache file. Its keys follow the keys of the previous one. */
+struct SI_CacheSection {
+    unsigned int    uItem;
+    unsigned int    uComment;
+    int             nOrder;
+    unsigned int    uKeys;
+};
+
+/** Key of a cache file */
+struct SI_CacheKey {
+    unsigned int    uItem;
+    unsigned int    uValue;
+    unsigned int    uComment;
+    int             nOrder;
+};
+
+/** Open a file with the C library */
+inline FILE * SI_OpenFile(const char * a_pszFile, const char * a_pszMode) {
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, a_pszMode);
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, a_pszMode);
+#endif // __STDC_WANT_SECURE_LIB__
+    return fp;
+}
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <stdlib.h>
+# include <unistd.h>
+#endif
+
+/** Change the size of a file opened for writing. Returns false on error. */
+inline bool SI_TruncateFile(FILE * a_fp, size_t a_uSize) {
+    if (fflush(a_fp) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _chsize_s(_fileno(a_fp), (__int64) a_uSize) == 0;
+#else
+    return ftruncate(fileno(a_fp), (off_t) a_uSize) == 0;
+#endif
+}
+
+/**
+ * Create a file for writing next to a_pszFile with a name that no other
+ * thread or process is using. a_strTemp is set to its path.
+ */
+inline FILE * SI_OpenTempFile(const char * a_pszFile, std::string & a_strTemp) {
+#ifdef _WIN32
+    // a thread only writes one file at a time
+    char szId[32];
+    sprintf(szId, ".%lu.%lu.tmp", (unsigned long) GetCurrentProcessId(),
+        (unsigned long) GetCurrentThreadId());
+    a_strTemp = a_pszFile;
+    a_strTemp += szId;
+    return SI_OpenFile(a_strTemp.c_str(), "wb");
+#else
+    std::string strName(a_pszFile);
+    strName += ".XXXXXX";
+    std::vector<char> name(strName.begin(), strName.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        return NULL;
+    }
+    a_strTemp = &name[0];
+    FILE * fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        remove(a_strTemp.c_str());
+    }
+    return fp;
+#endif
+}
+
+/** Replace a file with another one. Returns false on error. */
+inline bool SI_ReplaceFile(const char * a_pszFrom, const char * a_pszTo) {
+#ifdef _WIN32
+    // rename() doesn't replace an existing file on Windows
+    return MoveFileExA(a_pszFrom, a_pszTo, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(a_pszFrom, a_pszTo) == 0;
+#endif
+}
+
+/** Store a value of up to 64 bits as two halves */
+template<class T>
+inline void SI_SplitValue(T a_value, unsigned int a_parts[2]) {
+    a_parts[0] = (unsigned int) a_value;
+    a_parts[1] = (unsigned int) ((a_value >> 16) >> 16);
+}
+
+/** Starting value of SI_HashBytes() */
+#define SI_HASH_START   2166136261u
+
+/** Add bytes to an FNV-1a hash that was started with SI_HASH_START */
+inline unsigned int SI_HashBytes(
+    unsigned int    a_uHash,
+    const void *    a_pData,
+    size_t          a_uLen
+    )
+{
+    const unsigned char * pData = (const unsigned char *) a_pData;
+    for (size_t n = 0; n < a_uLen; ++n) {
+        a_uHash = (a_uHash ^ pData[n]) * 16777619u;
+    }
+    return a_uHash;
+}
+
+// nanoseconds of the modification time in a struct stat, where there are any
+#if defined(__APPLE__)
+# define SI_MTIME_NSEC(st)  ((st).st_mtimespec.tv_nsec)
+#elif defined(__linux__) || defined(__CYGWIN__) \
+    || (defined(_POSIX_VERSION) && _POSIX_VERSION >= 200809L)
+# define SI_MTIME_NSEC(st)  ((st).st_mtim.tv_nsec)
+#else
+# define SI_MTIME_NSEC(st)  0
+#endif
+
+/**
+ * Get the size and modification time of a file, and optionally the hash of
+ * its contents. The time is the two halves of the seconds since 1970, then
+ * the nanoseconds, which are 0 where they aren't known. Returns false if
+ * the file can't be read.
+ */
+inline bool SI_GetFileStamp(
+    const char *    a_pszFile,
+    unsigned int    a_uSize[2],
+    unsigned int    a_uTime[3],
+    unsigned int *  a_pHash
+    )
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(a_pszFile, GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    a_uSize[0] = data.nFileSizeLow;
+    a_uSize[1] = data.nFileSizeHigh;
+    ULONGLONG uTime = ((ULONGLONG) data.ftLastWriteTime.dwHighDateTime << 32)
+        | data.ftLastWriteTime.dwLowDateTime;
+    SI_SplitValue(uTime / 10000000 - 11644473600ULL, a_uTime);
+    a_uTime[2] = (unsigned int) (uTime % 10000000) * 100;
+#else
+    struct stat st;
+    if (stat(a_pszFile, &st) != 0) {
+        return false;
+    }
+    SI_SplitValue(st.st_size, a_uSize);
+    SI_SplitValue(st.st_mtime, a_uTime);
+    a_uTime[2] = (unsigned int) SI_MTIME_NSEC(st);
+#endif
+    if (!a_pHash) {
+        return true;
+    }
+
+    FILE * fp = SI_OpenFile(a_pszFile, "rb");
+    if (!fp) {
+        return false;
+    }
+    unsigned int uHash = SI_HASH_START;
+    unsigned char buf[4096];
+    size_t uRead;
+    while ((uRead = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        uHash = SI_HashBytes(uHash, buf, uRead);
+    }
+    bool bOk = !ferror(fp);
+    fclose(fp);
+    *a_pHash = uHash;
+    return bOk;
+}
+
+/**
+ * Can a file have been changed without changing a stamp that was taken at
+ * a_tStamp? A time with no fraction of a second may come from a file system
+ * that only keeps whole seconds, and a file changed just before a_tStamp
+ * can be changed again before the file system clock moves on.
+ */
+inline bool SI_IsStampAmbiguous(
+    const unsigned int  a_uTime[3],
+    time_t              a_tStamp
+    )
+{
+    double dTime = (double) a_uTime[0] + 4294967296.0 * (double) a_uTime[1];
+    return a_uTime[2] == 0 || (double) a_tStamp - dTime <= 2.0;
+}
+
+/** Does a file contain exactly the given bytes? */
+inline bool SI_FileEquals(
+    const char *    a_pszFile,
+    const char *    a_pData,
+    size_t          a_uLen
+    )
+{
+    unsigned int uSize[2], uTime[3], uLen[2];
+    SI_SplitValue(a_uLen, uLen);
+    if (!SI_GetFileStamp(a_pszFile, uSize, uTime, NULL)
+        || uSize[0] != uLen[0] || uSize[1] != uLen[1])
+    {
+        return false;
+    }
+
+    FILE * fp = SI_OpenFile(a_pszFile, "rb");
+    if (!fp) {
+        return false;
+    }
+    char buf[4096];
+    size_t uPos = 0, uRead;
+    bool bSame = true;
+    while (bSame && (uRead = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        bSame = uRead <= a_uLen - uPos
+            && memcmp(buf, a_pData + uPos, uRead) == 0;
+        uPos += uRead;
+    }
+    bSame = bSame && !ferror(fp) && uPos == a_uLen;
+    fclose(fp);
+    return bSame;
+}
+
+
+// ---------------------------------------------------------------------------
+//                                  THREADS
+// ---------------------------------------------------------------------------
+#ifdef SI_SUPPORT_THREADS
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+/** Minimum number of characters parsed by each thread of a parallel load */
+#ifndef SI_PARALLEL_MIN_CHUNK
+# define SI_PARALLEL_MIN_CHUNK  (256 * 1024)
+#endif
+
+/** Number of processors available to this process */
+inline int SI_CpuCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int nCount = (int) info.dwNumberOfProcessors;
+#else
+    int nCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return nCount > 0 ? nCount : 1;
+}
+
+/** A function to be run by SI_RunTasks() */
+struct SI_Task {
+    void (*pfnRun)(void *);
+    void * pArg;
+};
+
+#ifdef _WIN32
+inline DWORD WINAPI SI_TaskThread(LPVOID a_pTask) {
+    SI_Task * pTask = (SI_Task *) a_pTask;
+    pTask->pfnRun(pTask->pArg);
+    return 0;
+}
+#else
+inline void * SI_TaskThread(void * a_pTask) {
+    SI_Task * pTask = (SI_Task *) a_pTask;
+    pTask->pfnRun(pTask->pArg);
+    return NULL;
+}
+#endif
+
+/**
+ * Run all tasks to completion. The first task is run by the calling thread
+ * and each of the others by a new thread. A task whose thread can't be
+ * created is run by the calling thread instead.
+ */
+inline void SI_RunTasks(SI_Task * a_pTasks, int a_nTasks) {
+#ifdef _WIN32
+    HANDLE * pThreads = new HANDLE[a_nTasks];
+#else
+    pthread_t * pThreads = new pthread_t[a_nTasks];
+#endif
+    bool * pStarted = new bool[a_nTasks];
+    for (int n = 1; n < a_nTasks; ++n) {
+#ifdef _WIN32
+        pThreads[n] = CreateThread(NULL, 0, SI_TaskThread, &a_pTasks[n], 0, NULL);
+        pStarted[n] = (pThreads[n] != NULL);
+#else
+        pStarted[n] = (pthread_create(&pThreads[n], NULL,
+            SI_TaskThread, &a_pTasks[n]) == 0);
+#endif
+        if (!pStarted[n]) {
+            a_pTasks[n].pfnRun(a_pTasks[n].pArg);
+        }
+    }
+    if (a_nTasks > 0) {
+        a_pTasks[0].pfnRun(a_pTasks[0].pArg);
+    }
+    for (int n = 1; n < a_nTasks; ++n) {
+        if (pStarted[n]) {
+#ifdef _WIN32
+            WaitForSingleObject(pThreads[n], INFINITE);
+            CloseHandle(pThreads[n]);
+#else
+            pthread_join(pThreads[n], NULL);
+#endif
+        }
+    }
+    delete[] pStarted;
+    delete[] pThreads;
+}
+
+#endif // SI_SUPPORT_THREADS
+
+// Converters that store SI_CHAR data exactly as it is in the file. Data
+// loaded with these can be parsed directly in the file buffer.
+template<class SI_CHAR> class SI_ConvertA;
+template<class SI_CONVERTER> struct SI_IsCopyConverter {
+    enum { value = 0 };
+};
+template<class SI_CHAR> struct SI_IsCopyConverter<SI_ConvertA<SI_CHAR> > {
+    enum { value = (sizeof(SI_CHAR) == sizeof(char)) };
+};
+
+
+// ---------------------------------------------------------------------------
+//                                  HASH INDEX
+// ---------------------------------------------------------------------------
+
+/**
+ * Hash function that disables the hash index. This is the default for the
+ * SI_STRHASH parameter, lookups then search the maps directly.
+ */
+template<class SI_CHAR>
+struct SI_NoHash {
+    enum { enabled = 0 };
+    size_t operator()(const SI_CHAR *) const { return 0; }
+};
+
+/**
+ * FNV-1a hash of a string. This must be used with a case-sensitive
+ * comparison such as SI_Case.
+ */
+template<class SI_CHAR>
+struct SI_CaseHash {
+    enum { enabled = 1 };
+    size_t operator()(const SI_CHAR * a_pString) const {
+        size_t uHash = 2166136261u;
+        for ( ; *a_pString; ++a_pString) {
+            uHash = (uHash ^ (size_t) *a_pString) * 16777619u;
+        }
+        return uHash;
+    }
+};
+
+/**
+ * FNV-1a hash of a string with ASCII A-Z folded to lowercase. Every
+ * non-ASCII character hashes the same, so strings that compare equal
+ * with any comparison that folds the case of single characters (such as
+ * SI_NoCase) have the same hash.
+ */
+template<class SI_CHAR>
+struct SI_NoCaseHash {
+    enum { enabled = 1 };
+    size_t operator()(const SI_CHAR * a_pString) const {
+        size_t uHash = 2166136261u;
+        for ( ; *a_pString; ++a_pString) {
+            unsigned long c = (unsigned long) *a_pString;
+            if (c >= 0x80) {
+                c = 0x80;
+            }
+            else if (c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+            uHash = (uHash ^ (size_t) c) * 16777619u;
+        }
+        return uHash;
+    }
+};
+
+/**
+ * Open addressing hash table with linear probing. SLOT must have the
+ * members uHash and bUsed. Removal shifts the following slots back so
+ * that no tombstones are needed.
+ */
+template<class SLOT>
+class SI_HashTable {
+public:
+    SI_HashTable() : m_pSlots(NULL), m_uMask(0), m_uCount(0) { }
+    ~SI_HashTable() { delete[] m_pSlots; }
+
+    /** Bytes allocated for the slots */
+    size_t GetSize() const {
+        return m_pSlots ? (m_uMask + 1) * sizeof(SLOT) : 0;
+    }
+
+    /** Remove all slots */
+    void Clear() {
+        delete[] m_pSlots;
+        m_pSlots = NULL;
+        m_uMask = 0;
+        m_uCount = 0;
+    }
+
+    /** Find the used slot with this hash for which a_match returns true */
+    template<class MATCH>
+    SLOT * Find(size_t a_uHash, const MATCH & a_match) const {
+        if (!m_pSlots) {
+            return NULL;
+        }
+        for (size_t n = a_uHash & m_uMask; m_pSlots[n].bUsed; n = (n + 1) & m_uMask) {
+            if (m_pSlots[n].uHash == a_uHash && a_match(m_pSlots[n])) {
+                return &m_pSlots[n];
+            }
+        }
+        return NULL;
+    }
+
+    /** Add a slot, which must not already be in the table */
+    bool Insert(const SLOT & a_slot) {
+        if ((m_uCount + 1) * 2 > m_uMask + 1 && !Grow()) {
+            return false;
+        }
+        size_t n = a_slot.uHash & m_uMask;
+        while (m_pSlots[n].bUsed) {
+            n = (n + 1) & m_uMask;
+        }
+        m_pSlots[n] = a_slot;
+        m_pSlots[n].bUsed = true;
+        ++m_uCount;
+        return true;
+    }
+
+    /** Remove a slot returned by Find() */
+    void Erase(SLOT * a_pSlot) {
+        size_t uHole = (size_t) (a_pSlot - m_pSlots);
+        size_t n = uHole;
+        for (;;) {
+            m_pSlots[uHole].bUsed = false;
+            for (;;) {
+                n = (n + 1) & m_uMask;
+                if (!m_pSlots[n].bUsed) {
+                    --m_uCount;
+                    return;
+                }
+
+                // a slot can move back to the hole unless its home position
+                // is between the hole and the slot
+                size_t uHome = m_pSlots[n].uHash & m_uMask;
+                bool bStays = (uHole <= n) ?
+                    (uHole < uHome && uHome <= n) : (uHole < uHome || uHome <= n);
+                if (!bStays) {
+                    break;
+                }
+            }
+            m_pSlots[uHole] = m_pSlots[n];
+            uHole = n;
+        }
+    }
+
+private:
+    bool Grow() {
+        size_t uSize = m_pSlots ? (m_uMask + 1) * 2 : 16;
+        SLOT * pSlots = new SLOT[uSize];
+        if (!pSlots) {
+            return false;
+        }
+        for (size_t n = 0; n < uSize; ++n) {
+            pSlots[n].bUsed = false;
+        }
+        SLOT * pOld = m_pSlots;
+        size_t uOldSize = m_pSlots ? m_uMask + 1 : 0;
+        m_pSlots = pSlots;
+        m_uMask = uSize - 1;
+        m_uCount = 0;
+        for (size_t n = 0; n < uOldSize; ++n) {
+            if (pOld[n].bUsed) {
+                Insert(pOld[n]);
+            }
+        }
+        delete[] pOld;
+        return true;
+    }
+
+    SLOT *  m_pSlots;
+    size_t  m_uMask;
+    size_t  m_uCount;
+
+    // copying is not permitted
+    SI_HashTable(const SI_HashTable &); // disabled
+    SI_HashTable & operator=(const SI_HashTable &); // disabled
+};
+
+
+// ---------------------------------------------------------------------------
+//                                  ARENA
+// ---------------------------------------------------------------------------
+
+/**
+ * Block allocator for strings and map nodes. Memory is carved from large
+ * blocks, and freed memory is kept on a free list for its size so that it
+ * is reused by the next allocation of that size. Allocations larger than
+ * SMALL_MAX bytes are made separately. Reset() frees everything allocated
+ * since SetBase() at once.
+ */
+class SI_Arena {
+public:
+    SI_Arena()
+        : m_pBlocks(NULL), m_pNext(NULL), m_pEnd(NULL), m_pLarge(NULL)
+        , m_pBaseBlock(NULL), m_pBaseNext(NULL), m_uSize(0)
+    {
+        memset(m_pFree, 0, sizeof(m_pFree));
+    }
+    ~SI_Arena() {
+        m_pBaseBlock = NULL;
+        m_pBaseNext = NULL;
+        Reset();
+    }
+
+    /** Keep the memory allocated so far when Reset() is called. This is
+        used for memory that containers allocate when they are constructed
+        and free when they are destroyed. */
+    void SetBase() {
+        m_pBaseBlock = m_pBlocks;
+        m_pBaseNext = m_pNext;
+    }
+
+    /** Allocate memory aligned for any of the types stored in the maps */
+    void * Allocate(size_t a_uSize) {
+        if (a_uSize > SMALL_MAX) {
+            Large * pLarge = (Large *) ::operator new(sizeof(Large) + a_uSize);
+            m_uSize += sizeof(Large) + a_uSize;
+            pLarge->pPrev = NULL;
+            pLarge->pNext = m_pLarge;
+            if (m_pLarge) {
+                m_pLarge->pPrev = pLarge;
+            }
+            m_pLarge = pLarge;
+            return pLarge + 1;
+        }
+        size_t uClass = SizeClass(a_uSize);
+        if (m_pFree[uClass]) {
+            void * p = m_pFree[uClass];
+            m_pFree[uClass] = *(void **) p;
+            return p;
+        }
+        size_t uSize = (uClass + 1) * ALIGN;
+        if ((size_t)(m_pEnd - m_pNext) < uSize) {
+            Block * pBlock = (Block *) ::operator new(BLOCK_SIZE);
+            m_uSize += BLOCK_SIZE;
+            pBlock->pNext = m_pBlocks;
+            m_pBlocks = pBlock;
+            m_pNext = (char *) pBlock + sizeof(Block);
+            m_pEnd = (char *) pBlock + BLOCK_SIZE;
+        }
+        void * p = m_pNext;
+        m_pNext += uSize;
+        return p;
+    }
+
+    /** Return memory from Allocate(), a_uSize must be the size requested */
+    void Free(void * a_p, size_t a_uSize) {
+        if (!a_p) {
+            return;
+        }
+        if (a_uSize > SMALL_MAX) {
+            Large * pLarge = (Large *) a_p - 1;
+            if (pLarge->pPrev) {
+                pLarge->pPrev->pNext = pLarge->pNext;
+            }
+            else {
+                m_pLarge = pLarge->pNext;
+            }
+            if (pLarge->pNext) {
+                pLarge->pNext->pPrev = pLarge->pPrev;
+            }
+            ::operator delete(pLarge);
+            m_uSize -= sizeof(Large) + a_uSize;
+            return;
+        }
+        size_t uClass = SizeClass(a_uSize);
+        *(void **) a_p = m_pFree[uClass];
+        m_pFree[uClass] = a_p;
+    }
+
+    /** Free all memory allocated since SetBase(), which is then invalid */
+    void Reset() {
+        while (m_pBlocks != m_pBaseBlock) {
+            Block * pNext = m_pBlocks->pNext;
+            ::operator delete(m_pBlocks);
+            m_pBlocks = pNext;
+        }
+        while (m_pLarge) {
+            Large * pNext = m_pLarge->pNext;
+            ::operator delete(m_pLarge);
+            m_pLarge = pNext;
+        }
+        m_pNext = m_pBaseNext;
+        m_pEnd = m_pBlocks ? (char *) m_pBlocks + BLOCK_SIZE : NULL;
+        memset(m_pFree, 0, sizeof(m_pFree));
+        m_uSize = 0;
+        for (Block * pBlock = m_pBlocks; pBlock; pBlock = pBlock->pNext) {
+            m_uSize += BLOCK_SIZE;
+        }
+    }
+
+    /** Bytes allocated from the system, including free space in blocks */
+    size_t GetSize() const { return m_uSize; }
+
+private:
+    enum {
+        ALIGN       = 8,
+        SMALL_MAX   = 256,
+        BLOCK_SIZE  = 64 * 1024
+    };
+
+    /** Header of a block, padded so that allocations stay aligned */
+    union Block {
+        Block *     pNext;
+        double      dAlign;
+    };
+
+    /** Header of a large allocation */
+    struct Large {
+        Large *     pPrev;
+        Large *     pNext;
+        double      dAlign;
+    };
+
+    static size_t SizeClass(size_t a_uSize) {
+        return a_uSize ? (a_uSize - 1) / ALIGN : 0;
+    }
+
+    Block *     m_pBlocks;
+    char *      m_pNext;
+    char *      m_pEnd;
+    Large *     m_pLarge;
+    void *      m_pFree[SMALL_MAX / ALIGN];
+    Block *     m_pBaseBlock;
+    char *      m_pBaseNext;
+    size_t      m_uSize;
+
+    // copying is not permitted
+    SI_Arena(const SI_Arena &); // disable
+    SI_Arena & operator=(const SI_Arena &); // disable
+};
+
+/**
+ * Standard allocator that allocates from an SI_Arena. Use it as the SI_ALLOC
+ * parameter of CSimpleIniTempl to store all strings and map nodes in the
+ * arena of each object. Without an arena it uses the global operator new.
+ */
+template<class T>
+class SI_ArenaAllocator {
+public:
+    typedef T               value_type;
+    typedef T *             pointer;
+    typedef const T *       const_pointer;
+    typedef T &             reference;
+    typedef const T &       const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template<class U> struct rebind { typedef SI_ArenaAllocator<U> other; };
+
+    SI_ArenaAllocator(SI_Arena * a_pArena = NULL) throw() : m_pArena(a_pArena) { }
+    template<class U>
+    SI_ArenaAllocator(const SI_ArenaAllocator<U> & a_rhs) throw() : m_pArena(a_rhs.m_pArena) { }
+
+    pointer address(reference a_value) const { return &a_value; }
+    const_pointer address(const_reference a_value) const { return &a_value; }
+    size_type max_size() const throw() { return ((size_t)-1) / sizeof(T); }
+
+    pointer allocate(size_type a_uCount, const void * = 0) {
+        if (!m_pArena) {
+            return (pointer) ::operator new(a_uCount * sizeof(T));
+        }
+        return (pointer) m_pArena->Allocate(a_uCount * sizeof(T));
+    }
+    void deallocate(pointer a_p, size_type a_uCount) {
+        if (!m_pArena) {
+            ::operator delete(a_p);
+            return;
+        }
+        m_pArena->Free(a_p, a_uCount * sizeof(T));
+    }
+    void construct(pointer a_p, const T & a_value) { new((void *) a_p) T(a_value); }
+    void destroy(pointer a_p) { a_p->~T(); }
+
+    bool operator==(const SI_ArenaAllocator & a_rhs) const { return m_pArena == a_rhs.m_pArena; }
+    bool operator!=(const SI_ArenaAllocator & a_rhs) const { return m_pArena != a_rhs.m_pArena; }
+
+    SI_Arena * m_pArena;
+};
+
+/**
+ * How CSimpleIniTempl uses its SI_ALLOC parameter. Any allocator other than
+ * SI_ArenaAllocator is default constructed and strings use new[].
+ */
+template<class SI_ALLOC>
+struct SI_AllocTraits {
+    enum { arena = 0 };
+    static SI_ALLOC Make(SI_Arena *) { return SI_ALLOC(); }
+};
+template<class T>
+struct SI_AllocTraits<SI_ArenaAllocator<T> > {
+    enum { arena = 1 };
+    static SI_ArenaAllocator<T> Make(SI_Arena * a_pArena) {
+        return SI_ArenaAllocator<T>(a_pArena);
+    }
+};
+
+// ---------------------------------------------------------------------------
+//                              MAIN TEMPLATE CLASS
+// ---------------------------------------------------------------------------
+
+/** Simple INI file reader.
+
+    This can be instantiated with the choice of unicode or native characterset,
+    and case sensitive or insensitive comparisons of section and key names.
+    The supported combinations are pre-defined with the following typedefs:
+
+    <table>
+        <tr><th>Interface   <th>Case-sensitive  <th>Typedef
+        <tr><td>char        <td>No              <td>CSimpleIniA
+        <tr><td>char        <td>Yes             <td>CSimpleIniCaseA
+        <tr><td>wchar_t     <td>No              <td>CSimpleIniW
+        <tr><td>wchar_t     <td>Yes             <td>CSimpleIniCaseW
+    </table>
+
+    Note that using other types for the SI_CHAR is supported. For instance,
+    unsigned char, unsigned short, etc. Note that where the alternative type
+    is a different size to char/wchar_t you may need to supply new helper
+    classes for SI_STRLESS and SI_CONVERTER.
+
+    Sections and keys are found by searching the maps. When SI_STRHASH is
+    a hash function such as SI_NoCaseHash or SI_CaseHash, a hash index of
+    all sections and keys is also kept and used for lookups instead. The
+    hash must agree with SI_STRLESS. The typedefs CSimpleIniHashA,
+    CSimpleIniCaseHashA, CSimpleIniHashW and CSimpleIniCaseHashW use it.
+
+    SI_ALLOC is the allocator used by the maps. When it is SI_ArenaAllocator
+    the maps and all copied strings are allocated from an arena owned by
+    the object, see CSimpleIniArenaA and CSimpleIniArenaW.
+ */
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER,
+    class SI_STRHASH = SI_NoHash<SI_CHAR>,
+    class SI_ALLOC = std::allocator<char> >
+class CSimpleIniTempl
+{
+public:
+    /** key entry */
+    struct Entry {
+        const SI_CHAR * pItem;
+        const SI_CHAR * pComment;
+        int             nOrder;
+
+        Entry(const SI_CHAR * a_pszItem = NULL, int a_nOrder = 0)
+            : pItem(a_pszItem)
+            , pComment(NULL)
+            , nOrder(a_nOrder)
+        { }
+        Entry(const SI_CHAR * a_pszItem, const SI_CHAR * a_pszComment, int a_nOrder)
+            : pItem(a_pszItem)
+            , pComment(a_pszComment)
+            , nOrder(a_nOrder)
+        { }
+        Entry(const Entry & rhs) { operator=(rhs); }
+        Entry & operator=(const Entry & rhs) {
+            pItem    = rhs.pItem;
+            pComment = rhs.pComment;
+            nOrder   = rhs.nOrder;
+            return *this;
+        }
+
+#if defined(_MSC_VER) && _MSC_VER <= 1200
+        /** STL of VC6 doesn't allow me to specify my own comparator for list::sort() */
+        bool operator<(const Entry & rhs) const { return LoadOrder()(*this, rhs); }
+        bool operator>(const Entry & rhs) const { return LoadOrder()(rhs, *this); }
+#endif
+
+        /** Strict less ordering by name of key only */
+        struct KeyOrder : std::binary_function<Entry, Entry, bool> {
+            bool operator()(const Entry & lhs, const Entry & rhs) const {
+                const static SI_STRLESS isLess = SI_STRLESS();
+                return isLess(lhs.pItem, rhs.pItem);
+            }
+        };
+
+        /** Strict less ordering by order, and then name of key */
+        struct LoadOrder : std::binary_function<Entry, Entry, bool> {
+            bool operator()(const Entry & lhs, const Entry & rhs) const {
+                if (lhs.nOrder != rhs.nOrder) {
+                    return lhs.nOrder < rhs.nOrder;
+                }
+                return KeyOrder()(lhs.pItem, rhs.pItem);
+            }
+        };
+    };
+
+    /** map keys to values */
+    typedef std::multimap<Entry,const SI_CHAR *,typename Entry::KeyOrder,
+        typename SI_ALLOC::template rebind<
+            std::pair<const Entry,const SI_CHAR *> >::other> TKeyVal;
+
+    /** map sections to key/value map */
+    typedef std::map<Entry,TKeyVal,typename Entry::KeyOrder,
+        typename SI_ALLOC::template rebind<
+            std::pair<const Entry,TKeyVal> >::other> TSection;
+
+    /** set of dependent string pointers. Note that these pointers are
+        dependent on memory owned by CSimpleIni.
+    */
+    typedef std::list<Entry> TNamesDepend;
+
+    /** interface definition for the OutputWriter object to pass to Save()
+        in order to output the INI file data.
+    */
+    class OutputWriter {
+    public:
+        OutputWriter() { }
+        virtual ~OutputWriter() { }
+        virtual void Write(const char * a_pBuf) = 0;
+    private:
+        OutputWriter(const OutputWriter &);             // disable
+        OutputWriter & operator=(const OutputWriter &); // disable
+    };
+
+    /** OutputWriter class to write the INI data to a file */
+    class FileWriter : public OutputWriter {
+        FILE * m_file;
+    public:
+        FileWriter(FILE * a_file) : m_file(a_file) { }
+        void Write(const char * a_pBuf) {
+            fputs(a_pBuf, m_file);
+        }
+    private:
+        FileWriter(const FileWriter &);             // disable
+        FileWriter & operator=(const FileWriter &); // disable
+    };
+
+    /** OutputWriter class to write the INI data to a string */
+    class StringWriter : public OutputWriter {
+        std::string & m_string;
+    public:
+        StringWriter(std::string & a_string) : m_string(a_string) { }
+        void Write(const char * a_pBuf) {
+            m_string.append(a_pBuf);
+        }
+    private:
+        StringWriter(const StringWriter &);             // disable
+        StringWriter & operator=(const StringWriter &); // disable
+    };
+
+#ifdef SI_SUPPORT_IOSTREAMS
+    /** OutputWriter class to write the INI data to an ostream */
+    class StreamWriter : public OutputWriter {
+        std::ostream & m_ostream;
+    public:
+        StreamWriter(std::ostream & a_ostream) : m_ostream(a_ostream) { }
+        void Write(const char * a_pBuf) {
+            m_ostream << a_pBuf;
+        }
+    private:
+        StreamWriter(const StreamWriter &);             // disable
+        StreamWriter & operator=(const StreamWriter &); // disable
+    };
+#endif // SI_SUPPORT_IOSTREAMS
+
+    /** Characterset conversion utility class to convert strings to the
+        same format as is used for the storage.
+    */
+    class Converter : private SI_CONVERTER {
+    public:
+        Converter(bool a_bStoreIsUtf8) : SI_CONVERTER(a_bStoreIsUtf8) {
+            m_scratch.resize(1024);
+        }
+        Converter(const Converter & rhs) { operator=(rhs); }
+        Converter & operator=(const Converter & rhs) {
+            m_scratch = rhs.m_scratch;
+            return *this;
+        }
+        bool ConvertToStore(const SI_CHAR * a_pszString) {
+            size_t uLen = SizeToStore(a_pszString);
+            if (uLen == (size_t)(-1)) {
+                return false;
+            }
+            while (uLen > m_scratch.size()) {
+                m_scratch.resize(m_scratch.size() * 2);
+            }
+            return SI_CONVERTER::ConvertToStore(
+                a_pszString,
+                const_cast<char*>(m_scratch.data()),
+                m_scratch.size());
+        }
+        const char * Data() { return m_scratch.data(); }
+    private:
+        std::string m_scratch;
+    };
+
+public:
+    /*-----------------------------------------------------------------------*/
+
+    /** Default constructor.
+
+        @param a_bIsUtf8     See the method SetUnicode() for details.
+        @param a_bMultiKey   See the method SetMultiKey() for details.
+        @param a_bMultiLine  See the method SetMultiLine() for details.
+     */
+    CSimpleIniTempl(
+        bool a_bIsUtf8    = false,
+        bool a_bMultiKey  = false,
+        bool a_bMultiLine = false
+        );
+
+    /** Destructor */
+    ~CSimpleIniTempl();
+
+    /** Deallocate all memory stored by this object */
+    void Reset();
+
+    /** Has any data been loaded */
+    bool IsEmpty() const { return m_data.empty(); }
+
+    /** Get a counter that changes whenever the data is changed. A value
+        pointer returned by GetValue() or GetAllValues() stays valid for as
+        long as the counter is unchanged, so callers may cache lookups and
+        check the counter before using them.
+     */
+    unsigned long GetGeneration() const { return m_uGeneration; }
+
+    /** Has the data been changed since it was loaded or last saved to a
+        file? Values set with SetValue() and its variants, data loaded on top
+        of existing data, Delete() and Reset() are changes, and so are
+        SetUnicode(), SetMultiLine() and SetSpaces() when they change how
+        loaded data is written. Parsing a lazily loaded section is not. A save by SaveFile() or SaveFileIfModified()
+        makes the data unmodified.
+     */
+    bool IsModified() const { return m_uModified != m_uSavedModified; }
+
+    /** Approximate bytes of memory held by the data: the copy of the file,
+        the arena and the hash indexes. Map nodes and copied strings are only
+        counted when SI_ALLOC allocates them from the arena.
+     */
+    size_t GetMemoryUsage() const {
+        return m_uDataLen * sizeof(SI_CHAR) + m_arena.GetSize()
+            + m_sectionIndex.GetSize() + m_keyIndex.GetSize();
+    }
+
+    /** Mark the data as modified or, with false, as matching the file it
+        was loaded from or saved to. Useful when the data is saved by other
+        means than SaveFile().
+     */
+    void SetModified(bool a_bModified = true) {
+        if (a_bModified) ++m_uModified;
+        else m_uSavedModified = m_uModified;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /** @{ @name Settings */
+
+    /** Set the storage format of the INI data. This affects both the loading
+        and saving of the INI data using all of the Load/Save API functions.
+        This value cannot be changed after any INI data has been loaded.
+
+        If the file is not set to Unicode (UTF-8), then the data encoding is
+        assumed to be the OS native encoding. This encoding is the system
+        locale on Linux/Unix and the legacy MBCS encoding on Windows NT/2K/XP.
+        If the storage format is set to Unicode then the file will be loaded
+        as UTF-8 encoded data regardless of the native file encoding. If
+        SI_CHAR == char then all of the char* parameters take and return UTF-8
+        encoded data regardless of the system locale.
+
+        \param a_bIsUtf8     Assume UTF-8 encoding for the source?
+     */
+    void SetUnicode(bool a_bIsUtf8 = true) {
+        if (!m_pData && m_bStoreIsUtf8 != a_bIsUtf8) {
+            m_bStoreIsUtf8 = a_bIsUtf8;
+            OutputChanged();
+        }
+    }
+
+    /** Get the storage format of the INI data. */
+    bool IsUnicode() const { return m_bStoreIsUtf8; }
+
+    /** Should multiple identical keys be permitted in the file. If set to false
         then the last value encountered will be used as the value of the key.
         If set to true, then all values will be available to be queried. For
         example, with the following input:
@@ -519,7 +1804,10 @@ public:
         \param a_bAllowMultiLine     Allow multi-line values in the source?
      */
     void SetMultiLine(bool a_bAllowMultiLine = true) {
-        m_bAllowMultiLine = a_bAllowMultiLine;
+        if (m_bAllowMultiLine != a_bAllowMultiLine) {
+            m_bAllowMultiLine = a_bAllowMultiLine;
+            OutputChanged();
+        }
     }
 
     /** Query the status of multi-line data */
@@ -532,11 +1820,62 @@ public:
         \param a_bSpaces     Add spaces around the equals sign?
      */
     void SetSpaces(bool a_bSpaces = true) {
-        m_bSpaces = a_bSpaces;
+        if (m_bSpaces != a_bSpaces) {
+            m_bSpaces = a_bSpaces;
+            OutputChanged();
+        }
     }
 
     /** Query the status of spaces output */
     bool UsingSpaces() const { return m_bSpaces; }
+
+    /** Should the keys of each section only be parsed when the section is
+        first used. When set, loading data only finds the start of each
+        section and the keys are parsed by the first function that accesses
+        the section. Because of this the const functions of this class may
+        modify the data and must not be called from multiple threads at
+        once. Data containing multi-line values is always parsed completely.
+        This value may be changed at any time and affects the next load.
+
+        \param a_bLazyLoad  Parse sections when first used?
+     */
+    void SetLazyLoad(bool a_bLazyLoad = true) {
+        m_bLazyLoad = a_bLazyLoad;
+    }
+
+    /** Query the status of lazy loading */
+    bool IsLazyLoad() const { return m_bLazyLoad; }
+
+    /** Should LoadFile() remember where each section is in the file, so
+        that SaveFileIncremental() can rewrite only the sections that
+        changed. This is only possible when SI_CHAR is char and the converter
+        is SI_ConvertA, and costs a pass over the file data. This value may
+        be changed at any time and affects the next load.
+
+        \param a_bIncremental  Remember the layout of loaded files?
+     */
+    void SetIncrementalSave(bool a_bIncremental = true) {
+        m_bIncrementalSave = a_bIncremental;
+    }
+
+    /** Query the status of incremental saving */
+    bool IsIncrementalSave() const { return m_bIncrementalSave; }
+
+#ifdef SI_SUPPORT_THREADS
+    /** Set the number of threads used to parse large files. The data is
+        parsed by a single thread when this is 1, which is the default. If
+        it is 0 then one thread per processor is used. This value may be
+        changed at any time.
+
+        \param a_nThreads   Maximum number of threads used by a load
+     */
+    void SetParallelLoad(int a_nThreads = 0) {
+        m_nLoadThreads = a_nThreads < 0 ? 1 : a_nThreads;
+    }
+
+    /** Query the number of threads used to parse large files */
+    int GetParallelLoad() const { return m_nLoadThreads; }
+#endif // SI_SUPPORT_THREADS
     
     /*-----------------------------------------------------------------------*/
     /** @}
@@ -552,7 +1891,10 @@ public:
      */
     SI_Error LoadFile(
         const char * a_pszFile
-        );
+        )
+    {
+        return LoadFile(a_pszFile, NULL, NULL);
+    }
 
 #ifdef SI_HAS_WIDE_FILE
     /** Load an INI file from disk into memory
@@ -575,6 +1917,72 @@ public:
     */
     SI_Error LoadFile(
         FILE * a_fpFile
+        )
+    {
+        return LoadFile(a_fpFile, NULL, NULL);
+    }
+
+#ifdef SI_SUPPORT_MMAP
+    /** Load an INI file by mapping it into memory. The file data is parsed
+        directly in a private copy-on-write view of the file, so no copy of
+        the data is made. This is only possible when SI_CHAR is char, the
+        converter is SI_ConvertA and no data has been loaded yet. In all
+        other cases this is the same as LoadFile().
+
+        The view stays mapped until Reset() or the object is destroyed.
+        It still reads the file during that time, so the file must not be
+        truncated or rewritten by anything else. Saving to the same file by
+        path with SaveFile(), SaveFileIfModified() or SaveFileIncremental()
+        first copies the view to memory of its own at the same address. On
+        Windows a mapped file can't be rewritten, and these return SI_FILE
+        instead. Use LoadFile() for files which will be saved back to the
+        same path on Windows, or which are written to by others.
+
+        @param a_pszFile    Path of the file to be loaded.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFileMapped(
+        const char * a_pszFile
+        );
+#endif // SI_SUPPORT_MMAP
+
+    /** Load data from a cache file written by SaveCache(). The cache is
+        only used if it was saved by an object of the same type with the
+        same settings, and the source file still has the size it had then,
+        as well as the same modification time or the same contents. The
+        contents are compared if the time is ambiguous, see
+        SI_IsStampAmbiguous(). The strings are used directly from the cache
+        data, which is mapped into memory if SI_SUPPORT_MMAP is defined.
+        On Windows it is always read into memory instead, as a cache that
+        is mapped couldn't be replaced by SaveCache(). No data may have
+        been loaded.
+
+        @param a_pszCacheFile   Path of the cache file.
+        @param a_pszSourceFile  Path of the INI file that the cache was saved
+                                for.
+
+        @return SI_Error    See error definitions. SI_FAIL is returned if the
+                            cache is missing, out of date or for other data.
+     */
+    SI_Error LoadCache(
+        const char * a_pszCacheFile,
+        const char * a_pszSourceFile
+        );
+
+    /** Load an INI file using a cache file. If the cache is valid for the
+        file then it is loaded with LoadCache(), otherwise the file is loaded
+        and the cache is saved for the next time. Failing to save the cache
+        is not an error.
+
+        @param a_pszFile        Path of the file to be loaded.
+        @param a_pszCacheFile   Path of its cache file.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFileCached(
+        const char * a_pszFile,
+        const char * a_pszCacheFile
         );
 
 #ifdef SI_SUPPORT_IOSTREAMS
@@ -611,6 +2019,37 @@ public:
         size_t          a_uDataLen
         );
 
+    /** Start loading INI data incrementally. The data is supplied in chunks
+        of any size by calling Feed() and the load is completed by calling
+        EndLoad(). Any incremental load already in progress is discarded.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error BeginLoad();
+
+    /** Supply the next chunk of data for an incremental load started with
+        BeginLoad(). All entries that are completed by this chunk are added
+        to the data before this function returns. Incomplete lines are kept
+        until the following chunk.
+
+        @param a_pData      Data to be loaded
+        @param a_uDataLen   Length of the data in bytes
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Feed(
+        const char *    a_pData,
+        size_t          a_uDataLen
+        );
+
+    /** Complete an incremental load started with BeginLoad(). Any data
+        remaining from the last call to Feed() is parsed as the end of the
+        file.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error EndLoad();
+
     /*-----------------------------------------------------------------------*/
     /** @}
         @{ @name Saving INI Data */
@@ -632,6 +2071,52 @@ public:
         bool            a_bAddSignature = true
         ) const;
 
+    /** Save an INI file from memory to disk, but only if the data has been
+        modified (see IsModified()) and the file doesn't already contain the
+        same bytes. The data is first saved to memory and compared with the
+        file, so that an edit that was undone doesn't touch the disk.
+
+        @param a_pszFile    Path of the file to be saved.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
+                            in UTF-8 format. If it is not UTF-8 then
+                            this parameter is ignored.
+
+        @return SI_Error    See error definitions
+        @return SI_OK       The file was already up to date
+        @return SI_UPDATED  The file was written
+     */
+    SI_Error SaveFileIfModified(
+        const char *    a_pszFile,
+        bool            a_bAddSignature = true
+        ) const;
+
+    /** Save an INI file from memory to disk, but only if the data has been
+        modified (see IsModified()). If the file is the one that was last
+        loaded (see SetIncrementalSave()) or saved by this function, and it
+        still has the size and modification time it had then, the sections
+        that haven't changed are kept as they are in the file. The file is
+        only rewritten from the first section that was changed, deleted or
+        is new, and new sections are added at the end of the file. In all
+        other cases the whole file is written as by SaveFile(), and its
+        layout is remembered for the next time.
+
+        @param a_pszFile    Path of the file to be saved.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
+                            in UTF-8 format and the whole file is written.
+                            If it is not UTF-8 then this parameter is
+                            ignored.
+
+        @return SI_Error    See error definitions
+        @return SI_OK       The file was already up to date
+        @return SI_UPDATED  The file was written
+     */
+    SI_Error SaveFileIncremental(
+        const char *    a_pszFile,
+        bool            a_bAddSignature = true
+        ) const;
+
 #ifdef SI_HAS_WIDE_FILE
     /** Save an INI file from memory to disk
 
@@ -744,6 +2229,28 @@ public:
         return Save(writer, a_bAddSignature);
     }
 
+    /** Save the data in binary form to a cache file for LoadCache(). This
+        should be called right after loading the source file, as the cache
+        is only checked against the source file and not against the data.
+        LoadFileCached() doesn't have that problem, as it saves the cache
+        with the stamp of the file from before it was read.
+        The cache is written to a temporary file which then replaces it, so
+        other threads and processes never see it half written. On POSIX an
+        object that has the old cache mapped keeps the old contents. On
+        Windows a cache file is never left mapped, but it can't be replaced
+        while another process has it open, and SI_FILE is returned.
+
+        @param a_pszCacheFile   Path of the cache file.
+        @param a_pszSourceFile  Path of the INI file that the data was
+                                loaded from.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveCache(
+        const char * a_pszCacheFile,
+        const char * a_pszSourceFile
+        ) const;
+
     /*-----------------------------------------------------------------------*/
     /** @}
         @{ @name Accessing INI Data */
@@ -810,6 +2317,65 @@ public:
         TNamesDepend &  a_values
         ) const;
 
+    /** Call a visitor for each section without building a list of them.
+        The visitor is called as a_visitor(const Entry & section) and returns
+        true to continue or false to stop. The entries and the strings they
+        point to must not be changed or deleted during the walk.
+
+        @param a_visitor        Function object to call
+        @param a_bLoadOrder     Visit in load order rather than name order.
+                                 The load order is kept up to date as the
+                                 data changes, so this is a walk in place too.
+
+        @return true            All sections were visited.
+        @return false           The visitor stopped the walk.
+     */
+    template<class VISITOR>
+    bool VisitSections(
+        VISITOR &       a_visitor,
+        bool            a_bLoadOrder = false
+        ) const;
+
+    /** Call a visitor for each unique key in a section, as GetAllKeys()
+        would return them, without building a list. The visitor is called as
+        a_visitor(const Entry & key) with the first entry of each key, and
+        returns true to continue or false to stop.
+
+        @param a_pSection       Section to walk
+        @param a_visitor        Function object to call
+        @param a_bLoadOrder     Visit in load order rather than name order
+
+        @return true            All keys were visited.
+        @return false           The section wasn't found, or the visitor
+                                 stopped the walk.
+     */
+    template<class VISITOR>
+    bool VisitKeys(
+        const SI_CHAR * a_pSection,
+        VISITOR &       a_visitor,
+        bool            a_bLoadOrder = false
+        ) const;
+
+    /** Call a visitor for each value of a key, in load order, as
+        GetAllValues() would return them, without building a list. The
+        visitor is called as a_visitor(const Entry & value), pItem being the
+        value, and returns true to continue or false to stop.
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_visitor        Function object to call
+
+        @return true            All values were visited.
+        @return false           The key wasn't found, or the visitor stopped
+                                 the walk.
+     */
+    template<class VISITOR>
+    bool VisitValues(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        VISITOR &       a_visitor
+        ) const;
+
     /** Query the number of keys in a specific section. Note that if multiple
         keys are enabled, then this value may be different to the number of
         keys returned by GetAllKeys.
@@ -847,7 +2413,8 @@ public:
 
         NOTE! The returned value is a pointer to string data stored in memory
         owned by CSimpleIni. Ensure that the CSimpleIni object is not destroyed
-        or Reset while you are using this pointer!
+        or Reset, and that this key is not updated or deleted, while you are
+        using this pointer!
 
         @param a_pSection       Section to search
         @param a_pKey           Key to search for
@@ -955,6 +2522,10 @@ public:
                             with a_bForceReplace = true, is that the load 
                             order and comment will be preserved this way.
 
+        When a value is updated, the memory of the previous value is reused
+        for the new value if it is large enough, otherwise it is freed. Any
+        pointer to the previous value becomes invalid.
+
         @return SI_Error    See error definitions
         @return SI_UPDATED  Value was updated
         @return SI_INSERTED Value was inserted
@@ -1073,35 +2644,367 @@ public:
                                 been deleted, should the empty section be
                                 removed?
 
-        @return true            Key or section was deleted.
-        @return false           Key or section was not found.
-     */
-    bool Delete(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        bool            a_bRemoveEmpty = false
+        @return true            Key or section was deleted.
+        @return false           Key or section was not found.
+     */
+    bool Delete(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        bool            a_bRemoveEmpty = false
+        );
+
+    /*-----------------------------------------------------------------------*/
+    /** @}
+        @{ @name Converter */
+
+    /** Return a conversion object to convert text to the same encoding
+        as is used by the Save(), SaveFile() and SaveString() functions.
+        Use this to prepare the strings that you wish to append or prepend
+        to the output INI data.
+     */
+    Converter GetConverter() const {
+        return Converter(m_bStoreIsUtf8);
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /** @} */
+
+private:
+    // copying is not permitted
+    CSimpleIniTempl(const CSimpleIniTempl &); // disabled
+    CSimpleIniTempl & operator=(const CSimpleIniTempl &); // disabled
+
+    /** Parse a NULL terminated block of data in our character format and
+        add every entry to our data. The data is modified in place. The
+        caller remains responsible for the memory.
+    */
+    SI_Error ParseData(
+        SI_CHAR *       a_pData,
+        bool            a_bCopyStrings
+        ) {
+        const SI_CHAR * pSection = EmptySection();
+        return ParseData(a_pData, a_bCopyStrings, true, pSection);
+    }
+
+    /** Parse a block of data as above. The block starts in the section
+        a_pSection, which is updated to the section that the block ends in.
+        The file comment is only looked for if a_bFileStart is true.
+    */
+    SI_Error ParseData(
+        SI_CHAR *           a_pData,
+        bool                a_bCopyStrings,
+        bool                a_bFileStart,
+        const SI_CHAR *&    a_pSection
+        );
+
+    /** Add every entry in a block of data that has already had the file
+        comment removed. This is the body of ParseData().
+    */
+    SI_Error ParseEntries(
+        SI_CHAR *           a_pData,
+        bool                a_bCopyStrings,
+        const SI_CHAR *&    a_pSection
+        );
+
+    /** Parse the entries before the first section and find where each
+        section starts. The keys of each section are parsed by
+        LoadLazySection() when the section is first used.
+    */
+    SI_Error ParseLazy(
+        SI_CHAR *           a_pData,
+        const SI_CHAR *&    a_pSection
+        );
+
+    /** Parse the keys of a section that were deferred by ParseLazy() */
+    void LoadLazySection(const SI_CHAR * a_pSection);
+
+    /** Find a section, first parsing its keys if they have been deferred */
+    typename TSection::iterator FindSection(const SI_CHAR * a_pSection) {
+        typename TSection::iterator iSection = UseIndex() ?
+            FindIndexedSection(a_pSection) : m_data.find(a_pSection);
+        if (!m_lazy.empty() && iSection != m_data.end()) {
+            LoadLazySection(iSection->first.pItem);
+        }
+        return iSection;
+    }
+    typename TSection::const_iterator FindSection(const SI_CHAR * a_pSection) const {
+        return const_cast<CSimpleIniTempl *>(this)->FindSection(a_pSection);
+    }
+
+    /** Find the first key with a name in a section */
+    typename TKeyVal::iterator FindKey(TKeyVal & a_keyval, const SI_CHAR * a_pKey) {
+        return UseIndex() ?
+            FindIndexedKey(a_keyval, a_pKey) : a_keyval.find(a_pKey);
+    }
+    typename TKeyVal::const_iterator FindKey(const TKeyVal & a_keyval, const SI_CHAR * a_pKey) const {
+        return const_cast<CSimpleIniTempl *>(this)->FindKey(
+            const_cast<TKeyVal &>(a_keyval), a_pKey);
+    }
+
+    /** Slot of the hash index of sections */
+    struct SectionSlot {
+        size_t                      uHash;
+        bool                        bUsed;
+        typename TSection::iterator iSection;
+    };
+
+    /** Slot of the hash index of keys. A slot refers to the first of the
+        keys with the same name in a section. */
+    struct KeySlot {
+        size_t                      uHash;
+        bool                        bUsed;
+        const TKeyVal *             pOwner;
+        typename TKeyVal::iterator  iKey;
+    };
+
+    /** Do two names compare equal? */
+    static bool IsSameName(const SI_CHAR * a_pLeft, const SI_CHAR * a_pRight) {
+        const static SI_STRLESS isLess = SI_STRLESS();
+        return !isLess(a_pLeft, a_pRight) && !isLess(a_pRight, a_pLeft);
+    }
+
+    struct SectionMatch {
+        const SI_CHAR * pSection;
+        bool operator()(const SectionSlot & a_slot) const {
+            return IsSameName(pSection, a_slot.iSection->first.pItem);
+        }
+    };
+
+    struct KeyMatch {
+        const TKeyVal * pOwner;
+        const SI_CHAR * pKey;
+        bool operator()(const KeySlot & a_slot) const {
+            return a_slot.pOwner == pOwner
+                && IsSameName(pKey, a_slot.iKey->first.pItem);
+        }
+    };
+
+    /** Hash of a key name in a section */
+    static size_t KeyHash(const TKeyVal * a_pOwner, const SI_CHAR * a_pKey) {
+        return SI_STRHASH()(a_pKey)
+            ^ (((size_t) a_pOwner >> 4) * (size_t) 2654435761u);
+    }
+
+    /** Is the hash index in use? It is rebuilt first if it is stale. */
+    bool UseIndex() {
+        if (!SI_STRHASH::enabled) {
+            return false;
+        }
+        if (m_bIndexStale) {
+            RebuildIndex();
+        }
+        return !m_bIndexStale;
+    }
+
+    typename TSection::iterator FindIndexedSection(const SI_CHAR * a_pSection);
+    typename TKeyVal::iterator FindIndexedKey(TKeyVal & a_keyval, const SI_CHAR * a_pKey);
+
+    /** Add a section, or the first key with a name in a section, to the
+        hash index. */
+    void IndexSection(typename TSection::iterator a_iSection);
+    void IndexKey(TKeyVal & a_keyval, typename TKeyVal::iterator a_iKey);
+
+    /** Remove a section and all of its keys, or all keys with a name in a
+        section, from the hash index. This must be done before they are
+        erased from the maps. */
+    void UnindexSection(typename TSection::iterator a_iSection);
+    void UnindexKey(TKeyVal & a_keyval, const SI_CHAR * a_pKey);
+
+    /** Build the hash index from scratch */
+    void RebuildIndex();
+
+    /** A section and the first key of each name in it, in load order */
+    struct SectionOrder {
+        typename TSection::const_iterator               iSection;
+        std::vector<typename TKeyVal::const_iterator>   keys;
+    };
+    typedef std::deque<SectionOrder> TOrder;
+
+    /** Orders sections and keys by Entry::LoadOrder */
+    struct OrderLess {
+        static const Entry & Get(const Entry & a) { return a; }
+        static const Entry & Get(const SectionOrder & a) { return a.iSection->first; }
+        static const Entry & Get(const typename TSection::const_iterator & a) { return a->first; }
+        static const Entry & Get(const typename TKeyVal::const_iterator & a) { return a->first; }
+        template<class L, class R>
+        bool operator()(const L & lhs, const R & rhs) const {
+            return typename Entry::LoadOrder()(Get(lhs), Get(rhs));
+        }
+    };
+
+    /** Make the load order usable. It is rebuilt first if it is stale. */
+    void UseOrder() {
+        if (m_bOrderStale) {
+            RebuildOrder();
+        }
+    }
+
+    /** Find the load order entry of a section, NULL if there isn't one */
+    SectionOrder * FindOrder(const Entry & a_section);
+
+    /** Add a section, or the first key with a name in a section, to the
+        load order. */
+    void OrderSection(typename TSection::iterator a_iSection);
+    void OrderKey(typename TSection::iterator a_iSection, typename TKeyVal::iterator a_iKey);
+
+    /** Remove a section, or the first key with a name in a section, from
+        the load order. This must be done before they are erased from the
+        maps. */
+    void UnorderSection(typename TSection::iterator a_iSection);
+    void UnorderKey(typename TSection::iterator a_iSection, typename TKeyVal::iterator a_iKey);
+
+    /** Build the load order from scratch */
+    void RebuildOrder();
+
+    /** Find the place to split the data for the next section line after
+        a_pFrom. Comments before the section line stay with the section and
+        the split is always after a_pLimit. Returns NULL if there is no such
+        section line. a_bBadSection is set if an invalid section line is
+        found on the way.
+    */
+    SI_CHAR * FindSectionSplit(
+        SI_CHAR *       a_pFrom,
+        SI_CHAR *       a_pLimit,
+        bool &          a_bBadSection
+        ) const;
+
+    /** Is multi-line data allowed and does the data contain a multi-line
+        value? Section lines can only be found by a full parse if so. */
+    bool HasMultiLineTag(const SI_CHAR * a_pData) const;
+
+#ifdef SI_SUPPORT_THREADS
+    /** Split a block of data at section boundaries and parse the pieces in
+        parallel. The strings are never copied. Falls back to ParseEntries()
+        if the data can't be split.
+    */
+    SI_Error ParseParallel(
+        SI_CHAR *           a_pData,
+        const SI_CHAR *&    a_pSection
+        );
+
+    /** Move all sections and keys parsed by another object into this one,
+        as if they had been added after our existing entries. */
+    void MergeData(CSimpleIniTempl & a_oOther);
+
+    /** Work for one thread of ParseParallel() */
+    struct ParseTask {
+        CSimpleIniTempl *   pIni;
+        SI_CHAR *           pData;
+        SI_CHAR *           pEnd;   //!< after the NULL that ends the piece
+        const SI_CHAR *     pSection;
+        SI_Error            rc;
+    };
+    static void RunParseTask(void * a_pTask) {
+        // the scanner must not read the pieces of the other threads
+        ParseTask * pTask = (ParseTask *) a_pTask;
+        typename SI_ScanBounds<SI_CHAR>::Range scan(
+            pTask->pIni->m_scan, pTask->pData, pTask->pEnd);
+        pTask->rc = pTask->pIni->ParseEntries(
+            pTask->pData, false, pTask->pSection);
+    }
+#endif // SI_SUPPORT_THREADS
+
+    /** SI_CacheFlags for the settings of this object */
+    unsigned int CacheFlags() const {
+        return (m_bStoreIsUtf8 ? SI_CACHE_UTF8 : 0)
+            | (m_bAllowMultiKey ? SI_CACHE_MULTIKEY : 0)
+            | (m_bAllowMultiLine ? SI_CACHE_MULTILINE : 0);
+    }
+
+    /** Size of a cache file with this header, or 0 if it is too large */
+    static size_t CacheSize(const SI_CacheHeader & a_header) {
+        double dSize = (double) sizeof(SI_CacheHeader)
+            + (double) sizeof(SI_CacheSection) * a_header.uSections
+            + (double) sizeof(SI_CacheKey) * a_header.uKeys
+            + (double) sizeof(SI_CHAR) * a_header.uStrings;
+        return dSize < (double) (size_t) -1 ? (size_t) dSize : 0;
+    }
+
+    /** Is a cache header for our settings and for the current source? */
+    bool IsCacheValid(
+        const SI_CacheHeader &  a_header,
+        const char *            a_pszSourceFile,
+        const unsigned int      a_uSize[2],
+        const unsigned int      a_uTime[3]
+        ) const;
+
+    /** Check the tables of a cache file and add their data */
+    SI_Error LoadCacheTables(
+        const SI_CacheHeader &  a_header,
+        const SI_CacheSection * a_pSections,
+        const SI_CacheKey *     a_pKeys,
+        SI_CHAR *               a_pStrings
+        );
+
+    /** Add a string to the string data of a cache, returning its offset */
+    static unsigned int AddCacheString(
+        SI_CHAR *           a_pStrings,
+        size_t &            a_uUsed,
+        const SI_CHAR *     a_pString
+        )
+    {
+        if (!a_pString) {
+            return 0;
+        }
+        size_t uSize = StrLen(a_pString) + 1;
+        unsigned int uOffset = (unsigned int) a_uUsed;
+        memcpy(a_pStrings + a_uUsed, a_pString, sizeof(SI_CHAR)*uSize);
+        a_uUsed += uSize;
+        return uOffset;
+    }
+
+    /** LoadFile() that also adds the bytes that were read to the hash
+        *a_pHash and returns their number in *a_pSize, unless they are
+        NULL. Neither is changed for an empty file. */
+    SI_Error LoadFile(
+        const char *    a_pszFile,
+        unsigned int *  a_pHash,
+        size_t *        a_pSize
+        );
+    SI_Error LoadFile(
+        FILE *          a_fpFile,
+        unsigned int *  a_pHash,
+        size_t *        a_pSize
         );
 
-    /*-----------------------------------------------------------------------*/
-    /** @}
-        @{ @name Converter */
+    /** SaveCache() with the stamp of the source file from before it was
+        read and the hash of the bytes that were parsed. a_bHashAlways is
+        true if the stamp can't tell versions of the file apart, see
+        SI_IsStampAmbiguous(). */
+    SI_Error SaveCache(
+        const char *        a_pszCacheFile,
+        const unsigned int  a_uSourceSize[2],
+        const unsigned int  a_uSourceTime[3],
+        unsigned int        a_uSourceHash,
+        bool                a_bHashAlways
+        ) const;
 
-    /** Return a conversion object to convert text to the same encoding
-        as is used by the Save(), SaveFile() and SaveString() functions.
-        Use this to prepare the strings that you wish to append or prepend
-        to the output INI data.
-     */
-    Converter GetConverter() const {
-        return Converter(m_bStoreIsUtf8);
-    }
+    /** Convert a block of data from the storage format and parse it. The
+        converted block is kept as our data if we don't already have any,
+        otherwise the strings are copied from it and it is freed.
+    */
+    SI_Error LoadBlock(
+        const char *        a_pData,
+        size_t              a_uDataLen,
+        bool                a_bFileStart,
+        const SI_CHAR *&    a_pSection
+        );
 
-    /*-----------------------------------------------------------------------*/
-    /** @} */
+    /** Scan the lines of the incremental load buffer that have not been
+        scanned yet and return the offset just past the last line that
+        completes an entry, or 0 if there is none.
+    */
+    size_t FindFeedCut();
 
-private:
-    // copying is not permitted
-    CSimpleIniTempl(const CSimpleIniTempl &); // disabled
-    CSimpleIniTempl & operator=(const CSimpleIniTempl &); // disabled
+    /** Does a line of the incremental load buffer match the tag that ends
+        the open multi-line value? */
+    bool IsFeedTagLine(const char * a_pLine, size_t a_uLen) const;
+
+    /** Name of the unnamed section at the start of the file */
+    static const SI_CHAR * EmptySection() {
+        const static SI_CHAR empty = 0;
+        return &empty;
+    }
 
     /** Parse the data looking for a file comment and store it if found.
     */
@@ -1164,17 +3067,78 @@ private:
     }
 
 
+    /** Find the first NULL or newline character, or a_cStop if supplied */
+    inline SI_CHAR * FindLineEnd(SI_CHAR * a_pData, SI_CHAR a_cStop = 0) const {
+        return m_scan.FindLineEnd(a_pData, a_cStop);
+    }
+
     /** Skip over a newline character (or characters) for either DOS or UNIX */
     inline void SkipNewLine(SI_CHAR *& a_pData) const {
         a_pData += (*a_pData == '\r' && *(a_pData+1) == '\n') ? 2 : 1;
     }
 
+    /** Get ready to write a file. If it is the file that our data is
+        mapped from then the view is separated from it first, as it would
+        change or fault when the file is written. Returns SI_FILE if that
+        isn't possible. */
+    template<class SI_PATH_CHAR>
+    SI_Error UnshareFile(const SI_PATH_CHAR * a_pszFile) const {
+#ifdef SI_SUPPORT_MMAP
+        SI_FileId id;
+        if (m_bMapShared && SI_GetFileId(a_pszFile, id)
+            && SI_IsSameFile(id, m_mapId))
+        {
+            if (!SI_UnshareView(m_pMapView, m_uMapLen)) {
+                return SI_FILE;
+            }
+            m_bMapShared = false;
+        }
+#else
+        (void) a_pszFile;
+#endif // SI_SUPPORT_MMAP
+        return SI_OK;
+    }
+
+    /** Empty key/value map that allocates the same way as m_data */
+    TKeyVal NewKeyVal() {
+        return TKeyVal(typename Entry::KeyOrder(),
+            typename TKeyVal::allocator_type(SI_AllocTraits<SI_ALLOC>::Make(&m_arena)));
+    }
+
+    /** Length of a string, not including the NULL */
+    static size_t StrLen(const SI_CHAR * a_pString) {
+        if (sizeof(SI_CHAR) == sizeof(char)) {
+            return strlen((const char *)a_pString);
+        }
+        if (sizeof(SI_CHAR) == sizeof(wchar_t)) {
+            return wcslen((const wchar_t *)a_pString);
+        }
+        size_t uLen = 0;
+        for ( ; a_pString[uLen]; ++uLen) /*loop*/ ;
+        return uLen;
+    }
+
+    /** Header in front of each string copied by CopyString(). The copies
+        are kept in a doubly linked list so that DeleteString() can remove
+        one without searching for it. */
+    struct StringHeader {
+        StringHeader *  pPrev;
+        StringHeader *  pNext;
+        size_t          uCapacity;  //!< characters, including the NULL
+    };
+
     /** Make a copy of the supplied string, replacing the original pointer */
     SI_Error CopyString(const SI_CHAR *& a_pString);
 
-    /** Delete a string from the copied strings buffer if necessary */
+    /** Delete a string if it is a copy. a_pString must be NULL, a string
+        in the data block, or a string returned by CopyString(). */
     void DeleteString(const SI_CHAR * a_pString);
 
+    /** Overwrite a string returned by CopyString() with a_pNew if it fits.
+        a_pString must be NULL, a string in the data block, or a string
+        returned by CopyString(). */
+    bool OverwriteString(const SI_CHAR * a_pString, const SI_CHAR * a_pNew);
+
     /** Internal use of our string comparison function */
     bool IsLess(const SI_CHAR * a_pLeft, const SI_CHAR * a_pRight) const {
         const static SI_STRLESS isLess = SI_STRLESS();
@@ -1197,6 +3161,140 @@ private:
         const SI_CHAR * a_pText
         ) const;
 
+    /** Write the comment, header and keys of a section as Save() does */
+    bool OutputSection(
+        OutputWriter &  a_oOutput,
+        Converter &     a_oConverter,
+        const Entry &   a_section
+        ) const;
+
+    /** Write one value of a key and its comment as Save() does */
+    bool OutputValue(
+        OutputWriter &  a_oOutput,
+        Converter &     a_oConverter,
+        const Entry &   a_key,
+        const Entry &   a_value
+        ) const;
+
+    /** Visitor for Save(): writes each section, separated by blank lines */
+    class SectionOutput {
+    public:
+        SectionOutput(const CSimpleIniTempl & a_ini, OutputWriter & a_oOutput,
+            Converter & a_oConverter, bool a_bNeedNewLine)
+            : m_ini(a_ini), m_oOutput(a_oOutput), m_oConverter(a_oConverter)
+            , m_bNeedNewLine(a_bNeedNewLine) { }
+        bool operator()(const Entry & a_section) {
+            if (m_bNeedNewLine) {
+                m_oOutput.Write(SI_NEWLINE_A);
+                m_oOutput.Write(SI_NEWLINE_A);
+            }
+            m_bNeedNewLine = true;
+            return m_ini.OutputSection(m_oOutput, m_oConverter, a_section);
+        }
+    private:
+        const CSimpleIniTempl & m_ini;
+        OutputWriter &  m_oOutput;
+        Converter &     m_oConverter;
+        bool            m_bNeedNewLine;
+        SectionOutput & operator=(const SectionOutput &); // disable
+    };
+
+    /** Visitor for SaveFileIncremental(): collects the sections that are
+        not in the recorded layout */
+    class NewSections {
+    public:
+        NewSections(const CSimpleIniTempl & a_ini, bool a_bAll,
+            std::vector<const Entry *> & a_sections)
+            : m_ini(a_ini), m_bAll(a_bAll), m_sections(a_sections) { }
+        bool operator()(const Entry & a_section) {
+            if (m_bAll || m_ini.m_layoutIndex.find(a_section.pItem)
+                == m_ini.m_layoutIndex.end())
+            {
+                m_sections.push_back(&a_section);
+            }
+            return true;
+        }
+    private:
+        const CSimpleIniTempl &         m_ini;
+        bool                            m_bAll;
+        std::vector<const Entry *> &    m_sections;
+        NewSections & operator=(const NewSections &); // disable
+    };
+
+    /** Byte range of a section in the file that was last loaded or saved,
+        from the start of its comment or header to the start of the next
+        section. The first range is the text before the first section. */
+    struct SectionSpan {
+        const SI_CHAR * pSection;   //!< section name, NULL if none
+        size_t          uStart;     //!< offset of the first byte
+        size_t          uEnd;       //!< offset after the last byte
+        bool            bDirty;     //!< keys changed since then
+        bool            bDeleted;   //!< section deleted since then
+    };
+    typedef std::vector<SectionSpan> TLayout;
+
+    /** Orders section spans by their position in the file */
+    struct SpanOrder {
+        bool operator()(const SectionSpan & lhs, const SectionSpan & rhs) const {
+            return lhs.uStart < rhs.uStart;
+        }
+    };
+
+    /** Remember the layout of a file that has just been loaded into an
+        empty object, a_pFile being the file data that was parsed in place.
+        Nothing is remembered if a section is in more than one part of the
+        file, as it couldn't be rewritten on its own. */
+    void RecordLayout(
+        const char *    a_pszFile,
+        const SI_CHAR * a_pFile,
+        size_t          a_uLen
+        );
+
+    /** Use a new layout for a file and remember its size and time */
+    void SetLayout(
+        const char *    a_pszFile,
+        TLayout &       a_layout
+        ) const;
+
+    /** Does the text of a span of the file end with a comment line? Such
+        a comment at the end of the file isn't part of any section. */
+    bool SpanEndsInComment(
+        const char *        a_pszFile,
+        const SectionSpan & a_span
+        ) const;
+
+    /** Note that a setting which changes how the data is written has
+        changed. Unless there is no data yet, the data is then modified and
+        the next incremental save writes the whole file. */
+    void OutputChanged() {
+        if (!m_data.empty()) {
+            ++m_uModified;
+            ClearLayout();
+        }
+    }
+
+    /** Forget the layout of the file */
+    void ClearLayout() const {
+        m_layout.clear();
+        m_layoutIndex.clear();
+    }
+
+    /** Note that the keys of a section have changed or, if a_bDeleted is
+        true, that the section has been deleted */
+    void LayoutChanged(const SI_CHAR * a_pSection, bool a_bDeleted) {
+        typename TLayoutIndex::iterator i = m_layoutIndex.find(a_pSection);
+        if (i == m_layoutIndex.end()) {
+            return;
+        }
+        if (a_bDeleted) {
+            m_layout[i->second].bDeleted = true;
+            m_layoutIndex.erase(i);
+        }
+        else {
+            m_layout[i->second].bDirty = true;
+        }
+    }
+
 private:
     /** Copy of the INI file data in our character format. This will be
         modified when parsed to have NULL characters added after all
@@ -1211,17 +3309,39 @@ private:
      */
     size_t m_uDataLen;
 
+    /** Bounds of the buffer that is being parsed */
+    mutable SI_ScanBounds<SI_CHAR> m_scan;
+
+#ifdef SI_SUPPORT_MMAP
+    /** File view that m_pData points into when loaded by LoadFileMapped(),
+        otherwise NULL. */
+    void * m_pMapView;
+
+    /** Size of the file view. */
+    size_t m_uMapLen;
+
+    /** Identity of the file that is mapped */
+    SI_FileId m_mapId;
+
+    /** Does the view still read the file? See SI_UnshareView(). */
+    mutable bool m_bMapShared;
+#endif // SI_SUPPORT_MMAP
+
     /** File comment for this data, if one exists. */
     const SI_CHAR * m_pFileComment;
 
+    /** Memory for the maps and copied strings if SI_ALLOC is an
+        SI_ArenaAllocator. This must be declared before the maps. */
+    SI_Arena m_arena;
+
     /** Parsed INI data. Section -> (Key -> Value). */
     TSection m_data;
 
-    /** This vector stores allocated memory for copies of strings that have
-        been supplied after the file load. It will be empty unless SetValue()
-        has been called.
+    /** List of the copies of strings that have been supplied after the file
+        load, most recent first. It will be empty unless SetValue() has been
+        called. Arena strings are not included.
      */
-    TNamesDepend m_strings;
+    StringHeader * m_pStrings;
 
     /** Is the format of our datafile UTF-8 or MBCS? */
     bool m_bStoreIsUtf8;
@@ -1239,61 +3359,172 @@ private:
         same order that they are loaded/added.
      */
     int m_nOrder;
+
+    /** Incremented by every change to the data. See GetGeneration(). */
+    unsigned long m_uGeneration;
+
+    /** Incremented by every modification, see IsModified(), and its value
+        at the last save to a file. */
+    unsigned long m_uModified;
+    mutable unsigned long m_uSavedModified;
+
+    /** State of an incremental load between calls to Feed(). */
+    struct FeedState {
+        std::string     strData;    //!< data not yet parsed, in storage format
+        size_t          uScan;      //!< offset of the first unscanned line
+        std::string     strTag;     //!< end tag of the open multi-line value
+        bool            bInTag;     //!< is a multi-line value open?
+        bool            bStarted;   //!< has the start of the file been parsed?
+        bool            bEnded;     //!< was a NULL found in the data?
+        const SI_CHAR * pSection;   //!< section that the parsed data ends in
+    };
+
+    /** Incremental load in progress, or NULL. */
+    FeedState * m_pFeed;
+
+    /** Should the keys of each section be parsed when it is first used? */
+    bool m_bLazyLoad;
+
+    /** Section name -> start of its keys in m_pData, for the sections that
+        haven't been used since a lazy load. A section that appears more than
+        once in the file has an entry for each part, in file order.
+     */
+    typedef std::multimap<const SI_CHAR *,SI_CHAR *> TLazy;
+    mutable TLazy m_lazy;
+
+    /** Should the layout of loaded files be remembered? */
+    bool m_bIncrementalSave;
+
+    /** Layout of the file that was last loaded or saved incrementally, in
+        file order, or empty if it isn't known. Section name -> index of its
+        span, for the sections that are still in the data. */
+    typedef std::map<const SI_CHAR *,size_t> TLayoutIndex;
+    mutable TLayout m_layout;
+    mutable TLayoutIndex m_layoutIndex;
+
+    /** Path, size and modification time of that file */
+    mutable std::string m_strLayoutFile;
+    mutable unsigned int m_uLayoutSize[2];
+    mutable unsigned int m_uLayoutTime[3];
+
+    /** Hash index of sections and keys, only used if SI_STRHASH is a hash
+        function. A stale index is rebuilt when it is next used. */
+    SI_HashTable<SectionSlot> m_sectionIndex;
+    SI_HashTable<KeySlot> m_keyIndex;
+    bool m_bIndexStale;
+
+    /** Sections and keys in load order, which Save() walks. Data that is
+        loaded in bulk makes the order stale and it is rebuilt, with one
+        sort, when it is next used. */
+    TOrder m_order;
+    bool m_bOrderStale;
+
+#ifdef SI_SUPPORT_THREADS
+    /** Maximum number of threads used by a load, 0 for one per processor. */
+    int m_nLoadThreads;
+#endif // SI_SUPPORT_THREADS
 };
 
 // ---------------------------------------------------------------------------
 //                                  IMPLEMENTATION
 // ---------------------------------------------------------------------------
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::CSimpleIniTempl(
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::CSimpleIniTempl(
     bool a_bIsUtf8,
     bool a_bAllowMultiKey,
     bool a_bAllowMultiLine
     )
   : m_pData(0)
   , m_uDataLen(0)
+#ifdef SI_SUPPORT_MMAP
+  , m_pMapView(NULL)
+  , m_uMapLen(0)
+  , m_bMapShared(false)
+#endif // SI_SUPPORT_MMAP
   , m_pFileComment(NULL)
+  , m_data(typename Entry::KeyOrder(),
+        typename TSection::allocator_type(SI_AllocTraits<SI_ALLOC>::Make(&m_arena)))
+  , m_pStrings(NULL)
   , m_bStoreIsUtf8(a_bIsUtf8)
   , m_bAllowMultiKey(a_bAllowMultiKey)
   , m_bAllowMultiLine(a_bAllowMultiLine)
   , m_bSpaces(true)
   , m_nOrder(0)
-{ }
+  , m_uGeneration(0)
+  , m_uModified(0)
+  , m_uSavedModified(0)
+  , m_pFeed(NULL)
+  , m_bLazyLoad(false)
+  , m_bIncrementalSave(false)
+  , m_bIndexStale(false)
+  , m_bOrderStale(false)
+#ifdef SI_SUPPORT_THREADS
+  , m_nLoadThreads(1)
+#endif // SI_SUPPORT_THREADS
+{
+    // anything that m_data has allocated already lives as long as it does
+    m_arena.SetBase();
+}
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::~CSimpleIniTempl()
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::~CSimpleIniTempl()
 {
     Reset();
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 void
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Reset()
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::Reset()
 {
     // remove all data
+#ifdef SI_SUPPORT_MMAP
+    if (m_pMapView) {
+        SI_UnmapFile(m_pMapView, m_uMapLen);
+        m_pMapView = NULL;
+        m_uMapLen = 0;
+        m_bMapShared = false;
+    }
+    else
+#endif // SI_SUPPORT_MMAP
     delete[] m_pData;
     m_pData = NULL;
     m_uDataLen = 0;
     m_pFileComment = NULL;
+    ++m_uGeneration;
+    ++m_uModified;
+    delete m_pFeed;
+    m_pFeed = NULL;
+    m_lazy.clear();
+    ClearLayout();
+    m_sectionIndex.Clear();
+    m_keyIndex.Clear();
+    m_bIndexStale = false;
+    m_order.clear();
+    m_bOrderStale = false;
     if (!m_data.empty()) {
         m_data.erase(m_data.begin(), m_data.end());
     }
 
+    // arena strings and nodes are all freed with the arena blocks
+    if (SI_AllocTraits<SI_ALLOC>::arena) {
+        m_arena.Reset();
+    }
+
     // remove all strings
-    if (!m_strings.empty()) {
-        typename TNamesDepend::iterator i = m_strings.begin();
-        for (; i != m_strings.end(); ++i) {
-            delete[] const_cast<SI_CHAR*>(i->pItem);
-        }
-        m_strings.erase(m_strings.begin(), m_strings.end());
+    while (m_pStrings) {
+        StringHeader * pNext = m_pStrings->pNext;
+        delete[] (char *) m_pStrings;
+        m_pStrings = pNext;
     }
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
-    const char * a_pszFile
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadFile(
+    const char *    a_pszFile,
+    unsigned int *  a_pHash,
+    size_t *        a_pSize
     )
 {
     FILE * fp = NULL;
@@ -1305,15 +3536,23 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
     if (!fp) {
         return SI_FILE;
     }
-    SI_Error rc = LoadFile(fp);
+    bool bEmpty = (m_pData == NULL && m_data.empty());
+    SI_Error rc = LoadFile(fp, a_pHash, a_pSize);
     fclose(fp);
+
+    // without conversion the data is the file, including any BOM
+    if (rc >= 0 && bEmpty && m_bIncrementalSave
+        && SI_IsCopyConverter<SI_CONVERTER>::value)
+    {
+        RecordLayout(a_pszFile, m_pData, m_pData ? m_uDataLen-1 : 0);
+    }
     return rc;
 }
 
 #ifdef SI_HAS_WIDE_FILE
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadFile(
     const SI_WCHAR_T * a_pwszFile
     )
 {
@@ -1334,49 +3573,393 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
     return LoadFile(szFile);
 #endif // _WIN32
 }
-#endif // SI_HAS_WIDE_FILE
+#endif // SI_HAS_WIDE_FILE
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadFile(
+    FILE *          a_fpFile,
+    unsigned int *  a_pHash,
+    size_t *        a_pSize
+    )
+{
+    // load the raw file data
+    int retval = fseek(a_fpFile, 0, SEEK_END);
+    if (retval != 0) {
+        return SI_FILE;
+    }
+    long lSize = ftell(a_fpFile);
+    if (lSize < 0) {
+        return SI_FILE;
+    }
+    if (lSize == 0) {
+        return SI_OK;
+    }
+
+    // when no conversion is required, read straight into the buffer that
+    // will be parsed and kept instead of making a second copy of the data
+    if (SI_IsCopyConverter<SI_CONVERTER>::value) {
+        SI_CHAR * pData = new SI_CHAR[lSize+1];
+        if (!pData) {
+            return SI_NOMEM;
+        }
+        fseek(a_fpFile, 0, SEEK_SET);
+        size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
+        if (uRead != (size_t) lSize) {
+            delete[] pData;
+            return SI_FILE;
+        }
+        pData[uRead] = 0;
+        if (a_pHash) {
+            *a_pHash = SI_HashBytes(*a_pHash, pData, uRead);
+        }
+        if (a_pSize) {
+            *a_pSize = uRead;
+        }
+
+        // consume the UTF-8 BOM if it exists
+        SI_CHAR * pWork = pData;
+        if (m_bStoreIsUtf8 && uRead >= 3) {
+            if (memcmp(pData, SI_UTF8_SIGNATURE, 3) == 0) {
+                pWork += 3;
+            }
+        }
+
+        // the data is stored before it is parsed so that DeleteString()
+        // can tell its strings apart from copies
+        bool bCopyStrings = (m_pData != NULL);
+        if (!bCopyStrings) {
+            m_pData = pData;
+            m_uDataLen = uRead+1;
+        }
+        typename SI_ScanBounds<SI_CHAR>::Range scan(m_scan, pData, pData + uRead+1);
+        SI_Error rc = ParseData(pWork, bCopyStrings);
+        if (bCopyStrings) {
+            delete[] pData;
+        }
+        return rc;
+    }
+
+    char * pData = new char[lSize];
+    if (!pData) {
+        return SI_NOMEM;
+    }
+    fseek(a_fpFile, 0, SEEK_SET);
+    size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
+    if (uRead != (size_t) lSize) {
+        delete[] pData;
+        return SI_FILE;
+    }
+    if (a_pHash) {
+        *a_pHash = SI_HashBytes(*a_pHash, pData, uRead);
+    }
+    if (a_pSize) {
+        *a_pSize = uRead;
+    }
+
+    // convert the raw data to unicode
+    SI_Error rc = LoadData(pData, uRead);
+    delete[] pData;
+    return rc;
+}
+
+#ifdef SI_SUPPORT_MMAP
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadFileMapped(
+    const char * a_pszFile
+    )
+{
+    // the file can only be parsed in place when it needs no conversion and
+    // the strings don't need to be copied out of it
+    if (!SI_IsCopyConverter<SI_CONVERTER>::value || m_pData) {
+        return LoadFile(a_pszFile);
+    }
+
+    size_t uSize = 0;
+    SI_FileId id;
+    void * pView = SI_MapFile(a_pszFile, uSize, id);
+    if (!pView) {
+        return LoadFile(a_pszFile);
+    }
+
+    // the parser needs a NULL terminator after the data. The remainder of
+    // the last page of the view is zero filled, but if the file exactly
+    // fills the last page then there is no room for it.
+    if (uSize % SI_MapPageSize() == 0) {
+        SI_UnmapFile(pView, uSize);
+        return LoadFile(a_pszFile);
+    }
+
+    // consume the UTF-8 BOM if it exists
+    SI_CHAR * pData = (SI_CHAR *) pView;
+    size_t uLen = uSize;
+    if (m_bStoreIsUtf8 && uLen >= 3) {
+        if (memcmp(pData, SI_UTF8_SIGNATURE, 3) == 0) {
+            pData += 3;
+            uLen  -= 3;
+        }
+    }
+
+    m_pMapView = pView;
+    m_uMapLen = uSize;
+    m_mapId = id;
+    m_bMapShared = true;
+    m_pData = pData;
+    m_uDataLen = uLen+1;
+    typename SI_ScanBounds<SI_CHAR>::Range scan(m_scan, pData, pData + uLen+1);
+    return ParseData(pData, false);
+}
+#endif // SI_SUPPORT_MMAP
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadCache(
+    const char * a_pszCacheFile,
+    const char * a_pszSourceFile
+    )
+{
+    if (m_pData || !m_data.empty()) {
+        return SI_FAIL;
+    }
+    unsigned int uSize[2], uTime[3];
+    if (!SI_GetFileStamp(a_pszSourceFile, uSize, uTime, NULL)) {
+        return SI_FILE;
+    }
+
+    SI_Error rc = SI_FAIL;
+#if defined(SI_SUPPORT_MMAP) && !defined(_WIN32)
+    // the strings are used where they are in the view
+    size_t uLen = 0;
+    SI_FileId id;
+    char * pView = (char *) SI_MapFile(a_pszCacheFile, uLen, id);
+    if (!pView) {
+        return SI_FAIL;
+    }
+    const SI_CacheHeader * pHeader = (const SI_CacheHeader *) pView;
+    if (uLen >= sizeof(SI_CacheHeader)
+        && IsCacheValid(*pHeader, a_pszSourceFile, uSize, uTime)
+        && uLen == CacheSize(*pHeader))
+    {
+        const SI_CacheSection * pSections =
+            (const SI_CacheSection *) (pView + sizeof(SI_CacheHeader));
+        const SI_CacheKey * pKeys =
+            (const SI_CacheKey *) (pSections + pHeader->uSections);
+        SI_CHAR * pStrings = (SI_CHAR *) (pKeys + pHeader->uKeys);
+        rc = LoadCacheTables(*pHeader, pSections, pKeys, pStrings);
+        if (rc >= 0) {
+            m_pMapView = pView;
+            m_uMapLen = uLen;
+            m_mapId = id;
+            m_bMapShared = true;
+            m_pData = pStrings;
+            m_uDataLen = pHeader->uStrings;
+        }
+    }
+    if (rc < 0) {
+        SI_UnmapFile(pView, uLen);
+    }
+#else // !SI_SUPPORT_MMAP || _WIN32
+    // the strings are read into a buffer that becomes our data
+    FILE * fp = SI_OpenFile(a_pszCacheFile, "rb");
+    if (!fp) {
+        return SI_FAIL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long lSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    SI_CacheHeader header;
+    if (lSize >= (long) sizeof(SI_CacheHeader)
+        && fread(&header, sizeof(header), 1, fp) == 1
+        && IsCacheValid(header, a_pszSourceFile, uSize, uTime)
+        && (size_t) lSize == CacheSize(header))
+    {
+        size_t uTables = sizeof(SI_CacheSection) * header.uSections
+            + sizeof(SI_CacheKey) * header.uKeys;
+        char * pTables = new char[uTables + 1];
+        SI_CHAR * pStrings = new SI_CHAR[header.uStrings + 1];
+        if (!pTables || !pStrings) {
+            rc = SI_NOMEM;
+        }
+        else if (fread(pTables, 1, uTables, fp) == uTables
+            && fread(pStrings, sizeof(SI_CHAR), header.uStrings, fp) == header.uStrings)
+        {
+            const SI_CacheSection * pSections = (const SI_CacheSection *) pTables;
+            const SI_CacheKey * pKeys =
+                (const SI_CacheKey *) (pSections + header.uSections);
+            rc = LoadCacheTables(header, pSections, pKeys, pStrings);
+        }
+        delete[] pTables;
+        if (rc >= 0) {
+            m_pData = pStrings;
+            m_uDataLen = header.uStrings;
+        }
+        else {
+            delete[] pStrings;
+        }
+    }
+    fclose(fp);
+#endif // SI_SUPPORT_MMAP && !_WIN32
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IsCacheValid(
+    const SI_CacheHeader &  a_header,
+    const char *            a_pszSourceFile,
+    const unsigned int      a_uSize[2],
+    const unsigned int      a_uTime[3]
+    ) const
+{
+    if (memcmp(a_header.szMagic, "SICACHE", 8) != 0
+        || a_header.uVersion != SI_CACHE_VERSION
+        || a_header.uCharSize != sizeof(SI_CHAR)
+        || a_header.uFlags != CacheFlags())
+    {
+        return false;
+    }
+    if (a_header.uSourceSize[0] != a_uSize[0] || a_header.uSourceSize[1] != a_uSize[1]) {
+        return false;
+    }
+    // A time that matches to the fraction of a second identifies the
+    // version of the file, unless the file could have been changed again
+    // within the same time when the cache was saved
+    if (!a_header.uHashAlways && memcmp(a_header.uSourceTime, a_uTime,
+        sizeof(a_header.uSourceTime)) == 0)
+    {
+        return true;
+    }
+
+    // the file was touched or copied, it may still have the same contents
+    unsigned int uSize[2], uTime[3], uHash;
+    return SI_GetFileStamp(a_pszSourceFile, uSize, uTime, &uHash)
+        && uHash == a_header.uSourceHash;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadCacheTables(
+    const SI_CacheHeader &  a_header,
+    const SI_CacheSection * a_pSections,
+    const SI_CacheKey *     a_pKeys,
+    SI_CHAR *               a_pStrings
+    )
+{
+    // check every offset before any data is added, the file may be damaged
+    unsigned int uStrings = a_header.uStrings;
+    if (uStrings == 0 || a_pStrings[uStrings-1] != 0
+        || a_header.uFileComment >= uStrings)
+    {
+        return SI_FAIL;
+    }
+    size_t uKeys = 0;
+    for (unsigned int n = 0; n < a_header.uSections; ++n) {
+        const SI_CacheSection & section = a_pSections[n];
+        if (section.uItem == 0 || section.uItem >= uStrings
+            || section.uComment >= uStrings)
+        {
+            return SI_FAIL;
+        }
+        uKeys += section.uKeys;
+    }
+    if (uKeys != a_header.uKeys) {
+        return SI_FAIL;
+    }
+    for (unsigned int n = 0; n < a_header.uKeys; ++n) {
+        const SI_CacheKey & key = a_pKeys[n];
+        if (key.uItem == 0 || key.uItem >= uStrings || key.uValue == 0
+            || key.uValue >= uStrings || key.uComment >= uStrings)
+        {
+            return SI_FAIL;
+        }
+    }
+
+    // the sections and keys are stored in map order, so each one is added
+    // at the end of its map
+    if (a_header.uFileComment) {
+        m_pFileComment = a_pStrings + a_header.uFileComment;
+    }
+    const SI_CacheKey * pKey = a_pKeys;
+    for (unsigned int n = 0; n < a_header.uSections; ++n) {
+        const SI_CacheSection & section = a_pSections[n];
+        Entry oSection(a_pStrings + section.uItem, section.nOrder);
+        if (section.uComment) {
+            oSection.pComment = a_pStrings + section.uComment;
+        }
+        typename TSection::iterator iSection = m_data.insert(m_data.end(),
+            typename TSection::value_type(oSection, NewKeyVal()));
+
+        TKeyVal & keyval = iSection->second;
+        for (unsigned int k = 0; k < section.uKeys; ++k, ++pKey) {
+            Entry oKey(a_pStrings + pKey->uItem, pKey->nOrder);
+            if (pKey->uComment) {
+                oKey.pComment = a_pStrings + pKey->uComment;
+            }
+            keyval.insert(keyval.end(),
+                typename TKeyVal::value_type(oKey, a_pStrings + pKey->uValue));
+        }
+    }
+    if (a_header.nOrder > m_nOrder) {
+        m_nOrder = a_header.nOrder;
+    }
+    ++m_uGeneration;
+    m_bIndexStale = true;
+    m_bOrderStale = true;
+    ClearLayout();
+    return SI_OK;
+}
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
-    FILE * a_fpFile
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadFileCached(
+    const char * a_pszFile,
+    const char * a_pszCacheFile
     )
 {
-    // load the raw file data
-    int retval = fseek(a_fpFile, 0, SEEK_END);
-    if (retval != 0) {
-        return SI_FILE;
-    }
-    long lSize = ftell(a_fpFile);
-    if (lSize < 0) {
-        return SI_FILE;
-    }
-    if (lSize == 0) {
+    // a cache is only used by and saved for an empty object
+    bool bEmpty = (m_pData == NULL && m_data.empty());
+    if (bEmpty && LoadCache(a_pszCacheFile, a_pszFile) >= 0) {
         return SI_OK;
     }
-    char * pData = new char[lSize];
-    if (!pData) {
-        return SI_NOMEM;
-    }
-    fseek(a_fpFile, 0, SEEK_SET);
-    size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
-    if (uRead != (size_t) lSize) {
-        delete[] pData;
-        return SI_FILE;
-    }
 
-    // convert the raw data to unicode
-    SI_Error rc = LoadData(pData, uRead);
-    delete[] pData;
+    // The stamp is taken before the file is read, and the hash is of the
+    // bytes that are parsed. A change to the file while it is loaded then
+    // leaves a cache that is out of date for the file, never one that
+    // looks current for data that it doesn't hold.
+    unsigned int uSize[2], uTime[3], uHash = SI_HASH_START;
+    time_t tStamp = time(NULL);
+    bool bStamp = bEmpty && SI_GetFileStamp(a_pszFile, uSize, uTime, NULL);
+    size_t uRead = 0;
+    SI_Error rc = LoadFile(a_pszFile, &uHash, &uRead);
+    unsigned int uReadSize[2];
+    SI_SplitValue(uRead, uReadSize);
+    if (rc >= 0 && bStamp && memcmp(uReadSize, uSize, sizeof(uSize)) == 0) {
+        SaveCache(a_pszCacheFile, uSize, uTime, uHash,
+            SI_IsStampAmbiguous(uTime, tStamp));
+    }
     return rc;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadData(
     const char *    a_pData,
     size_t          a_uDataLen
     )
+{
+    const SI_CHAR * pSection = EmptySection();
+    return LoadBlock(a_pData, a_uDataLen, true, pSection);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadBlock(
+    const char *        a_pData,
+    size_t              a_uDataLen,
+    bool                a_bFileStart,
+    const SI_CHAR *&    a_pSection
+    )
 {
     SI_CONVERTER converter(m_bStoreIsUtf8);
 
@@ -1385,7 +3968,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
     }
 
     // consume the UTF-8 BOM if it exists
-    if (m_bStoreIsUtf8 && a_uDataLen >= 3) {
+    if (a_bFileStart && m_bStoreIsUtf8 && a_uDataLen >= 3) {
         if (memcmp(a_pData, SI_UTF8_SIGNATURE, 3) == 0) {
             a_pData    += 3;
             a_uDataLen -= 3;
@@ -1399,12 +3982,18 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
     }
 
     // allocate memory for the data, ensure that there is a NULL
-    // terminator wherever the converted data ends
+    // terminator wherever the converted data ends. A straight copy always
+    // fills the buffer so only the terminator needs to be set.
     SI_CHAR * pData = new SI_CHAR[uLen+1];
     if (!pData) {
         return SI_NOMEM;
     }
-    memset(pData, 0, sizeof(SI_CHAR)*(uLen+1));
+    if (SI_IsCopyConverter<SI_CONVERTER>::value) {
+        pData[uLen] = 0;
+    }
+    else {
+        memset(pData, 0, sizeof(SI_CHAR)*(uLen+1));
+    }
 
     // convert the data
     if (!converter.ConvertFromStore(a_pData, a_uDataLen, pData, uLen)) {
@@ -1412,45 +4001,589 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
         return SI_FAIL;
     }
 
-    // parse it
-    const static SI_CHAR empty = 0;
-    SI_CHAR * pWork = pData;
-    const SI_CHAR * pSection = &empty;
-    const SI_CHAR * pItem = NULL;
-    const SI_CHAR * pVal = NULL;
-    const SI_CHAR * pComment = NULL;
-
     // We copy the strings if we are loading data into this class when we
-    // already have stored some.
+    // already have stored some. Otherwise the data is stored before it is
+    // parsed so that DeleteString() can tell its strings apart from copies.
     bool bCopyStrings = (m_pData != NULL);
+    if (!bCopyStrings) {
+        m_pData = pData;
+        m_uDataLen = uLen+1;
+    }
+
+    // parse it
+    typename SI_ScanBounds<SI_CHAR>::Range scan(m_scan, pData, pData + uLen+1);
+    SI_Error rc = ParseData(pData, bCopyStrings, a_bFileStart, a_pSection);
+
+    // store these strings if we didn't copy them
+    if (bCopyStrings) {
+        // the section may be continued by the next block, so it must
+        // refer to our copy of the name and not to this block
+        if (a_pSection >= pData && a_pSection < pData + uLen + 1) {
+            typename TSection::const_iterator iSection = m_data.find(a_pSection);
+            a_pSection = (iSection != m_data.end()) ?
+                iSection->first.pItem : EmptySection();
+        }
+        delete[] pData;
+    }
+
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::ParseData(
+    SI_CHAR *           a_pData,
+    bool                a_bCopyStrings,
+    bool                a_bFileStart,
+    const SI_CHAR *&    a_pSection
+    )
+{
+    SI_CHAR * pWork = a_pData;
+
+    // the file layout no longer matches the data
+    ClearLayout();
 
     // find a file comment if it exists, this is a comment that starts at the
     // beginning of the file and continues until the first blank line.
-    SI_Error rc = FindFileComment(pWork, bCopyStrings);
-    if (rc < 0) return rc;
+    if (a_bFileStart) {
+        SI_Error rc = FindFileComment(pWork, a_bCopyStrings);
+        if (rc < 0) return rc;
+    }
+
+    if (!a_bCopyStrings && m_bLazyLoad) {
+        return ParseLazy(pWork, a_pSection);
+    }
+
+#ifdef SI_SUPPORT_THREADS
+    // the parsing threads have their own arenas, which don't outlive them
+    if (!a_bCopyStrings && m_nLoadThreads != 1 && !SI_AllocTraits<SI_ALLOC>::arena) {
+        return ParseParallel(pWork, a_pSection);
+    }
+#endif // SI_SUPPORT_THREADS
+
+    return ParseEntries(pWork, a_bCopyStrings, a_pSection);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::ParseEntries(
+    SI_CHAR *           a_pData,
+    bool                a_bCopyStrings,
+    const SI_CHAR *&    a_pSection
+    )
+{
+    const SI_CHAR * pItem = NULL;
+    const SI_CHAR * pVal = NULL;
+    const SI_CHAR * pComment = NULL;
 
     // add every entry in the file to the data table
-    while (FindEntry(pWork, pSection, pItem, pVal, pComment)) {
-        rc = AddEntry(pSection, pItem, pVal, pComment, false, bCopyStrings);
+    while (FindEntry(a_pData, a_pSection, pItem, pVal, pComment)) {
+        SI_Error rc = AddEntry(a_pSection, pItem, pVal, pComment, false, a_bCopyStrings);
         if (rc < 0) return rc;
     }
 
-    // store these strings if we didn't copy them
-    if (bCopyStrings) {
-        delete[] pData;
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_CHAR *
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindSectionSplit(
+    SI_CHAR *       a_pFrom,
+    SI_CHAR *       a_pLimit,
+    bool &          a_bBadSection
+    ) const
+{
+    SI_CHAR * pLine = (a_pFrom > a_pLimit) ? a_pFrom : a_pLimit;
+    for (;;) {
+        // find the start of the next line that is a valid section name
+        for (;;) {
+            pLine = FindLineEnd(pLine);
+            if (!*pLine) {
+                return NULL;
+            }
+            SkipNewLine(pLine);
+
+            SI_CHAR * p = pLine;
+            while (*p == ' ' || *p == '\t') {
+                ++p;
+            }
+            if (*p == '[') {
+                if (*FindLineEnd(p, ']') == ']') {
+                    break;
+                }
+                a_bBadSection = true;
+            }
+        }
+
+        // move back over the lines before the section that don't hold an entry,
+        // as the last comment in them belongs to the section. The split can't
+        // be earlier than a_pLimit.
+        SI_CHAR * pSplit = pLine;
+        while (pSplit > a_pLimit) {
+            // find the start of the previous line
+            SI_CHAR * pPrevEnd = pSplit - 1;
+            if (*pPrevEnd == '\n' && pPrevEnd > a_pLimit && pPrevEnd[-1] == '\r') {
+                --pPrevEnd;
+            }
+            SI_CHAR * pPrev = pPrevEnd;
+            while (pPrev > a_pLimit && !IsNewLineChar(pPrev[-1])) {
+                --pPrev;
+            }
+
+            // stop at a line that FindEntry() would return as an entry
+            SI_CHAR * p = pPrev;
+            while (p < pPrevEnd && (*p == ' ' || *p == '\t')) {
+                ++p;
+            }
+            bool bEntry = false;
+            if (p < pPrevEnd && !IsComment(*p)) {
+                SI_CHAR cStop = (*p == '[') ? ']' : '=';
+                SI_CHAR * q = p;
+                while (q < pPrevEnd && *q != cStop) {
+                    ++q;
+                }
+                bEntry = (q < pPrevEnd) && (cStop == ']' || q > p);
+            }
+            if (bEntry) {
+                break;
+            }
+            pSplit = pPrev;
+        }
+        if (pSplit > a_pLimit) {
+            return pSplit;
+        }
     }
-    else {
-        m_pData = pData;
-        m_uDataLen = uLen+1;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::ParseLazy(
+    SI_CHAR *           a_pData,
+    const SI_CHAR *&    a_pSection
+    )
+{
+    if (HasMultiLineTag(a_pData)) {
+        return ParseEntries(a_pData, false, a_pSection);
+    }
+
+    // each segment holds a single section and the comments before it
+    SI_Error rc = SI_OK;
+    SI_CHAR * pSegment = a_pData;
+    while (pSegment && rc >= 0) {
+        bool bBadSection = false;
+        SI_CHAR * pNext = FindSectionSplit(pSegment, pSegment, bBadSection);
+        if (pNext) {
+            pNext[-1] = 0;
+        }
+
+        // an invalid section line changes the section of the keys that
+        // follow it, so the segment must be parsed now
+        if (bBadSection) {
+            rc = ParseEntries(pSegment, false, a_pSection);
+            pSegment = pNext;
+            continue;
+        }
+
+        // keep the keys of the section to be parsed when first used, only
+        // keys before the first section are added now
+        const SI_CHAR * pKey = NULL;
+        const SI_CHAR * pVal = NULL;
+        const SI_CHAR * pComment = NULL;
+        SI_CHAR * pBody = pSegment;
+        if (FindEntry(pBody, a_pSection, pKey, pVal, pComment)) {
+            rc = AddEntry(a_pSection, pKey, pVal, pComment, false, false);
+            if (rc >= 0 && pKey) {
+                rc = ParseEntries(pBody, false, a_pSection);
+            }
+            else if (rc >= 0) {
+                typename TSection::iterator iSection = m_data.find(a_pSection);
+                m_lazy.insert(typename TLazy::value_type(
+                    iSection->first.pItem, pBody));
+            }
+        }
+        pSegment = pNext;
+    }
+
+    return rc < 0 ? rc : SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadLazySection(
+    const SI_CHAR * a_pSection
+    )
+{
+    // the keys are added in file order. Each part is removed before it is
+    // parsed as adding the keys looks up this section again.
+    for (;;) {
+        typename TLazy::iterator iLazy = m_lazy.lower_bound(a_pSection);
+        if (iLazy == m_lazy.end() || iLazy->first != a_pSection) {
+            break;
+        }
+        SI_CHAR * pBody = iLazy->second;
+        m_lazy.erase(iLazy);
+
+        const SI_CHAR * pSection = a_pSection;
+        typename SI_ScanBounds<SI_CHAR>::Range scan(m_scan, m_pData, m_pData + m_uDataLen);
+        ParseEntries(pBody, false, pSection);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::HasMultiLineTag(
+    const SI_CHAR * a_pData
+    ) const
+{
+    if (!m_bAllowMultiLine) {
+        return false;
+    }
+    for (int nCount = 0; *a_pData; ++a_pData) {
+        nCount = (*a_pData == '<') ? nCount + 1 : 0;
+        if (nCount == 3) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef SI_SUPPORT_THREADS
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::ParseParallel(
+    SI_CHAR *           a_pData,
+    const SI_CHAR *&    a_pSection
+    )
+{
+    size_t uLen = 0;
+    while (a_pData[uLen]) {
+        ++uLen;
+    }
+
+    // A multi-line value may contain lines that look like sections, and
+    // each piece needs its own range of load order values (at most two for
+    // every character) so that the merged order matches the file.
+    int nTasks = m_nLoadThreads > 0 ? m_nLoadThreads : SI_CpuCount();
+    if ((size_t) nTasks > uLen / SI_PARALLEL_MIN_CHUNK) {
+        nTasks = (int) (uLen / SI_PARALLEL_MIN_CHUNK);
+    }
+    if (nTasks < 2 || uLen > (size_t) (INT_MAX - m_nOrder) / 2
+        || HasMultiLineTag(a_pData))
+    {
+        return ParseEntries(a_pData, false, a_pSection);
+    }
+
+    // split the data into pieces of roughly equal size
+    ParseTask * pTasks = new ParseTask[nTasks];
+    int nPieces = 1;
+    pTasks[0].pData = a_pData;
+    for (int n = 1; n < nTasks; ++n) {
+        bool bBadSection = false;
+        SI_CHAR * pSplit = FindSectionSplit(a_pData + (uLen / nTasks) * n,
+            pTasks[nPieces-1].pData, bBadSection);
+        if (pSplit) {
+            pTasks[nPieces++].pData = pSplit;
+        }
+    }
+
+    // each piece ends at the newline before the next one
+    SI_Task * pRun = new SI_Task[nPieces];
+    for (int n = 0; n < nPieces; ++n) {
+        if (n + 1 < nPieces) {
+            pTasks[n+1].pData[-1] = 0;
+            pTasks[n].pEnd = pTasks[n+1].pData;
+        }
+        else {
+            pTasks[n].pEnd = a_pData + uLen+1;
+        }
+        if (n == 0) {
+            pTasks[n].pIni = this;
+            pTasks[n].pSection = a_pSection;
+        }
+        else {
+            pTasks[n].pIni = new CSimpleIniTempl(
+                m_bStoreIsUtf8, m_bAllowMultiKey, m_bAllowMultiLine);
+            pTasks[n].pIni->m_nOrder =
+                m_nOrder + 2 * (int) (pTasks[n].pData - a_pData);
+            pTasks[n].pIni->m_bOrderStale = true;
+            pTasks[n].pIni->m_pData = a_pData;
+            pTasks[n].pIni->m_uDataLen = uLen+1;
+            pTasks[n].pSection = EmptySection();
+        }
+        pTasks[n].rc = SI_OK;
+        pRun[n].pfnRun = RunParseTask;
+        pRun[n].pArg = &pTasks[n];
+    }
+    SI_RunTasks(pRun, nPieces);
+
+    // merge the results in file order
+    SI_Error rc = pTasks[0].rc;
+    for (int n = 1; n < nPieces; ++n) {
+        MergeData(*pTasks[n].pIni);
+        pTasks[n].pIni->m_pData = NULL; // it is still our data
+        delete pTasks[n].pIni;
+        if (rc >= 0) rc = pTasks[n].rc;
+    }
+    a_pSection = pTasks[nPieces-1].pSection;
+
+    delete[] pRun;
+    delete[] pTasks;
+    return rc < 0 ? rc : SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::MergeData(
+    CSimpleIniTempl & a_oOther
+    )
+{
+    ++m_uGeneration;
+    typename TSection::iterator iOther = a_oOther.m_data.begin();
+    for ( ; iOther != a_oOther.m_data.end(); ++iOther) {
+        // new sections are moved across as they are
+        typename TSection::iterator iSection = m_data.find(iOther->first);
+        if (iSection == m_data.end()) {
+            typename TSection::value_type oEntry(iOther->first, NewKeyVal());
+            iSection = m_data.insert(oEntry).first;
+            iSection->second.swap(iOther->second);
+            continue;
+        }
+
+        // the keys of existing sections are added the same way as AddEntry,
+        // an existing key has its value updated unless multi-key is allowed
+        TKeyVal & keyval = iSection->second;
+        typename TKeyVal::const_iterator iKey = iOther->second.begin();
+        for ( ; iKey != iOther->second.end(); ++iKey) {
+            if (!m_bAllowMultiKey) {
+                typename TKeyVal::iterator iExisting = keyval.find(iKey->first);
+                if (iExisting != keyval.end()) {
+                    DeleteString(iExisting->second);
+                    iExisting->second = iKey->second;
+                    continue;
+                }
+            }
+            keyval.insert(*iKey);
+        }
+    }
+
+    if (a_oOther.m_nOrder > m_nOrder) {
+        m_nOrder = a_oOther.m_nOrder;
+    }
+    m_bIndexStale = true;
+    m_bOrderStale = true;
+}
+#endif // SI_SUPPORT_THREADS
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::BeginLoad()
+{
+    delete m_pFeed;
+    m_pFeed = new FeedState;
+    if (!m_pFeed) {
+        return SI_NOMEM;
+    }
+    m_pFeed->uScan    = 0;
+    m_pFeed->bInTag   = false;
+    m_pFeed->bStarted = false;
+    m_pFeed->bEnded   = false;
+    m_pFeed->pSection = EmptySection();
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::Feed(
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    if (!m_pFeed) {
+        return SI_FAIL;
+    }
+    FeedState & feed = *m_pFeed;
+
+    // parsing of a single buffer stops at the first NULL, so ignore
+    // everything that follows one
+    if (feed.bEnded) {
+        return SI_OK;
+    }
+    const char * pNull = (const char *) memchr(a_pData, 0, a_uDataLen);
+    if (pNull) {
+        a_uDataLen = (size_t) (pNull - a_pData);
+        feed.bEnded = true;
+    }
+    feed.strData.append(a_pData, a_uDataLen);
+
+    // parse all of the complete entries that we have
+    size_t uCut = FindFeedCut();
+    if (uCut == 0) {
+        return SI_OK;
+    }
+
+    // the converters may require the block to be NULL terminated
+    char cCut = feed.strData[uCut];
+    feed.strData[uCut] = 0;
+    SI_Error rc = LoadBlock(feed.strData.data(), uCut,
+        !feed.bStarted, feed.pSection);
+    feed.strData[uCut] = cCut;
+
+    feed.bStarted = true;
+    feed.strData.erase(0, uCut);
+    feed.uScan -= uCut;
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::EndLoad()
+{
+    if (!m_pFeed) {
+        return SI_FAIL;
+    }
+
+    // whatever remains is the end of the file
+    SI_Error rc = LoadBlock(m_pFeed->strData.c_str(), m_pFeed->strData.size(),
+        !m_pFeed->bStarted, m_pFeed->pSection);
+
+    delete m_pFeed;
+    m_pFeed = NULL;
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+size_t
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindFeedCut()
+{
+    FeedState & feed = *m_pFeed;
+    const char * pData = feed.strData.c_str();
+    size_t uDataLen = feed.strData.size();
+    size_t uCut = 0;
+
+    // An entry is complete at the end of a section line, a key line or the
+    // end tag of a multi-line value. Cutting the data there gives the same
+    // result as parsing it in one piece, as all comments belong to the entry
+    // that follows them.
+    while (feed.uScan < uDataLen) {
+        const char * pLine = pData + feed.uScan;
+        const char * pEnd = SI_Scanner<char,1>::FindLineEnd(
+            const_cast<char *>(pLine), const_cast<char *>(pData + uDataLen), 0);
+        if (!*pEnd) {
+            break;
+        }
+
+        // we can't tell if a trailing '\r' is a DOS newline until we have
+        // seen the next character
+        const char * pNext = pEnd + 1;
+        if (*pEnd == '\r') {
+            if (!*pNext) {
+                break;
+            }
+            if (*pNext == '\n') {
+                ++pNext;
+            }
+        }
+        feed.uScan = (size_t) (pNext - pData);
+
+        // inside a multi-line value only the end tag is of interest
+        if (feed.bInTag) {
+            if (IsFeedTagLine(pLine, (size_t) (pEnd - pLine))) {
+                feed.bInTag = false;
+                uCut = feed.uScan;
+            }
+            continue;
+        }
+
+        // skip the BOM and leading whitespace
+        if (!feed.bStarted && pLine == pData && m_bStoreIsUtf8
+            && pEnd - pLine >= 3 && memcmp(pLine, SI_UTF8_SIGNATURE, 3) == 0)
+        {
+            pLine += 3;
+        }
+        while (pLine < pEnd && (*pLine == ' ' || *pLine == '\t')) {
+            ++pLine;
+        }
+        if (pLine == pEnd || *pLine == ';' || *pLine == '#') {
+            continue;
+        }
+
+        // section names must be closed to be valid
+        if (*pLine == '[') {
+            if (memchr(pLine, ']', (size_t) (pEnd - pLine))) {
+                uCut = feed.uScan;
+            }
+            continue;
+        }
+
+        // keys must be followed by '=' and must not be empty
+        const char * pEquals = (const char *)
+            memchr(pLine, '=', (size_t) (pEnd - pLine));
+        if (!pEquals || pEquals == pLine) {
+            continue;
+        }
+
+        // a multi-line value is complete after the line with its end tag
+        if (m_bAllowMultiLine) {
+            const char * pVal = pEquals + 1;
+            while (pVal < pEnd && (*pVal == ' ' || *pVal == '\t')) {
+                ++pVal;
+            }
+            const char * pValEnd = pEnd;
+            while (pValEnd > pVal && (pValEnd[-1] == ' ' || pValEnd[-1] == '\t')) {
+                --pValEnd;
+            }
+            if (pValEnd - pVal >= 3 && memcmp(pVal, "<<<", 3) == 0) {
+                feed.strTag.assign(pVal + 3, pValEnd);
+                feed.bInTag = true;
+                continue;
+            }
+        }
+        uCut = feed.uScan;
+    }
+
+    return uCut;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IsFeedTagLine(
+    const char *    a_pLine,
+    size_t          a_uLen
+    ) const
+{
+    const std::string & strTag = m_pFeed->strTag;
+    if (a_uLen != strTag.size()) {
+        return false;
+    }
+    if (memcmp(a_pLine, strTag.data(), a_uLen) == 0) {
+        return true;
     }
 
-    return SI_OK;
+    // the tag may still match if the comparison ignores case
+    std::string strLine(a_pLine, a_uLen);
+    SI_CONVERTER c(m_bStoreIsUtf8);
+    size_t uLen = c.SizeFromStore(strLine.c_str(), a_uLen + 1);
+    if (uLen == (size_t)(-1)) {
+        return false;
+    }
+    SI_CHAR * pLine = new SI_CHAR[2 * (uLen + 1)];
+    if (!pLine) {
+        return false;
+    }
+    SI_CHAR * pTag = pLine + uLen + 1;
+    memset(pLine, 0, sizeof(SI_CHAR) * 2 * (uLen + 1));
+    bool bMatch =
+        c.ConvertFromStore(strLine.c_str(), a_uLen + 1, pLine, uLen) &&
+        c.ConvertFromStore(strTag.c_str(), a_uLen + 1, pTag, uLen) &&
+        !IsLess(pLine, pTag) && !IsLess(pTag, pLine);
+    delete[] pLine;
+    return bMatch;
 }
 
 #ifdef SI_SUPPORT_IOSTREAMS
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadData(
     std::istream & a_istream
     )
 {
@@ -1465,9 +4598,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadData(
 }
 #endif // SI_SUPPORT_IOSTREAMS
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindFileComment(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindFileComment(
     SI_CHAR *&      a_pData,
     bool            a_bCopyStrings
     )
@@ -1492,9 +4625,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindFileComment(
     return SI_OK;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindEntry(
     SI_CHAR *&        a_pData,
     const SI_CHAR *&  a_pSection,
     const SI_CHAR *&  a_pKey,
@@ -1532,9 +4665,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
             // find the end of the section name (it may contain spaces)
             // and convert it to lowercase as necessary
             a_pSection = a_pData;
-            while (*a_pData && *a_pData != ']' && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            a_pData = FindLineEnd(a_pData, ']');
 
             // if it's an invalid line, just skip it
             if (*a_pData != ']') {
@@ -1551,9 +4682,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
 
             // skip to the end of the line
             ++a_pData;  // safe as checked that it == ']' above
-            while (*a_pData && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            a_pData = FindLineEnd(a_pData);
 
             a_pKey = NULL;
             a_pVal = NULL;
@@ -1563,9 +4692,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
         // find the end of the key name (it may contain spaces)
         // and convert it to lowercase as necessary
         a_pKey = a_pData;
-        while (*a_pData && *a_pData != '=' && !IsNewLineChar(*a_pData)) {
-            ++a_pData;
-        }
+        a_pData = FindLineEnd(a_pData, '=');
 
         // if it's an invalid line, just skip it
         if (*a_pData != '=') {
@@ -1574,9 +4701,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
 
         // empty keys are invalid
         if (a_pKey == a_pData) {
-            while (*a_pData && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            a_pData = FindLineEnd(a_pData);
             continue;
         }
 
@@ -1596,9 +4721,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
 
         // find the end of the value which is the end of this line
         a_pVal = a_pData;
-        while (*a_pData && !IsNewLineChar(*a_pData)) {
-            ++a_pData;
-        }
+        a_pData = FindLineEnd(a_pData);
 
         // remove trailing spaces from the value
         pTrail = a_pData - 1;
@@ -1625,9 +4748,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
     return false;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IsMultiLineTag(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IsMultiLineTag(
     const SI_CHAR * a_pVal
     ) const
 {
@@ -1638,9 +4761,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IsMultiLineTag(
     return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IsMultiLineData(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IsMultiLineData(
     const SI_CHAR * a_pData
     ) const
 {
@@ -1675,18 +4798,18 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IsMultiLineData(
     return false;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IsNewLineChar(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IsNewLineChar(
     SI_CHAR a_c
     ) const
 {
     return (a_c == '\n' || a_c == '\r');
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::LoadMultiLineText(
     SI_CHAR *&          a_pData,
     const SI_CHAR *&    a_pVal,
     const SI_CHAR *     a_pTagName,
@@ -1749,7 +4872,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
 
         // find the end of this line
         pCurrLine = a_pData;
-        while (*a_pData && !IsNewLineChar(*a_pData)) ++a_pData;
+        a_pData = FindLineEnd(a_pData);
 
         // move this line down to the location that it should be if necessary
         if (pDataLine < pCurrLine) {
@@ -1808,36 +4931,42 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
     return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::CopyString(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::CopyString(
     const SI_CHAR *& a_pString
     )
 {
-    size_t uLen = 0;
-    if (sizeof(SI_CHAR) == sizeof(char)) {
-        uLen = strlen((const char *)a_pString);
-    }
-    else if (sizeof(SI_CHAR) == sizeof(wchar_t)) {
-        uLen = wcslen((const wchar_t *)a_pString);
-    }
-    else {
-        for ( ; a_pString[uLen]; ++uLen) /*loop*/ ;
+    size_t uLen = StrLen(a_pString) + 1; // NULL character
+    if (SI_AllocTraits<SI_ALLOC>::arena) {
+        // arena strings aren't tracked, Reset() frees them with the arena
+        SI_CHAR * pCopy = (SI_CHAR *) m_arena.Allocate(sizeof(SI_CHAR)*uLen);
+        memcpy(pCopy, a_pString, sizeof(SI_CHAR)*uLen);
+        a_pString = pCopy;
+        return SI_OK;
     }
-    ++uLen; // NULL character
-    SI_CHAR * pCopy = new SI_CHAR[uLen];
-    if (!pCopy) {
+    char * pBlock = new char[sizeof(StringHeader) + sizeof(SI_CHAR)*uLen];
+    if (!pBlock) {
         return SI_NOMEM;
     }
+    StringHeader * pHeader = (StringHeader *) pBlock;
+    pHeader->uCapacity = uLen;
+    pHeader->pPrev = NULL;
+    pHeader->pNext = m_pStrings;
+    if (m_pStrings) {
+        m_pStrings->pPrev = pHeader;
+    }
+    m_pStrings = pHeader;
+
+    SI_CHAR * pCopy = (SI_CHAR *) (pHeader + 1);
     memcpy(pCopy, a_pString, sizeof(SI_CHAR)*uLen);
-    m_strings.push_back(pCopy);
     a_pString = pCopy;
     return SI_OK;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::AddEntry(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     const SI_CHAR * a_pValue,
@@ -1848,6 +4977,12 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
 {
     SI_Error rc;
     bool bInserted = false;
+    ++m_uGeneration;
+
+    // strings are only copied for new data, not for the data being loaded
+    if (a_bCopyStrings) {
+        ++m_uModified;
+    }
 
     SI_ASSERT(!a_pComment || IsComment(*a_pComment));
 
@@ -1859,7 +4994,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
     }
 
     // create the section entry if necessary
-    typename TSection::iterator iSection = m_data.find(a_pSection);
+    typename TSection::iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         // if the section doesn't exist then we need a copy as the
         // string needs to last beyond the end of this function
@@ -1874,20 +5009,29 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
             oSection.pComment = a_pComment;
         }
 
-        typename TSection::value_type oEntry(oSection, TKeyVal());
+        typename TSection::value_type oEntry(oSection, NewKeyVal());
         typedef typename TSection::iterator SectionIterator;
         std::pair<SectionIterator,bool> i = m_data.insert(oEntry);
         iSection = i.first;
+        IndexSection(iSection);
+        OrderSection(iSection);
         bInserted = true;
     }
     if (!a_pKey || !a_pValue) {
-        // section only entries are specified with pItem and pVal as NULL
+        // section only entries are specified with pItem and pVal as NULL.
+        // The comment is only used if the section was created.
+        if (!bInserted && a_bCopyStrings) {
+            DeleteString(a_pComment);
+        }
         return bInserted ? SI_INSERTED : SI_UPDATED;
     }
+    if (a_bCopyStrings && !m_layout.empty()) {
+        LayoutChanged(iSection->first.pItem, false);
+    }
 
     // check for existence of the key
     TKeyVal & keyval = iSection->second;
-    typename TKeyVal::iterator iKey = keyval.find(a_pKey);
+    typename TKeyVal::iterator iKey = FindKey(keyval, a_pKey);
 
     // remove all existing entries but save the load order and
     // comment of the first entry
@@ -1912,6 +5056,10 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
 
     // make string copies if necessary
     bool bForceCreateNewKey = m_bAllowMultiKey && !a_bForceReplace;
+    const SI_CHAR * pOldValue = NULL;
+    if (iKey != keyval.end() && !bForceCreateNewKey) {
+        pOldValue = iKey->second;
+    }
     if (a_bCopyStrings) {
         if (bForceCreateNewKey || iKey == keyval.end()) {
             // if the key doesn't exist then we need a copy as the
@@ -1921,9 +5069,15 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
             if (rc < 0) return rc;
         }
 
-        // we always need a copy of the value
-        rc = CopyString(a_pValue);
-        if (rc < 0) return rc;
+        // we always need a copy of the value, but the copy of the value
+        // being replaced is reused if the new value fits into it
+        if (OverwriteString(pOldValue, a_pValue)) {
+            a_pValue = pOldValue;
+        }
+        else {
+            rc = CopyString(a_pValue);
+            if (rc < 0) return rc;
+        }
     }
 
     // create the key entry
@@ -1933,16 +5087,28 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
             oKey.pComment = a_pComment;
         }
         typename TKeyVal::value_type oEntry(oKey, static_cast<const SI_CHAR *>(NULL));
+        bool bNewName = (iKey == keyval.end());
         iKey = keyval.insert(oEntry);
+        if (bNewName) {
+            IndexKey(keyval, iKey);
+            OrderKey(iSection, iKey);
+        }
         bInserted = true;
     }
+    else if (a_bCopyStrings) {
+        // the comment is only used if the key was created
+        DeleteString(a_pComment);
+    }
     iKey->second = a_pValue;
+    if (pOldValue != a_pValue) {
+        DeleteString(pOldValue);
+    }
     return bInserted ? SI_INSERTED : SI_UPDATED;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 const SI_CHAR *
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     const SI_CHAR * a_pDefault,
@@ -1955,11 +5121,11 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
     if (!a_pSection || !a_pKey) {
         return a_pDefault;
     }
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return a_pDefault;
     }
-    typename TKeyVal::const_iterator iKeyVal = iSection->second.find(a_pKey);
+    typename TKeyVal::const_iterator iKeyVal = FindKey(iSection->second, a_pKey);
     if (iKeyVal == iSection->second.end()) {
         return a_pDefault;
     }
@@ -1977,9 +5143,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
     return iKeyVal->second;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 long
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetLongValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetLongValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     long            a_nDefault,
@@ -2016,9 +5182,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetLongValue(
     return nValue;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error 
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetLongValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SetLongValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     long            a_nValue,
@@ -2048,9 +5214,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetLongValue(
     return AddEntry(a_pSection, a_pKey, szOutput, a_pComment, a_bForceReplace, true);
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 double
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetDoubleValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetDoubleValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     double          a_nDefault,
@@ -2079,9 +5245,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetDoubleValue(
     return nValue;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error 
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetDoubleValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SetDoubleValue(
 	const SI_CHAR * a_pSection,
 	const SI_CHAR * a_pKey,
 	double          a_nValue,
@@ -2110,9 +5276,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetDoubleValue(
 	return AddEntry(a_pSection, a_pKey, szOutput, a_pComment, a_bForceReplace, true);
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetBoolValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetBoolValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     bool            a_bDefault,
@@ -2145,9 +5311,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetBoolValue(
     return a_bDefault;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error 
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetBoolValue(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SetBoolValue(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     bool            a_bValue,
@@ -2171,9 +5337,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetBoolValue(
     return AddEntry(a_pSection, a_pKey, szOutput, a_pComment, a_bForceReplace, true);
 }
     
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllValues(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetAllValues(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     TNamesDepend &  a_values
@@ -2184,11 +5350,11 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllValues(
     if (!a_pSection || !a_pKey) {
         return false;
     }
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return false;
     }
-    typename TKeyVal::const_iterator iKeyVal = iSection->second.find(a_pKey);
+    typename TKeyVal::const_iterator iKeyVal = FindKey(iSection->second, a_pKey);
     if (iKeyVal == iSection->second.end()) {
         return false;
     }
@@ -2206,9 +5372,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllValues(
     return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 int
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSectionSize(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetSectionSize(
     const SI_CHAR * a_pSection
     ) const
 {
@@ -2216,7 +5382,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSectionSize(
         return -1;
     }
 
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return -1;
     }
@@ -2241,14 +5407,14 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSectionSize(
     return nCount;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-const typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::TKeyVal *
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSection(
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+const typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::TKeyVal *
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetSection(
     const SI_CHAR * a_pSection
     ) const
 {
     if (a_pSection) {
-        typename TSection::const_iterator i = m_data.find(a_pSection);
+        typename TSection::const_iterator i = FindSection(a_pSection);
         if (i != m_data.end()) {
             return &(i->second);
         }
@@ -2256,9 +5422,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSection(
     return 0;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 void
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllSections(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetAllSections(
     TNamesDepend & a_names
     ) const
 {
@@ -2269,9 +5435,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllSections(
     }
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllKeys(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::GetAllKeys(
     const SI_CHAR * a_pSection,
     TNamesDepend &  a_names
     ) const
@@ -2281,53 +5447,540 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllKeys(
     if (!a_pSection) {
         return false;
     }
-
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
-    if (iSection == m_data.end()) {
-        return false;
+
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
+    if (iSection == m_data.end()) {
+        return false;
+    }
+
+    const TKeyVal & section = iSection->second;
+    const SI_CHAR * pLastKey = NULL;
+    typename TKeyVal::const_iterator iKeyVal = section.begin();
+    for (int n = 0; iKeyVal != section.end(); ++iKeyVal, ++n ) {
+        if (!pLastKey || IsLess(pLastKey, iKeyVal->first.pItem)) {
+            a_names.push_back(iKeyVal->first);
+            pLastKey = iKeyVal->first.pItem;
+        }
+    }
+
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+template<class VISITOR>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::VisitSections(
+    VISITOR &       a_visitor,
+    bool            a_bLoadOrder
+    ) const
+{
+    typename TSection::const_iterator i = m_data.begin();
+    if (!a_bLoadOrder) {
+        for ( ; i != m_data.end(); ++i) {
+            if (!a_visitor(i->first)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const_cast<CSimpleIniTempl *>(this)->UseOrder();
+    typename TOrder::const_iterator iOrder = m_order.begin();
+    for ( ; iOrder != m_order.end(); ++iOrder) {
+        if (!a_visitor(iOrder->iSection->first)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+template<class VISITOR>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::VisitKeys(
+    const SI_CHAR * a_pSection,
+    VISITOR &       a_visitor,
+    bool            a_bLoadOrder
+    ) const
+{
+    if (!a_pSection) {
+        return false;
+    }
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
+    if (iSection == m_data.end()) {
+        return false;
+    }
+
+    if (a_bLoadOrder) {
+        const SectionOrder * pOrder =
+            const_cast<CSimpleIniTempl *>(this)->FindOrder(iSection->first);
+        if (!pOrder) {
+            return false;
+        }
+        for (size_t n = 0; n < pOrder->keys.size(); ++n) {
+            if (!a_visitor(pOrder->keys[n]->first)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the first entry of each key, as GetAllKeys() returns them
+    const TKeyVal & section = iSection->second;
+    const SI_CHAR * pLastKey = NULL;
+    typename TKeyVal::const_iterator iKeyVal = section.begin();
+    for ( ; iKeyVal != section.end(); ++iKeyVal) {
+        if (!pLastKey || IsLess(pLastKey, iKeyVal->first.pItem)) {
+            pLastKey = iKeyVal->first.pItem;
+            if (!a_visitor(iKeyVal->first)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+template<class VISITOR>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::VisitValues(
+    const SI_CHAR * a_pSection,
+    const SI_CHAR * a_pKey,
+    VISITOR &       a_visitor
+    ) const
+{
+    if (!a_pSection || !a_pKey) {
+        return false;
+    }
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
+    if (iSection == m_data.end()) {
+        return false;
+    }
+    typename TKeyVal::const_iterator iKeyVal = FindKey(iSection->second, a_pKey);
+    if (iKeyVal == iSection->second.end()) {
+        return false;
+    }
+
+    // the values of a key are stored in the order they were added
+    do {
+        if (!a_visitor(Entry(iKeyVal->second, iKeyVal->first.pComment, iKeyVal->first.nOrder))) {
+            return false;
+        }
+        ++iKeyVal;
+    }
+    while (m_bAllowMultiKey && iKeyVal != iSection->second.end()
+        && !IsLess(a_pKey, iKeyVal->first.pItem));
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveFile(
+    const char *    a_pszFile,
+    bool            a_bAddSignature
+    ) const
+{
+    SI_Error rc = UnshareFile(a_pszFile);
+    if (rc < 0) {
+        return rc;
+    }
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, "wb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, "wb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (!fp) return SI_FILE;
+    ClearLayout();
+    rc = SaveFile(fp, a_bAddSignature);
+    fclose(fp);
+    if (rc >= 0) {
+        m_uSavedModified = m_uModified;
+    }
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveFileIfModified(
+    const char *    a_pszFile,
+    bool            a_bAddSignature
+    ) const
+{
+    if (!IsModified()) {
+        return SI_OK;
+    }
+
+    std::string strOutput;
+    SI_Error rc = Save(strOutput, a_bAddSignature);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = SI_OK;
+    if (!SI_FileEquals(a_pszFile, strOutput.data(), strOutput.size())) {
+        rc = UnshareFile(a_pszFile);
+        if (rc < 0) {
+            return rc;
+        }
+        ClearLayout();
+        FILE * fp = SI_OpenFile(a_pszFile, "wb");
+        if (!fp) {
+            return SI_FILE;
+        }
+        bool bOk = fwrite(strOutput.data(), 1, strOutput.size(), fp)
+            == strOutput.size();
+        bOk = (fclose(fp) == 0) && bOk;
+        if (!bOk) {
+            return SI_FILE;
+        }
+        rc = SI_UPDATED;
+    }
+    m_uSavedModified = m_uModified;
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveFileIncremental(
+    const char *    a_pszFile,
+    bool            a_bAddSignature
+    ) const
+{
+    if (!IsModified()) {
+        return SI_OK;
+    }
+    Converter convert(m_bStoreIsUtf8);
+
+    // the file can only be spliced if it is as it was left, and the keys
+    // before the first section haven't changed
+    unsigned int uSize[2], uTime[3];
+    bool bSplice = !m_layout.empty() && m_strLayoutFile == a_pszFile
+        && !m_layout[0].bDirty && !m_layout[0].bDeleted
+        && SI_GetFileStamp(a_pszFile, uSize, uTime, NULL)
+        && memcmp(uSize, m_uLayoutSize, sizeof(uSize)) == 0
+        && memcmp(uTime, m_uLayoutTime, sizeof(uTime)) == 0;
+    if (bSplice) {
+        typename TSection::const_iterator iEmpty = m_data.find(EmptySection());
+        if (iEmpty != m_data.end() && iEmpty->first.pItem != m_layout[0].pSection) {
+            bSplice = false;
+        }
+    }
+
+    // get all of the sections in load order. When splicing, only those
+    // which aren't in the file yet are needed.
+    std::vector<const Entry *> oSections;
+    NewSections newSections(*this, !bSplice, oSections);
+    VisitSections(newSections, true);
+
+    // a comment at the end of the file would become the comment of the
+    // first new section when the file is loaded again, so the whole file
+    // is written instead, which drops it as SaveFile() does
+    if (bSplice && !oSections.empty()
+        && !m_layout.back().bDirty && !m_layout.back().bDeleted
+        && SpanEndsInComment(a_pszFile, m_layout.back()))
+    {
+        bSplice = false;
+        oSections.clear();
+        NewSections allSections(*this, true, oSections);
+        VisitSections(allSections, true);
+    }
+
+    // the output is the file from offset uFirst on
+    std::string strOutput;
+    StringWriter writer(strOutput);
+    TLayout layout;
+    size_t uFirst = 0;
+    bool bNeedNewLine = false;
+    bool bRecord = true;
+    if (bSplice) {
+        // keep the file up to the first section that has changed
+        size_t n = 0;
+        while (n < m_layout.size() && !m_layout[n].bDirty && !m_layout[n].bDeleted) {
+            ++n;
+        }
+        if (n == m_layout.size() && oSections.empty()) {
+            m_uSavedModified = m_uModified;
+            return SI_OK;
+        }
+        layout.assign(m_layout.begin(), m_layout.begin() + n);
+        uFirst = (n < m_layout.size()) ? m_layout[n].uStart : m_layout.back().uEnd;
+
+        // read the rest of the file, which the unchanged sections are
+        // copied from, and the end of the part that is kept
+        std::string strOld;
+        size_t uOldStart = (uFirst < 4) ? 0 : uFirst - 4;
+        size_t uOldEnd = m_layout.back().uEnd;
+        if (uOldEnd > uOldStart) {
+            FILE * fp = SI_OpenFile(a_pszFile, "rb");
+            if (!fp) {
+                return SI_FILE;
+            }
+            strOld.resize(uOldEnd - uOldStart);
+            bool bOk = fseek(fp, (long) uOldStart, SEEK_SET) == 0
+                && fread(&strOld[0], 1, strOld.size(), fp) == strOld.size();
+            fclose(fp);
+            if (!bOk) {
+                return SI_FILE;
+            }
+        }
+
+        for ( ; n < m_layout.size(); ++n) {
+            SectionSpan span = m_layout[n];
+            if (span.bDeleted) {
+                continue;
+            }
+            if (bNeedNewLine) {
+                writer.Write(SI_NEWLINE_A);
+                writer.Write(SI_NEWLINE_A);
+            }
+            size_t uStart = uFirst + strOutput.size();
+            if (span.bDirty) {
+                typename TSection::const_iterator iSection = m_data.find(span.pSection);
+                if (!OutputSection(writer, convert, iSection->first)) {
+                    return SI_FAIL;
+                }
+                bNeedNewLine = true;
+            }
+            else {
+                // the span already ends with the blank lines before the next
+                strOutput.append(strOld, span.uStart - uOldStart, span.uEnd - span.uStart);
+                bNeedNewLine = false;
+            }
+            span.uStart = uStart;
+            span.bDirty = false;
+            layout.push_back(span);
+        }
+
+        // new sections follow a blank line, which may be there already
+        if (!bNeedNewLine && uFirst + strOutput.size() > 0) {
+            std::string strEnd = (strOutput.size() >= 3) ?
+                strOutput.substr(strOutput.size() - 3) :
+                strOld.substr(0, uFirst - uOldStart) + strOutput;
+            size_t uEnd = strEnd.size();
+            bNeedNewLine = !(uEnd >= 2 && strEnd[uEnd-1] == '\n'
+                && (strEnd[uEnd-2] == '\n'
+                    || (uEnd >= 3 && strEnd[uEnd-2] == '\r' && strEnd[uEnd-3] == '\n')));
+        }
+    }
+    else {
+        // add the UTF-8 signature if it is desired
+        if (m_bStoreIsUtf8 && a_bAddSignature) {
+            writer.Write(SI_UTF8_SIGNATURE);
+        }
+
+        // write the file comment if we have one
+        if (m_pFileComment) {
+            if (!OutputMultiLineText(writer, convert, m_pFileComment)) {
+                return SI_FAIL;
+            }
+            bNeedNewLine = true;
+        }
+        SectionSpan oPreamble = { NULL, 0, 0, false, false };
+        layout.push_back(oPreamble);
+    }
+
+    // write the new sections, or all of them, as Save() does
+    for (size_t n = 0; n < oSections.size(); ++n) {
+        const Entry & section = *oSections[n];
+        if (bNeedNewLine) {
+            writer.Write(SI_NEWLINE_A);
+            writer.Write(SI_NEWLINE_A);
+        }
+        if (*section.pItem) {
+            SectionSpan span = { section.pItem, uFirst + strOutput.size(), 0, false, false };
+            layout.push_back(span);
+        }
+        else if (layout.size() == 1) {
+            // keys before the first section are part of the text before it
+            layout[0].pSection = section.pItem;
+        }
+        else {
+            // they are written after a section, so a reload merges them
+            bRecord = false;
+        }
+        if (!OutputSection(writer, convert, section)) {
+            return SI_FAIL;
+        }
+        bNeedNewLine = true;
+    }
+    for (size_t n = 0; n < layout.size(); ++n) {
+        layout[n].uEnd = (n+1 < layout.size()) ?
+            layout[n+1].uStart : uFirst + strOutput.size();
+    }
+
+    // write the changed part of the file and cut off what is left of the
+    // old one
+    SI_Error rc = UnshareFile(a_pszFile);
+    if (rc < 0) {
+        ClearLayout();
+        return rc;
+    }
+    FILE * fp = SI_OpenFile(a_pszFile, bSplice ? "r+b" : "wb");
+    if (!fp) {
+        ClearLayout();
+        return SI_FILE;
+    }
+    bool bOk = (!bSplice || fseek(fp, (long) uFirst, SEEK_SET) == 0)
+        && fwrite(strOutput.data(), 1, strOutput.size(), fp) == strOutput.size()
+        && (!bSplice || SI_TruncateFile(fp, uFirst + strOutput.size()));
+    bOk = (fclose(fp) == 0) && bOk;
+    if (!bOk) {
+        ClearLayout();
+        return SI_FILE;
+    }
+    if (bRecord) {
+        SetLayout(a_pszFile, layout);
+    }
+    else {
+        ClearLayout();
+    }
+    m_uSavedModified = m_uModified;
+    return SI_UPDATED;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SpanEndsInComment(
+    const char *        a_pszFile,
+    const SectionSpan & a_span
+    ) const
+{
+    if (a_span.uEnd <= a_span.uStart) {
+        return false;
+    }
+
+    // if the span can't be read then assume the worst
+    FILE * fp = SI_OpenFile(a_pszFile, "rb");
+    if (!fp) {
+        return true;
+    }
+    std::string strSpan(a_span.uEnd - a_span.uStart, '\0');
+    bool bOk = fseek(fp, (long) a_span.uStart, SEEK_SET) == 0
+        && fread(&strSpan[0], 1, strSpan.size(), fp) == strSpan.size();
+    fclose(fp);
+    if (!bOk) {
+        return true;
+    }
+
+    // find the start of the last line that isn't blank
+    size_t uEnd = strSpan.size();
+    while (uEnd > 0 && IsSpace((SI_CHAR) strSpan[uEnd-1])) {
+        --uEnd;
+    }
+    size_t uLine = uEnd;
+    while (uLine > 0 && strSpan[uLine-1] != '\n' && strSpan[uLine-1] != '\r') {
+        --uLine;
+    }
+    while (uLine < uEnd && IsSpace((SI_CHAR) strSpan[uLine])) {
+        ++uLine;
+    }
+    return uLine < uEnd && IsComment((SI_CHAR) strSpan[uLine]);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::RecordLayout(
+    const char *    a_pszFile,
+    const SI_CHAR * a_pFile,
+    size_t          a_uLen
+    )
+{
+    ClearLayout();
+
+    // each section starts at the line of its comment, or of its header
+    TLayout layout;
+    SectionSpan oPreamble = { NULL, 0, 0, false, false };
+    layout.push_back(oPreamble);
+    typename TSection::const_iterator iSection = m_data.begin();
+    for ( ; iSection != m_data.end(); ++iSection) {
+        const Entry & section = iSection->first;
+        if (!*section.pItem) {
+            layout[0].pSection = section.pItem;
+            continue;
+        }
+        if (section.pItem < a_pFile || section.pItem >= a_pFile + a_uLen) {
+            return;
+        }
+        const SI_CHAR * pStart = section.pItem;
+        if (section.pComment && section.pComment >= a_pFile
+            && section.pComment < pStart)
+        {
+            pStart = section.pComment;
+        }
+        while (pStart > a_pFile && (pStart[-1] == ' '
+            || pStart[-1] == '\t' || pStart[-1] == '['))
+        {
+            --pStart;
+        }
+        SectionSpan span = { section.pItem, (size_t) (pStart - a_pFile), 0, false, false };
+        layout.push_back(span);
+    }
+    std::sort(layout.begin() + 1, layout.end(), SpanOrder());
+    for (size_t n = 0; n < layout.size(); ++n) {
+        layout[n].uEnd = (n+1 < layout.size()) ? layout[n+1].uStart : a_uLen;
     }
 
-    const TKeyVal & section = iSection->second;
-    const SI_CHAR * pLastKey = NULL;
-    typename TKeyVal::const_iterator iKeyVal = section.begin();
-    for (int n = 0; iKeyVal != section.end(); ++iKeyVal, ++n ) {
-        if (!pLastKey || IsLess(pLastKey, iKeyVal->first.pItem)) {
-            a_names.push_back(iKeyVal->first);
-            pLastKey = iKeyVal->first.pItem;
+    // a section in more than one part of the file has a header line for
+    // each, and so do some invalid section lines. The parsed lines may
+    // end in NULL instead of a newline.
+    size_t uHeaders = 0;
+    size_t uPos = 0;
+    if (m_bStoreIsUtf8 && a_uLen >= 3 && memcmp(a_pFile, SI_UTF8_SIGNATURE, 3) == 0) {
+        uPos = 3;
+    }
+    bool bLineStart = true;
+    for ( ; uPos < a_uLen; ++uPos) {
+        SI_CHAR c = a_pFile[uPos];
+        if (c == '\n' || c == '\r' || c == 0) {
+            bLineStart = true;
+        }
+        else if (bLineStart && c == '[') {
+            ++uHeaders;
+            bLineStart = false;
+        }
+        else if (c != ' ' && c != '\t') {
+            bLineStart = false;
         }
     }
-
-    return true;
+    if (uHeaders != layout.size() - 1) {
+        return;
+    }
+    SetLayout(a_pszFile, layout);
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SetLayout(
     const char *    a_pszFile,
-    bool            a_bAddSignature
+    TLayout &       a_layout
     ) const
 {
-    FILE * fp = NULL;
-#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
-    fopen_s(&fp, a_pszFile, "wb");
-#else // !__STDC_WANT_SECURE_LIB__
-    fp = fopen(a_pszFile, "wb");
-#endif // __STDC_WANT_SECURE_LIB__
-    if (!fp) return SI_FILE;
-    SI_Error rc = SaveFile(fp, a_bAddSignature);
-    fclose(fp);
-    return rc;
+    ClearLayout();
+    if (!SI_GetFileStamp(a_pszFile, m_uLayoutSize, m_uLayoutTime, NULL)) {
+        return;
+    }
+    m_strLayoutFile = a_pszFile;
+    m_layout.swap(a_layout);
+    for (size_t n = 0; n < m_layout.size(); ++n) {
+        if (m_layout[n].pSection) {
+            m_layoutIndex[m_layout[n].pSection] = n;
+        }
+    }
 }
 
 #ifdef SI_HAS_WIDE_FILE
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveFile(
     const SI_WCHAR_T *  a_pwszFile,
     bool                a_bAddSignature
     ) const
 {
 #ifdef _WIN32
+    SI_Error rc = UnshareFile(a_pwszFile);
+    if (rc < 0) {
+        return rc;
+    }
     FILE * fp = NULL;
 #if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
     _wfopen_s(&fp, a_pwszFile, L"wb");
@@ -2335,8 +5988,12 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
     fp = _wfopen(a_pwszFile, L"wb");
 #endif // __STDC_WANT_SECURE_LIB__
     if (!fp) return SI_FILE;
-    SI_Error rc = SaveFile(fp, a_bAddSignature);
+    ClearLayout();
+    rc = SaveFile(fp, a_bAddSignature);
     fclose(fp);
+    if (rc >= 0) {
+        m_uSavedModified = m_uModified;
+    }
     return rc;
 #else // !_WIN32 (therefore SI_CONVERT_ICU)
     char szFile[256];
@@ -2346,9 +6003,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
 }
 #endif // SI_HAS_WIDE_FILE
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveFile(
     FILE *  a_pFile,
     bool    a_bAddSignature
     ) const
@@ -2357,9 +6014,136 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
     return Save(writer, a_bAddSignature);
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveCache(
+    const char * a_pszCacheFile,
+    const char * a_pszSourceFile
+    ) const
+{
+    unsigned int uSize[2], uTime[3], uHash;
+    time_t tStamp = time(NULL);
+    if (!SI_GetFileStamp(a_pszSourceFile, uSize, uTime, &uHash)) {
+        return SI_FILE;
+    }
+    return SaveCache(a_pszCacheFile, uSize, uTime, uHash,
+        SI_IsStampAmbiguous(uTime, tStamp));
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SaveCache(
+    const char *        a_pszCacheFile,
+    const unsigned int  a_uSourceSize[2],
+    const unsigned int  a_uSourceTime[3],
+    unsigned int        a_uSourceHash,
+    bool                a_bHashAlways
+    ) const
+{
+    SI_CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, "SICACHE", 8);
+    header.uVersion = SI_CACHE_VERSION;
+    header.uCharSize = sizeof(SI_CHAR);
+    header.uFlags = CacheFlags();
+    header.nOrder = m_nOrder;
+    memcpy(header.uSourceSize, a_uSourceSize, sizeof(header.uSourceSize));
+    memcpy(header.uSourceTime, a_uSourceTime, sizeof(header.uSourceTime));
+    header.uSourceHash = a_uSourceHash;
+    header.uHashAlways = a_bHashAlways ? 1 : 0;
+
+    // size the tables first, offset 0 of the strings is not used so that it
+    // can mean NULL. Getting the keys parses any lazily loaded sections.
+    TNamesDepend sections;
+    GetAllSections(sections);
+    size_t uStrings = 1 + (m_pFileComment ? StrLen(m_pFileComment) + 1 : 0);
+    size_t uKeys = 0;
+    typename TNamesDepend::const_iterator iSection = sections.begin();
+    for ( ; iSection != sections.end(); ++iSection) {
+        uStrings += StrLen(iSection->pItem) + 1;
+        if (iSection->pComment) {
+            uStrings += StrLen(iSection->pComment) + 1;
+        }
+        const TKeyVal * pSection = GetSection(iSection->pItem);
+        typename TKeyVal::const_iterator iKey = pSection->begin();
+        for ( ; iKey != pSection->end(); ++iKey) {
+            uStrings += StrLen(iKey->first.pItem) + StrLen(iKey->second) + 2;
+            if (iKey->first.pComment) {
+                uStrings += StrLen(iKey->first.pComment) + 1;
+            }
+            ++uKeys;
+        }
+    }
+    if (uStrings > UINT_MAX || uKeys > UINT_MAX) {
+        return SI_FAIL;
+    }
+    header.uSections = (unsigned int) sections.size();
+    header.uKeys = (unsigned int) uKeys;
+    header.uStrings = (unsigned int) uStrings;
+
+    SI_CacheSection * pSections = new SI_CacheSection[header.uSections + 1];
+    SI_CacheKey * pKeys = new SI_CacheKey[uKeys + 1];
+    SI_CHAR * pStrings = new SI_CHAR[uStrings];
+    if (!pSections || !pKeys || !pStrings) {
+        delete[] pSections;
+        delete[] pKeys;
+        delete[] pStrings;
+        return SI_NOMEM;
+    }
+
+    // fill the tables in map order
+    size_t uUsed = 1;
+    pStrings[0] = 0;
+    header.uFileComment = AddCacheString(pStrings, uUsed, m_pFileComment);
+    SI_CacheSection * pSection = pSections;
+    SI_CacheKey * pKey = pKeys;
+    for (iSection = sections.begin(); iSection != sections.end(); ++iSection, ++pSection) {
+        pSection->uItem = AddCacheString(pStrings, uUsed, iSection->pItem);
+        pSection->uComment = AddCacheString(pStrings, uUsed, iSection->pComment);
+        pSection->nOrder = iSection->nOrder;
+        pSection->uKeys = 0;
+
+        const TKeyVal * pKeyVal = GetSection(iSection->pItem);
+        typename TKeyVal::const_iterator iKey = pKeyVal->begin();
+        for ( ; iKey != pKeyVal->end(); ++iKey, ++pKey) {
+            pKey->uItem = AddCacheString(pStrings, uUsed, iKey->first.pItem);
+            pKey->uValue = AddCacheString(pStrings, uUsed, iKey->second);
+            pKey->uComment = AddCacheString(pStrings, uUsed, iKey->first.pComment);
+            pKey->nOrder = iKey->first.nOrder;
+            ++pSection->uKeys;
+        }
+    }
+
+    // write a temporary file and then replace the cache with it
+    std::string strTemp;
+    FILE * fp = SI_OpenTempFile(a_pszCacheFile, strTemp);
+    bool bOk = fp
+        && fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(pSections, sizeof(SI_CacheSection), header.uSections, fp) == header.uSections
+        && fwrite(pKeys, sizeof(SI_CacheKey), uKeys, fp) == uKeys
+        && fwrite(pStrings, sizeof(SI_CHAR), uStrings, fp) == uStrings;
+    if (fp && fclose(fp) != 0) {
+        bOk = false;
+    }
+    delete[] pSections;
+    delete[] pKeys;
+    delete[] pStrings;
+
+    if (bOk && !SI_ReplaceFile(strTemp.c_str(), a_pszCacheFile)) {
+        bOk = false;
+    }
+    if (!bOk) {
+        if (fp) {
+            remove(strTemp.c_str());
+        }
+        return SI_FILE;
+    }
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Save(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::Save(
     OutputWriter &  a_oOutput,
     bool            a_bAddSignature
     ) const
@@ -2371,17 +6155,6 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Save(
         a_oOutput.Write(SI_UTF8_SIGNATURE);
     }
 
-    // get all of the sections sorted in load order
-    TNamesDepend oSections;
-    GetAllSections(oSections);
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-    oSections.sort();
-#elif defined(__BORLANDC__)
-    oSections.sort(Entry::LoadOrder());
-#else
-    oSections.sort(typename Entry::LoadOrder());
-#endif
-
     // write the file comment if we have one
     bool bNeedNewLine = false;
     if (m_pFileComment) {
@@ -2391,102 +6164,112 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Save(
         bNeedNewLine = true;
     }
 
-    // iterate through our sections and output the data
-    typename TNamesDepend::const_iterator iSection = oSections.begin();
-    for ( ; iSection != oSections.end(); ++iSection ) {
-        // write out the comment if there is one
-        if (iSection->pComment) {
-            if (bNeedNewLine) {
-                a_oOutput.Write(SI_NEWLINE_A);
-                a_oOutput.Write(SI_NEWLINE_A);
-            }
-            if (!OutputMultiLineText(a_oOutput, convert, iSection->pComment)) {
-                return SI_FAIL;
-            }
-            bNeedNewLine = false;
+    // walk our sections in load order and output the data
+    SectionOutput output(*this, a_oOutput, convert, bNeedNewLine);
+    if (!VisitSections(output, true)) {
+        return SI_FAIL;
+    }
+
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OutputSection(
+    OutputWriter &  a_oOutput,
+    Converter &     a_oConverter,
+    const Entry &   a_section
+    ) const
+{
+    // write out the comment if there is one
+    if (a_section.pComment) {
+        if (!OutputMultiLineText(a_oOutput, a_oConverter, a_section.pComment)) {
+            return false;
         }
+    }
 
-        if (bNeedNewLine) {
-            a_oOutput.Write(SI_NEWLINE_A);
-            a_oOutput.Write(SI_NEWLINE_A);
-            bNeedNewLine = false;
+    // write the section (unless there is no section name)
+    if (*a_section.pItem) {
+        if (!a_oConverter.ConvertToStore(a_section.pItem)) {
+            return false;
         }
+        a_oOutput.Write("[");
+        a_oOutput.Write(a_oConverter.Data());
+        a_oOutput.Write("]");
+        a_oOutput.Write(SI_NEWLINE_A);
+    }
 
-        // write the section (unless there is no section name)
-        if (*iSection->pItem) {
-            if (!convert.ConvertToStore(iSection->pItem)) {
-                return SI_FAIL;
+    // write all keys in load order. The values of a key follow the first
+    // of them in the map, in the order they were added.
+    typename TSection::const_iterator iSection = FindSection(a_section.pItem);
+    const SectionOrder * pOrder = (iSection == m_data.end()) ? NULL :
+        const_cast<CSimpleIniTempl *>(this)->FindOrder(iSection->first);
+    if (!pOrder) {
+        return true;
+    }
+    for (size_t n = 0; n < pOrder->keys.size(); ++n) {
+        typename TKeyVal::const_iterator iKeyVal = pOrder->keys[n];
+        const Entry & key = iKeyVal->first;
+        do {
+            Entry oValue(iKeyVal->second, iKeyVal->first.pComment, iKeyVal->first.nOrder);
+            if (!OutputValue(a_oOutput, a_oConverter, key, oValue)) {
+                return false;
             }
-            a_oOutput.Write("[");
-            a_oOutput.Write(convert.Data());
-            a_oOutput.Write("]");
-            a_oOutput.Write(SI_NEWLINE_A);
+            ++iKeyVal;
         }
+        while (m_bAllowMultiKey && iKeyVal != iSection->second.end()
+            && !IsLess(key.pItem, iKeyVal->first.pItem));
+    }
+    return true;
+}
 
-        // get all of the keys sorted in load order
-        TNamesDepend oKeys;
-        GetAllKeys(iSection->pItem, oKeys);
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-        oKeys.sort();
-#elif defined(__BORLANDC__)
-        oKeys.sort(Entry::LoadOrder());
-#else
-        oKeys.sort(typename Entry::LoadOrder());
-#endif
-
-        // write all keys and values
-        typename TNamesDepend::const_iterator iKey = oKeys.begin();
-        for ( ; iKey != oKeys.end(); ++iKey) {
-            // get all values for this key
-            TNamesDepend oValues;
-            GetAllValues(iSection->pItem, iKey->pItem, oValues);
-
-            typename TNamesDepend::const_iterator iValue = oValues.begin();
-            for ( ; iValue != oValues.end(); ++iValue) {
-                // write out the comment if there is one
-                if (iValue->pComment) {
-                    a_oOutput.Write(SI_NEWLINE_A);
-                    if (!OutputMultiLineText(a_oOutput, convert, iValue->pComment)) {
-                        return SI_FAIL;
-                    }
-                }
-
-                // write the key
-                if (!convert.ConvertToStore(iKey->pItem)) {
-                    return SI_FAIL;
-                }
-                a_oOutput.Write(convert.Data());
-
-                // write the value
-                if (!convert.ConvertToStore(iValue->pItem)) {
-                    return SI_FAIL;
-                }
-                a_oOutput.Write(m_bSpaces ? " = " : "=");
-                if (m_bAllowMultiLine && IsMultiLineData(iValue->pItem)) {
-                    // multi-line data needs to be processed specially to ensure
-                    // that we use the correct newline format for the current system
-                    a_oOutput.Write("<<<END_OF_TEXT" SI_NEWLINE_A);
-                    if (!OutputMultiLineText(a_oOutput, convert, iValue->pItem)) {
-                        return SI_FAIL;
-                    }
-                    a_oOutput.Write("END_OF_TEXT");
-                }
-                else {
-                    a_oOutput.Write(convert.Data());
-                }
-                a_oOutput.Write(SI_NEWLINE_A);
-            }
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OutputValue(
+    OutputWriter &  a_oOutput,
+    Converter &     a_oConverter,
+    const Entry &   a_key,
+    const Entry &   a_value
+    ) const
+{
+    // write out the comment if there is one
+    if (a_value.pComment) {
+        a_oOutput.Write(SI_NEWLINE_A);
+        if (!OutputMultiLineText(a_oOutput, a_oConverter, a_value.pComment)) {
+            return false;
         }
+    }
 
-        bNeedNewLine = true;
+    // write the key
+    if (!a_oConverter.ConvertToStore(a_key.pItem)) {
+        return false;
     }
+    a_oOutput.Write(a_oConverter.Data());
 
-    return SI_OK;
+    // write the value
+    if (!a_oConverter.ConvertToStore(a_value.pItem)) {
+        return false;
+    }
+    a_oOutput.Write(m_bSpaces ? " = " : "=");
+    if (m_bAllowMultiLine && IsMultiLineData(a_value.pItem)) {
+        // multi-line data needs to be processed specially to ensure
+        // that we use the correct newline format for the current system
+        a_oOutput.Write("<<<END_OF_TEXT" SI_NEWLINE_A);
+        if (!OutputMultiLineText(a_oOutput, a_oConverter, a_value.pItem)) {
+            return false;
+        }
+        a_oOutput.Write("END_OF_TEXT");
+    }
+    else {
+        a_oOutput.Write(a_oConverter.Data());
+    }
+    a_oOutput.Write(SI_NEWLINE_A);
+    return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::OutputMultiLineText(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OutputMultiLineText(
     OutputWriter &  a_oOutput,
     Converter &     a_oConverter,
     const SI_CHAR * a_pText
@@ -2513,9 +6296,9 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::OutputMultiLineText(
     return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
 bool
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::Delete(
     const SI_CHAR * a_pSection,
     const SI_CHAR * a_pKey,
     bool            a_bRemoveEmpty
@@ -2525,17 +6308,29 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
         return false;
     }
 
-    typename TSection::iterator iSection = m_data.find(a_pSection);
+    // the keys of a section that is removed don't need to be parsed
+    typename TSection::iterator iSection = UseIndex() ?
+        FindIndexedSection(a_pSection) : m_data.find(a_pSection);
     if (iSection == m_data.end()) {
         return false;
     }
+    if (a_pKey && !m_lazy.empty()) {
+        LoadLazySection(iSection->first.pItem);
+    }
 
     // remove a single key if we have a keyname
     if (a_pKey) {
-        typename TKeyVal::iterator iKeyVal = iSection->second.find(a_pKey);
+        typename TKeyVal::iterator iKeyVal = FindKey(iSection->second, a_pKey);
         if (iKeyVal == iSection->second.end()) {
             return false;
         }
+        ++m_uGeneration;
+        ++m_uModified;
+        UnindexKey(iSection->second, a_pKey);
+        UnorderKey(iSection, iKeyVal);
+        if (!m_layout.empty()) {
+            LayoutChanged(iSection->first.pItem, false);
+        }
 
         // remove any copied strings and then the key
         typename TKeyVal::iterator iDelete;
@@ -2555,10 +6350,14 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
         if (!a_bRemoveEmpty || !iSection->second.empty()) {
             return true;
         }
+        UnindexSection(iSection);
     }
     else {
         // delete all copied strings from this section. The actual
         // entries will be removed when the section is removed.
+        ++m_uGeneration;
+        ++m_uModified;
+        UnindexSection(iSection);
         typename TKeyVal::iterator iKeyVal = iSection->second.begin();
         for ( ; iKeyVal != iSection->second.end(); ++iKeyVal) {
             DeleteString(iKeyVal->first.pItem);
@@ -2567,31 +6366,353 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
     }
 
     // delete the section itself
+    UnorderSection(iSection);
+    m_lazy.erase(iSection->first.pItem);
+    if (!m_layout.empty()) {
+        LayoutChanged(iSection->first.pItem, true);
+    }
     DeleteString(iSection->first.pItem);
     m_data.erase(iSection);
 
     return true;
 }
 
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-void
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::DeleteString(
-    const SI_CHAR * a_pString
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::TSection::iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindIndexedSection(
+    const SI_CHAR * a_pSection
+    )
+{
+    SectionMatch match = { a_pSection };
+    SectionSlot * pSlot = m_sectionIndex.Find(SI_STRHASH()(a_pSection), match);
+    return pSlot ? pSlot->iSection : m_data.end();
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::TKeyVal::iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindIndexedKey(
+    TKeyVal &       a_keyval,
+    const SI_CHAR * a_pKey
+    )
+{
+    KeyMatch match = { &a_keyval, a_pKey };
+    KeySlot * pSlot = m_keyIndex.Find(KeyHash(&a_keyval, a_pKey), match);
+    return pSlot ? pSlot->iKey : a_keyval.end();
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IndexSection(
+    typename TSection::iterator a_iSection
+    )
+{
+    if (!SI_STRHASH::enabled || m_bIndexStale) {
+        return;
+    }
+    SectionSlot slot;
+    slot.uHash = SI_STRHASH()(a_iSection->first.pItem);
+    slot.iSection = a_iSection;
+    if (!m_sectionIndex.Insert(slot)) {
+        m_bIndexStale = true;
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::IndexKey(
+    TKeyVal &                   a_keyval,
+    typename TKeyVal::iterator  a_iKey
+    )
+{
+    if (!SI_STRHASH::enabled || m_bIndexStale) {
+        return;
+    }
+    KeySlot slot;
+    slot.uHash = KeyHash(&a_keyval, a_iKey->first.pItem);
+    slot.pOwner = &a_keyval;
+    slot.iKey = a_iKey;
+    if (!m_keyIndex.Insert(slot)) {
+        m_bIndexStale = true;
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::UnindexSection(
+    typename TSection::iterator a_iSection
+    )
+{
+    if (!SI_STRHASH::enabled || m_bIndexStale) {
+        return;
+    }
+
+    // remove the slot of each key name
+    TKeyVal & keyval = a_iSection->second;
+    typename TKeyVal::iterator iKey = keyval.begin();
+    while (iKey != keyval.end()) {
+        const SI_CHAR * pKey = iKey->first.pItem;
+        UnindexKey(keyval, pKey);
+        while (iKey != keyval.end() && !IsLess(pKey, iKey->first.pItem)) {
+            ++iKey;
+        }
+    }
+
+    SectionMatch match = { a_iSection->first.pItem };
+    SectionSlot * pSlot = m_sectionIndex.Find(
+        SI_STRHASH()(a_iSection->first.pItem), match);
+    if (pSlot) {
+        m_sectionIndex.Erase(pSlot);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::UnindexKey(
+    TKeyVal &       a_keyval,
+    const SI_CHAR * a_pKey
+    )
+{
+    if (!SI_STRHASH::enabled || m_bIndexStale) {
+        return;
+    }
+    KeyMatch match = { &a_keyval, a_pKey };
+    KeySlot * pSlot = m_keyIndex.Find(KeyHash(&a_keyval, a_pKey), match);
+    if (pSlot) {
+        m_keyIndex.Erase(pSlot);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::RebuildIndex()
+{
+    m_sectionIndex.Clear();
+    m_keyIndex.Clear();
+    m_bIndexStale = false;
+
+    typename TSection::iterator iSection = m_data.begin();
+    for ( ; iSection != m_data.end() && !m_bIndexStale; ++iSection) {
+        IndexSection(iSection);
+
+        // only the first key of each name is indexed
+        TKeyVal & keyval = iSection->second;
+        const SI_CHAR * pLastKey = NULL;
+        typename TKeyVal::iterator iKey = keyval.begin();
+        for ( ; iKey != keyval.end(); ++iKey) {
+            if (!pLastKey || IsLess(pLastKey, iKey->first.pItem)) {
+                IndexKey(keyval, iKey);
+                pLastKey = iKey->first.pItem;
+            }
+        }
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::SectionOrder *
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::FindOrder(
+    const Entry &   a_section
+    )
+{
+    UseOrder();
+    if (m_order.empty()) {
+        return NULL;
+    }
+
+    // keys are mostly added to the last section
+    OrderLess isLess;
+    if (isLess(m_order.back(), a_section)) {
+        return NULL;
+    }
+    if (!isLess(a_section, m_order.back())) {
+        return &m_order.back();
+    }
+    typename TOrder::iterator i = std::lower_bound(
+        m_order.begin(), m_order.end(), a_section, isLess);
+    if (i == m_order.end() || isLess(a_section, *i)) {
+        return NULL;
+    }
+    return &(*i);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OrderSection(
+    typename TSection::iterator a_iSection
+    )
+{
+    if (m_bOrderStale) {
+        return;
+    }
+    OrderLess isLess;
+    typename TOrder::iterator i = m_order.end();
+    if (!m_order.empty() && isLess(a_iSection->first, m_order.back())) {
+        i = std::upper_bound(m_order.begin(), m_order.end(),
+            a_iSection->first, isLess);
+    }
+    SectionOrder order;
+    order.iSection = a_iSection;
+    m_order.insert(i, order);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OrderKey(
+    typename TSection::iterator a_iSection,
+    typename TKeyVal::iterator  a_iKey
+    )
+{
+    if (m_bOrderStale) {
+        return;
+    }
+    SectionOrder * pOrder = FindOrder(a_iSection->first);
+    if (!pOrder) {
+        m_bOrderStale = true;
+        return;
+    }
+    std::vector<typename TKeyVal::const_iterator> & keys = pOrder->keys;
+    OrderLess isLess;
+    if (keys.empty() || !isLess(a_iKey->first, keys.back())) {
+        keys.push_back(a_iKey);
+    }
+    else {
+        keys.insert(std::upper_bound(keys.begin(), keys.end(),
+            a_iKey->first, isLess), a_iKey);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::UnorderSection(
+    typename TSection::iterator a_iSection
+    )
+{
+    if (m_bOrderStale) {
+        return;
+    }
+    typename TOrder::iterator i = std::lower_bound(
+        m_order.begin(), m_order.end(), a_iSection->first, OrderLess());
+    if (i != m_order.end() && i->iSection == a_iSection) {
+        m_order.erase(i);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::UnorderKey(
+    typename TSection::iterator a_iSection,
+    typename TKeyVal::iterator  a_iKey
+    )
+{
+    if (m_bOrderStale) {
+        return;
+    }
+    SectionOrder * pOrder = FindOrder(a_iSection->first);
+    if (!pOrder) {
+        return;
+    }
+    std::vector<typename TKeyVal::const_iterator> & keys = pOrder->keys;
+    typename std::vector<typename TKeyVal::const_iterator>::iterator i =
+        std::lower_bound(keys.begin(), keys.end(), a_iKey->first, OrderLess());
+    if (i != keys.end() && *i == typename TKeyVal::const_iterator(a_iKey)) {
+        keys.erase(i);
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::RebuildOrder()
+{
+    m_order.clear();
+    m_bOrderStale = false;
+
+    // the sections are sorted before their key lists are made, so that the
+    // lists aren't copied around by the sort
+    std::vector<typename TSection::const_iterator> oSections;
+    oSections.reserve(m_data.size());
+    typename TSection::const_iterator iSection = m_data.begin();
+    for ( ; iSection != m_data.end(); ++iSection) {
+        oSections.push_back(iSection);
+    }
+    std::sort(oSections.begin(), oSections.end(), OrderLess());
+
+    for (size_t n = 0; n < oSections.size(); ++n) {
+        m_order.push_back(SectionOrder());
+        SectionOrder & order = m_order.back();
+        order.iSection = oSections[n];
+
+        // only the first key of each name is ordered
+        const TKeyVal & keyval = oSections[n]->second;
+        const SI_CHAR * pLastKey = NULL;
+        typename TKeyVal::const_iterator iKey = keyval.begin();
+        for ( ; iKey != keyval.end(); ++iKey) {
+            if (!pLastKey || IsLess(pLastKey, iKey->first.pItem)) {
+                order.keys.push_back(iKey);
+                pLastKey = iKey->first.pItem;
+            }
+        }
+        std::sort(order.keys.begin(), order.keys.end(), OrderLess());
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::DeleteString(
+    const SI_CHAR * a_pString
+    )
+{
+    // strings may exist either inside the data block, or they will be
+    // individually allocated by CopyString(). Apart from the empty section
+    // name, every string outside of the data block is a copy, so we can
+    // physically delete it without searching for it.
+    if (!a_pString || a_pString == EmptySection()
+        || (a_pString >= m_pData && a_pString < m_pData + m_uDataLen))
+    {
+        return;
+    }
+    if (SI_AllocTraits<SI_ALLOC>::arena) {
+        m_arena.Free(const_cast<SI_CHAR*>(a_pString),
+            sizeof(SI_CHAR) * (StrLen(a_pString) + 1));
+        return;
+    }
+
+    StringHeader * pHeader = (StringHeader *) a_pString - 1;
+    if (pHeader->pPrev) {
+        pHeader->pPrev->pNext = pHeader->pNext;
+    }
+    else {
+        m_pStrings = pHeader->pNext;
+    }
+    if (pHeader->pNext) {
+        pHeader->pNext->pPrev = pHeader->pPrev;
+    }
+    delete[] (char *) pHeader;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC>::OverwriteString(
+    const SI_CHAR * a_pString,
+    const SI_CHAR * a_pNew
     )
 {
-    // strings may exist either inside the data block, or they will be
-    // individually allocated and stored in m_strings. We only physically
-    // delete those stored in m_strings.
-    if (a_pString < m_pData || a_pString >= m_pData + m_uDataLen) {
-        typename TNamesDepend::iterator i = m_strings.begin();
-        for (;i != m_strings.end(); ++i) {
-            if (a_pString == i->pItem) {
-                delete[] const_cast<SI_CHAR*>(i->pItem);
-                m_strings.erase(i);
-                break;
-            }
-        }
+    // arena strings aren't overwritten, a deleted arena string is reused by
+    // the next copy of the same size anyway
+    if (!a_pString || a_pString == EmptySection()
+        || (a_pString >= m_pData && a_pString < m_pData + m_uDataLen)
+        || SI_AllocTraits<SI_ALLOC>::arena)
+    {
+        return false;
+    }
+
+    const StringHeader * pHeader = (const StringHeader *) a_pString - 1;
+    size_t uLen = StrLen(a_pNew) + 1; // NULL character
+    if (uLen > pHeader->uCapacity) {
+        return false;
     }
+
+    // the new value may be part of the old one
+    memmove(const_cast<SI_CHAR*>(a_pString), a_pNew, sizeof(SI_CHAR)*uLen);
+    return true;
 }
 
 // ---------------------------------------------------------------------------
@@ -3335,6 +7456,511 @@ public:
 #endif // SI_CONVERT_WIN32
 
 
+// ---------------------------------------------------------------------------
+//                                  FROZEN DATA
+// ---------------------------------------------------------------------------
+
+/** Read-only copy of the data of a CSimpleIniTempl.
+
+    Data that is never modified after it has been loaded can be frozen into
+    this compact form. All strings are stored in a single block, and the
+    sections and the keys of all sections are each stored in one array,
+    sorted in the same way as the maps of CSimpleIniTempl and searched with
+    a binary search. Names, values and comments are referred to by their
+    offset in the string block.
+
+    The frozen data doesn't depend on the object it was built from, which
+    may be modified or destroyed afterwards.
+
+    @code
+        CSimpleIniA ini;
+        ini.LoadFile("reference.ini");
+        CSimpleIniFrozenA frozen;
+        SI_Error rc = frozen.Freeze(ini);
+        ini.Reset();
+        const char * pVal = frozen.GetValue("section", "key", "default");
+    @endcode
+ */
+template<class SI_CHAR, class SI_STRLESS>
+class CSimpleIniFrozenTempl
+{
+public:
+    /** key entry and its orderings, those of CSimpleIniTempl. They don't
+        depend on the converter, which is only named to reach them. */
+    typedef typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,
+        SI_ConvertA<SI_CHAR> >::Entry Entry;
+
+    /** set of dependent string pointers. Note that these pointers are
+        dependent on memory owned by the frozen data.
+    */
+    typedef std::list<Entry> TNamesDepend;
+
+    /** A key of the frozen data. The strings are offsets in the string
+        block, see GetString(). */
+    struct Key {
+        unsigned int    uItem;      //!< name of the key
+        unsigned int    uValue;     //!< value of the key
+        unsigned int    uComment;   //!< comment, 0 if there is none
+        int             nOrder;     //!< load order
+    };
+
+    /** A section of the frozen data. Its keys are the array elements
+        uFirstKey to uFirstKey + uKeys - 1, sorted by name. */
+    struct Section {
+        unsigned int    uItem;      //!< name of the section
+        unsigned int    uComment;   //!< comment, 0 if there is none
+        int             nOrder;     //!< load order
+        unsigned int    uFirstKey;  //!< index of the first key
+        unsigned int    uKeys;      //!< number of keys, including duplicates
+    };
+
+public:
+    /** Default constructor, there is no data until Freeze() is called */
+    CSimpleIniFrozenTempl()
+        : m_pStrings(NULL), m_pSections(NULL), m_uSections(0)
+        , m_pKeys(NULL), m_uKeys(0), m_bAllowMultiKey(false)
+    { }
+
+    /** Destructor */
+    ~CSimpleIniFrozenTempl() {
+        Reset();
+    }
+
+    /** Deallocate all memory */
+    void Reset() {
+        delete[] m_pStrings;
+        delete[] m_pSections;
+        delete[] m_pKeys;
+        m_pStrings = NULL;
+        m_pSections = NULL;
+        m_pKeys = NULL;
+        m_uSections = 0;
+        m_uKeys = 0;
+        m_bAllowMultiKey = false;
+    }
+
+    /** Has any data been frozen? */
+    bool IsEmpty() const { return m_uSections == 0; }
+
+    /** Replace the frozen data with a copy of the data of an object. Any
+        sections of the object that haven't been parsed yet because of lazy
+        loading are parsed first.
+
+        @param a_ini        Object to copy the data from
+
+        @return SI_Error    See error definitions
+     */
+    template<class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+    SI_Error Freeze(
+        const CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC> & a_ini
+        );
+
+    /** Retrieve the value for a specific key, see CSimpleIniTempl::GetValue().
+        The returned pointer is valid until the data is reset or replaced.
+     */
+    const SI_CHAR * GetValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        const SI_CHAR * a_pDefault     = NULL,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve all values for a specific key, see
+        CSimpleIniTempl::GetAllValues(). */
+    bool GetAllValues(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        TNamesDepend &  a_values
+        ) const;
+
+    /** Retrieve all section names, sorted by name */
+    void GetAllSections(
+        TNamesDepend & a_names
+        ) const;
+
+    /** Retrieve all unique key names in a section, see
+        CSimpleIniTempl::GetAllKeys(). */
+    bool GetAllKeys(
+        const SI_CHAR * a_pSection,
+        TNamesDepend &  a_names
+        ) const;
+
+    /** Query the number of unique keys in a section, or -1 if the section
+        doesn't exist. */
+    int GetSectionSize(
+        const SI_CHAR * a_pSection
+        ) const;
+
+    /** Retrieve the keys of a section, sorted by name.
+
+        @param a_pSection   Name of the section
+        @param a_uKeys      Receives the number of keys
+
+        @return NULL        Section was not found
+        @return other       First key of the section
+     */
+    const Key * GetSection(
+        const SI_CHAR * a_pSection,
+        size_t &        a_uKeys
+        ) const;
+
+    /** Retrieve a string of a Key or Section from its offset */
+    const SI_CHAR * GetString(unsigned int a_uOffset) const {
+        return a_uOffset ? m_pStrings + a_uOffset : NULL;
+    }
+
+private:
+    /** Find a section, returning NULL if it doesn't exist */
+    const Section * FindSection(const SI_CHAR * a_pSection) const;
+
+    /** Find the first key with a name in a section, returning NULL if it
+        doesn't exist */
+    const Key * FindKey(const Section & a_section, const SI_CHAR * a_pKey) const;
+
+    /** Internal use of our string comparison function */
+    static bool IsLess(const SI_CHAR * a_pLeft, const SI_CHAR * a_pRight) {
+        const static SI_STRLESS isLess = SI_STRLESS();
+        return isLess(a_pLeft, a_pRight);
+    }
+
+    /** Add a string to the string block, returning its offset */
+    static unsigned int AddString(
+        SI_CHAR *           a_pStrings,
+        size_t &            a_uUsed,
+        const SI_CHAR *     a_pString
+        );
+
+    /** Number of characters needed to store a string, 0 for NULL */
+    static size_t StringSize(const SI_CHAR * a_pString) {
+        if (!a_pString) {
+            return 0;
+        }
+        size_t uLen = 0;
+        for ( ; a_pString[uLen]; ++uLen) /*loop*/ ;
+        return uLen + 1;
+    }
+
+private:
+    /** All strings. Offset 0 is not used so that it can mean NULL. */
+    SI_CHAR * m_pStrings;
+
+    /** Sections, sorted by name */
+    Section * m_pSections;
+    unsigned int m_uSections;
+
+    /** Keys of all sections, in the order of their sections */
+    Key * m_pKeys;
+    unsigned int m_uKeys;
+
+    /** Was the data frozen from an object allowing multiple keys? */
+    bool m_bAllowMultiKey;
+
+    // copying is not permitted
+    CSimpleIniFrozenTempl(const CSimpleIniFrozenTempl &); // disable
+    CSimpleIniFrozenTempl & operator=(const CSimpleIniFrozenTempl &); // disable
+};
+
+template<class SI_CHAR, class SI_STRLESS>
+template<class SI_CONVERTER, class SI_STRHASH, class SI_ALLOC>
+SI_Error
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::Freeze(
+    const CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC> & a_ini
+    )
+{
+    typedef CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER,SI_STRHASH,SI_ALLOC> SourceIni;
+    Reset();
+
+    // the sections are already in name order, and so are the keys of each
+    // section with duplicate keys in the order they were added
+    typename SourceIni::TNamesDepend sections;
+    a_ini.GetAllSections(sections);
+    if (sections.empty()) {
+        return SI_OK;
+    }
+
+    // size everything first so that each array is a single allocation
+    size_t uStrings = 1;
+    size_t uKeys = 0;
+    typename SourceIni::TNamesDepend::const_iterator iSection = sections.begin();
+    for ( ; iSection != sections.end(); ++iSection) {
+        uStrings += StringSize(iSection->pItem) + StringSize(iSection->pComment);
+        const typename SourceIni::TKeyVal * pSection = a_ini.GetSection(iSection->pItem);
+        typename SourceIni::TKeyVal::const_iterator iKey = pSection->begin();
+        for ( ; iKey != pSection->end(); ++iKey) {
+            uStrings += StringSize(iKey->first.pItem)
+                + StringSize(iKey->first.pComment) + StringSize(iKey->second);
+            ++uKeys;
+        }
+    }
+    if (uStrings > UINT_MAX || uKeys > UINT_MAX) {
+        return SI_NOMEM;
+    }
+
+    m_pStrings = new SI_CHAR[uStrings];
+    m_pSections = new Section[sections.size()];
+    m_pKeys = new Key[uKeys ? uKeys : 1];
+    if (!m_pStrings || !m_pSections || !m_pKeys) {
+        Reset();
+        return SI_NOMEM;
+    }
+    m_pStrings[0] = 0;
+
+    size_t uUsed = 1;
+    for (iSection = sections.begin(); iSection != sections.end(); ++iSection) {
+        Section & section = m_pSections[m_uSections++];
+        section.uItem = AddString(m_pStrings, uUsed, iSection->pItem);
+        section.uComment = AddString(m_pStrings, uUsed, iSection->pComment);
+        section.nOrder = iSection->nOrder;
+        section.uFirstKey = m_uKeys;
+
+        const typename SourceIni::TKeyVal * pSection = a_ini.GetSection(iSection->pItem);
+        typename SourceIni::TKeyVal::const_iterator iKey = pSection->begin();
+        for ( ; iKey != pSection->end(); ++iKey) {
+            Key & key = m_pKeys[m_uKeys++];
+            key.uItem = AddString(m_pStrings, uUsed, iKey->first.pItem);
+            key.uValue = AddString(m_pStrings, uUsed, iKey->second);
+            key.uComment = AddString(m_pStrings, uUsed, iKey->first.pComment);
+            key.nOrder = iKey->first.nOrder;
+        }
+        section.uKeys = m_uKeys - section.uFirstKey;
+    }
+    m_bAllowMultiKey = a_ini.IsMultiKey();
+
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+unsigned int
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::AddString(
+    SI_CHAR *           a_pStrings,
+    size_t &            a_uUsed,
+    const SI_CHAR *     a_pString
+    )
+{
+    if (!a_pString) {
+        return 0;
+    }
+    size_t uSize = StringSize(a_pString);
+    unsigned int uOffset = (unsigned int) a_uUsed;
+    memcpy(a_pStrings + a_uUsed, a_pString, sizeof(SI_CHAR)*uSize);
+    a_uUsed += uSize;
+    return uOffset;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+const typename CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::Section *
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::FindSection(
+    const SI_CHAR * a_pSection
+    ) const
+{
+    if (!a_pSection) {
+        return NULL;
+    }
+
+    // find the first section that isn't less than the name
+    unsigned int uLow = 0;
+    unsigned int uHigh = m_uSections;
+    while (uLow < uHigh) {
+        unsigned int uMid = uLow + (uHigh - uLow) / 2;
+        if (IsLess(m_pStrings + m_pSections[uMid].uItem, a_pSection)) {
+            uLow = uMid + 1;
+        }
+        else {
+            uHigh = uMid;
+        }
+    }
+    if (uLow == m_uSections || IsLess(a_pSection, m_pStrings + m_pSections[uLow].uItem)) {
+        return NULL;
+    }
+    return &m_pSections[uLow];
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+const typename CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::Key *
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::FindKey(
+    const Section & a_section,
+    const SI_CHAR * a_pKey
+    ) const
+{
+    // find the first key that isn't less than the name, which is the first
+    // of the duplicates of a key
+    unsigned int uLow = a_section.uFirstKey;
+    unsigned int uEnd = a_section.uFirstKey + a_section.uKeys;
+    unsigned int uHigh = uEnd;
+    while (uLow < uHigh) {
+        unsigned int uMid = uLow + (uHigh - uLow) / 2;
+        if (IsLess(m_pStrings + m_pKeys[uMid].uItem, a_pKey)) {
+            uLow = uMid + 1;
+        }
+        else {
+            uHigh = uMid;
+        }
+    }
+    if (uLow == uEnd || IsLess(a_pKey, m_pStrings + m_pKeys[uLow].uItem)) {
+        return NULL;
+    }
+    return &m_pKeys[uLow];
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+const SI_CHAR *
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetValue(
+    const SI_CHAR * a_pSection,
+    const SI_CHAR * a_pKey,
+    const SI_CHAR * a_pDefault,
+    bool *          a_pHasMultiple
+    ) const
+{
+    if (a_pHasMultiple) {
+        *a_pHasMultiple = false;
+    }
+    if (!a_pSection || !a_pKey) {
+        return a_pDefault;
+    }
+    const Section * pSection = FindSection(a_pSection);
+    if (!pSection) {
+        return a_pDefault;
+    }
+    const Key * pKey = FindKey(*pSection, a_pKey);
+    if (!pKey) {
+        return a_pDefault;
+    }
+
+    // check for multiple entries with the same key
+    if (m_bAllowMultiKey && a_pHasMultiple) {
+        const Key * pNext = pKey + 1;
+        if (pNext != m_pKeys + pSection->uFirstKey + pSection->uKeys
+            && !IsLess(a_pKey, m_pStrings + pNext->uItem))
+        {
+            *a_pHasMultiple = true;
+        }
+    }
+
+    return m_pStrings + pKey->uValue;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+bool
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetAllValues(
+    const SI_CHAR * a_pSection,
+    const SI_CHAR * a_pKey,
+    TNamesDepend &  a_values
+    ) const
+{
+    a_values.clear();
+
+    if (!a_pSection || !a_pKey) {
+        return false;
+    }
+    const Section * pSection = FindSection(a_pSection);
+    if (!pSection) {
+        return false;
+    }
+    const Key * pKey = FindKey(*pSection, a_pKey);
+    if (!pKey) {
+        return false;
+    }
+
+    // insert all values for this key
+    const Key * pEnd = m_pKeys + pSection->uFirstKey + pSection->uKeys;
+    do {
+        a_values.push_back(Entry(m_pStrings + pKey->uValue,
+            GetString(pKey->uComment), pKey->nOrder));
+        ++pKey;
+    }
+    while (pKey != pEnd && !IsLess(a_pKey, m_pStrings + pKey->uItem));
+
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+void
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetAllSections(
+    TNamesDepend & a_names
+    ) const
+{
+    a_names.clear();
+    for (unsigned int n = 0; n < m_uSections; ++n) {
+        const Section & section = m_pSections[n];
+        a_names.push_back(Entry(m_pStrings + section.uItem,
+            GetString(section.uComment), section.nOrder));
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+bool
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetAllKeys(
+    const SI_CHAR * a_pSection,
+    TNamesDepend &  a_names
+    ) const
+{
+    a_names.clear();
+
+    const Section * pSection = FindSection(a_pSection);
+    if (!pSection) {
+        return false;
+    }
+
+    const SI_CHAR * pLastKey = NULL;
+    const Key * pKey = m_pKeys + pSection->uFirstKey;
+    const Key * pEnd = pKey + pSection->uKeys;
+    for ( ; pKey != pEnd; ++pKey) {
+        const SI_CHAR * pItem = m_pStrings + pKey->uItem;
+        if (!pLastKey || IsLess(pLastKey, pItem)) {
+            a_names.push_back(Entry(pItem, GetString(pKey->uComment), pKey->nOrder));
+            pLastKey = pItem;
+        }
+    }
+
+    return true;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+int
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetSectionSize(
+    const SI_CHAR * a_pSection
+    ) const
+{
+    const Section * pSection = FindSection(a_pSection);
+    if (!pSection) {
+        return -1;
+    }
+    if (!m_bAllowMultiKey) {
+        return (int) pSection->uKeys;
+    }
+
+    // otherwise we need to count them
+    int nCount = 0;
+    const SI_CHAR * pLastKey = NULL;
+    const Key * pKey = m_pKeys + pSection->uFirstKey;
+    const Key * pEnd = pKey + pSection->uKeys;
+    for ( ; pKey != pEnd; ++pKey) {
+        const SI_CHAR * pItem = m_pStrings + pKey->uItem;
+        if (!pLastKey || IsLess(pLastKey, pItem)) {
+            ++nCount;
+            pLastKey = pItem;
+        }
+    }
+    return nCount;
+}
+
+template<class SI_CHAR, class SI_STRLESS>
+const typename CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::Key *
+CSimpleIniFrozenTempl<SI_CHAR,SI_STRLESS>::GetSection(
+    const SI_CHAR * a_pSection,
+    size_t &        a_uKeys
+    ) const
+{
+    a_uKeys = 0;
+    const Section * pSection = FindSection(a_pSection);
+    if (!pSection) {
+        return NULL;
+    }
+    a_uKeys = pSection->uKeys;
+    return m_pKeys + pSection->uFirstKey;
+}
+
+
 // ---------------------------------------------------------------------------
 //                                  TYPE DEFINITIONS
 // ---------------------------------------------------------------------------
@@ -3343,17 +7969,56 @@ typedef CSimpleIniTempl<char,
     SI_NoCase<char>,SI_ConvertA<char> >                 CSimpleIniA;
 typedef CSimpleIniTempl<char,
     SI_Case<char>,SI_ConvertA<char> >                   CSimpleIniCaseA;
+typedef CSimpleIniTempl<char,
+    SI_NoCase<char>,SI_ConvertA<char>,
+    SI_NoCaseHash<char> >                               CSimpleIniHashA;
+typedef CSimpleIniTempl<char,
+    SI_Case<char>,SI_ConvertA<char>,
+    SI_CaseHash<char> >                                 CSimpleIniCaseHashA;
+typedef CSimpleIniTempl<char,
+    SI_NoCase<char>,SI_ConvertA<char>,SI_NoHash<char>,
+    SI_ArenaAllocator<char> >                           CSimpleIniArenaA;
+typedef CSimpleIniFrozenTempl<char,
+    SI_NoCase<char> >                                   CSimpleIniFrozenA;
+typedef CSimpleIniFrozenTempl<char,
+    SI_Case<char> >                                     CSimpleIniCaseFrozenA;
 
 #if defined(SI_CONVERT_ICU)
 typedef CSimpleIniTempl<UChar,
     SI_NoCase<UChar>,SI_ConvertW<UChar> >               CSimpleIniW;
 typedef CSimpleIniTempl<UChar,
     SI_Case<UChar>,SI_ConvertW<UChar> >                 CSimpleIniCaseW;
+typedef CSimpleIniTempl<UChar,
+    SI_NoCase<UChar>,SI_ConvertW<UChar>,
+    SI_NoCaseHash<UChar> >                              CSimpleIniHashW;
+typedef CSimpleIniTempl<UChar,
+    SI_Case<UChar>,SI_ConvertW<UChar>,
+    SI_CaseHash<UChar> >                                CSimpleIniCaseHashW;
+typedef CSimpleIniTempl<UChar,
+    SI_NoCase<UChar>,SI_ConvertW<UChar>,SI_NoHash<UChar>,
+    SI_ArenaAllocator<UChar> >                          CSimpleIniArenaW;
+typedef CSimpleIniFrozenTempl<UChar,
+    SI_NoCase<UChar> >                                  CSimpleIniFrozenW;
+typedef CSimpleIniFrozenTempl<UChar,
+    SI_Case<UChar> >                                    CSimpleIniCaseFrozenW;
 #else
 typedef CSimpleIniTempl<wchar_t,
     SI_NoCase<wchar_t>,SI_ConvertW<wchar_t> >           CSimpleIniW;
 typedef CSimpleIniTempl<wchar_t,
     SI_Case<wchar_t>,SI_ConvertW<wchar_t> >             CSimpleIniCaseW;
+typedef CSimpleIniTempl<wchar_t,
+    SI_NoCase<wchar_t>,SI_ConvertW<wchar_t>,
+    SI_NoCaseHash<wchar_t> >                            CSimpleIniHashW;
+typedef CSimpleIniTempl<wchar_t,
+    SI_Case<wchar_t>,SI_ConvertW<wchar_t>,
+    SI_CaseHash<wchar_t> >                              CSimpleIniCaseHashW;
+typedef CSimpleIniTempl<wchar_t,
+    SI_NoCase<wchar_t>,SI_ConvertW<wchar_t>,SI_NoHash<wchar_t>,
+    SI_ArenaAllocator<wchar_t> >                        CSimpleIniArenaW;
+typedef CSimpleIniFrozenTempl<wchar_t,
+    SI_NoCase<wchar_t> >                                CSimpleIniFrozenW;
+typedef CSimpleIniFrozenTempl<wchar_t,
+    SI_Case<wchar_t> >                                  CSimpleIniCaseFrozenW;
 #endif
 
 #ifdef _UNICODE
@@ -0,0 +1,93 @@
+// Time of deleting whole sections, and then single keys, from data whose
+// 100,000 keys are all copied strings. The strings are copied because
+// the data is loaded into an object that already has data.
+//
+//   g++ -O2 -fpermissive -I.. delete.cpp -o delete
+//   ./delete [sections] [keys per section]
+//
+// On other than Windows SimpleIni.h uses SI_CONVERT_GENERIC, which needs
+// ConvertUTF.h from the SimpleIni distribution. GCC needs -fpermissive for
+// the calls that Converter makes to its dependent base class.
+
+#include "SimpleIni.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+static double Now() {
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+template<class SI_INI>
+static bool Run(const char * a_pszName, const std::string & a_strData,
+    int a_nSections, int a_nKeys)
+{
+    SI_INI ini;
+    ini.LoadData("[first]\nkey = value\n");
+    if (ini.LoadData(a_strData) < 0) {
+        fprintf(stderr, "load failed\n");
+        return false;
+    }
+
+    // every other section, newest first as a cleanup script would find
+    // them, then one key from each of the sections that are left
+    char szName[64];
+    double dStart = Now();
+    int nDeleted = 0;
+    for (int s = a_nSections - 1; s >= 0; s -= 2) {
+        sprintf(szName, "section_%d", s);
+        nDeleted += ini.Delete(szName, NULL) ? 1 : 0;
+    }
+    double dSections = Now() - dStart;
+
+    dStart = Now();
+    for (int s = 0; s < a_nSections; s += 2) {
+        sprintf(szName, "section_%d", s);
+        nDeleted += ini.Delete(szName, "key_0") ? 1 : 0;
+    }
+    double dKeys = Now() - dStart;
+
+    int nExpected = a_nSections / 2 + (a_nSections + 1) / 2;
+    if (nDeleted != nExpected || ini.GetSectionSize("section_0") != a_nKeys - 1) {
+        fprintf(stderr, "%s: wrong result\n", a_pszName);
+        return false;
+    }
+    printf("%-12s %d sections in %.1f ms, %d keys in %.1f ms\n", a_pszName,
+        a_nSections / 2, dSections * 1e3, (a_nSections + 1) / 2, dKeys * 1e3);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    int nSections = argc > 1 ? atoi(argv[1]) : 2000;
+    int nKeys = argc > 2 ? atoi(argv[2]) : 50;
+
+    std::string strData;
+    char szLine[128];
+    for (int s = 0; s < nSections; ++s) {
+        sprintf(szLine, "[section_%d]\n", s);
+        strData += szLine;
+        for (int k = 0; k < nKeys; ++k) {
+            sprintf(szLine, "key_%d = value %d\n", k, s * nKeys + k);
+            strData += szLine;
+        }
+    }
+
+    printf("%d copied keys\n", nSections * nKeys);
+    bool bOk = Run<CSimpleIniA>("CSimpleIniA", strData, nSections, nKeys)
+        && Run<CSimpleIniArenaA>("arena", strData, nSections, nKeys);
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// Load time of SetParallelLoad() with 1 to 16 threads, and a check that
+// every thread count gives the same data as the serial parser.
+//
+//   g++ -O2 -fpermissive -I.. parallel.cpp -o parallel -lpthread
+//   ./parallel [sections] [runs]
+//
+// On other than Windows SimpleIni.h uses SI_CONVERT_GENERIC, which needs
+// ConvertUTF.h from the SimpleIni distribution. GCC needs -fpermissive for
+// the calls that Converter makes to its dependent base class.
+
+#define SI_SUPPORT_THREADS
+#include "SimpleIni.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+static double Now() {
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+int main(int argc, char ** argv) {
+    int nSections = argc > 1 ? atoi(argv[1]) : 50000;
+    int nRuns = argc > 2 ? atoi(argv[2]) : 5;
+
+    // sections with comments, keys and some sections that appear twice so
+    // that the merge has work to do
+    std::string strData;
+    char szLine[256];
+    for (int s = 0; s < nSections; ++s) {
+        int nSection = (s % 10 == 9) ? s / 2 : s;
+        sprintf(szLine, "; section %d\n[section_%d]\n", s, nSection);
+        strData += szLine;
+        for (int k = 0; k < 10; ++k) {
+            sprintf(szLine, "key_%d = value %d of section %d\n", k, k, s);
+            strData += szLine;
+        }
+        strData += "\n";
+    }
+
+    std::string strSerial;
+    {
+        CSimpleIniA ini;
+        ini.LoadData(strData);
+        ini.Save(strSerial);
+    }
+
+    printf("%.1f MB, %d sections\n", strData.size() / 1e6, nSections);
+    printf("threads      ms   speedup\n");
+    double dSerial = 0;
+    int nThreads[] = { 1, 2, 4, 8, 16 };
+    for (size_t t = 0; t < sizeof(nThreads) / sizeof(nThreads[0]); ++t) {
+        double dBest = 1e30;
+        for (int n = 0; n < nRuns; ++n) {
+            CSimpleIniA ini;
+            ini.SetParallelLoad(nThreads[t]);
+            double dStart = Now();
+            if (ini.LoadData(strData) < 0) {
+                fprintf(stderr, "load failed\n");
+                return 1;
+            }
+            double dTime = Now() - dStart;
+            if (dTime < dBest) dBest = dTime;
+
+            std::string strOutput;
+            ini.Save(strOutput);
+            if (strOutput != strSerial) {
+                fprintf(stderr, "%d threads: output differs\n", nThreads[t]);
+                return 1;
+            }
+        }
+        if (t == 0) dSerial = dBest;
+        printf("%7d %7.1f %8.2fx\n", nThreads[t], dBest * 1e3, dSerial / dBest);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Parse speed of CSimpleIniA and CSimpleIniW in MB/s.
+//
+// Build it against this SimpleIni.h, with and without -DSI_NO_SSE2, and
+// against the SimpleIni.h of a release before the vector scanner with
+// -DSI_BASELINE, to compare the parsers on the same data:
+//
+//   g++ -O2 -fpermissive -I.. scan.cpp -o scan
+//   g++ -O2 -fpermissive -I.. -DSI_NO_SSE2 scan.cpp -o scan_scalar
+//   g++ -O2 -fpermissive -I<old> -DSI_BASELINE scan.cpp -o scan_baseline
+//
+// The arguments are the number of sections, the runs of which the best is
+// taken and the length of the values. Longer values spend more of the time
+// scanning and less of it adding the keys to the maps.
+//
+// On other than Windows CSimpleIniW uses SI_CONVERT_GENERIC, which needs
+// ConvertUTF.h and ConvertUTF.c from the SimpleIni distribution. GCC needs
+// -fpermissive for the calls that Converter makes to its dependent base.
+
+#include "SimpleIni.h"
+#include <stdio.h>
+#include <string>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+static double Now() {
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+template<class SI_INI>
+static double Best(const std::string & a_strData, int a_nRuns) {
+    double dBest = 1e30;
+    for (int n = 0; n < a_nRuns; ++n) {
+        SI_INI ini(true, false, true);
+        double dStart = Now();
+        if (ini.LoadData(a_strData) < 0) {
+            fprintf(stderr, "load failed\n");
+            return 0;
+        }
+        double dTime = Now() - dStart;
+        if (dTime < dBest) dBest = dTime;
+    }
+    return dBest;
+}
+
+int main(int argc, char ** argv) {
+    int nSections = argc > 1 ? atoi(argv[1]) : 20000;
+    int nRuns = argc > 2 ? atoi(argv[2]) : 5;
+    int nValue = argc > 3 ? atoi(argv[3]) : 24;
+
+    // sections of keys with comments and values of nValue characters
+    std::string strData;
+    std::string strValue(nValue > 0 ? nValue : 1, 'v');
+    char szLine[64];
+    for (int s = 0; s < nSections; ++s) {
+        sprintf(szLine, "; comment for section %d\n[section_%d]\n", s, s);
+        strData += szLine;
+        for (int k = 0; k < 12; ++k) {
+            sprintf(szLine, "property_name_%d = ", k);
+            strData += szLine;
+            strData += strValue;
+            sprintf(szLine, " %d_%d\n", s, k);
+            strData += szLine;
+        }
+    }
+
+    double dMB = strData.size() / 1e6;
+#ifdef SI_BASELINE
+    printf("%.1f MB, baseline parser\n", dMB);
+#else
+    static const char * s_pszLevel[] = { "scalar", "SSE2" };
+    printf("%.1f MB, scanner %s\n", dMB, s_pszLevel[SI_GetScanLevel()]);
+#endif
+    printf("CSimpleIniA: %.0f MB/s\n", dMB / Best<CSimpleIniA>(strData, nRuns));
+    printf("CSimpleIniW: %.0f MB/s\n", dMB / Best<CSimpleIniW>(strData, nRuns));
+    return 0;
+}
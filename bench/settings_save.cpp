@@ -0,0 +1,75 @@
+// Test that a setting which changes how the data is written makes it
+// modified, so that a save which skips unmodified data still writes the
+// file. Each setting is changed after loading a file and the file must
+// then be rewritten, by SaveFileIfModified() and by SaveFileIncremental().
+// Returns 1 if a file wasn't rewritten.
+//
+//   g++ -O2 -fpermissive -I.. settings_save.cpp -o settings_save
+//
+// On other than Windows SimpleIni.h uses SI_CONVERT_GENERIC, which needs
+// ConvertUTF.h from the SimpleIni distribution. GCC needs -fpermissive for
+// the calls that Converter makes to its dependent base class.
+
+#include "SimpleIni.h"
+#include <stdio.h>
+#include <string>
+
+static const char * s_pszFile = "settings_save.ini";
+
+static void WriteText(const char * a_pszText) {
+    FILE * fp = fopen(s_pszFile, "wb");
+    if (fp) {
+        fputs(a_pszText, fp);
+        fclose(fp);
+    }
+}
+
+static std::string ReadText() {
+    std::string strText;
+    FILE * fp = fopen(s_pszFile, "rb");
+    if (fp) {
+        char szBuf[256];
+        size_t uRead;
+        while ((uRead = fread(szBuf, 1, sizeof(szBuf), fp)) > 0) {
+            strText.append(szBuf, uRead);
+        }
+        fclose(fp);
+    }
+    return strText;
+}
+
+/** Load a_pszText, change a setting, save and compare the file with
+    a_pszExpected */
+static bool Run(const char * a_pszName, bool a_bIncremental,
+    const char * a_pszText, bool a_bSpaces, bool a_bMultiLine,
+    const char * a_pszExpected)
+{
+    WriteText(a_pszText);
+    CSimpleIniA ini(false, false, true);
+    ini.SetIncrementalSave(a_bIncremental);
+    ini.LoadFile(s_pszFile);
+    ini.SetSpaces(a_bSpaces);
+    ini.SetMultiLine(a_bMultiLine);
+    bool bModified = ini.IsModified();
+    SI_Error rc = a_bIncremental
+        ? ini.SaveFileIncremental(s_pszFile)
+        : ini.SaveFileIfModified(s_pszFile);
+    bool bOk = bModified && rc == SI_UPDATED && ReadText() == a_pszExpected
+        && !ini.IsModified();
+    printf("%-12s %-12s %s\n", a_pszName,
+        a_bIncremental ? "incremental" : "if modified", bOk ? "ok" : "NOT SAVED");
+    return bOk;
+}
+
+int main() {
+    bool bOk = true;
+    for (int n = 0; n < 2; ++n) {
+        bool bIncremental = (n == 1);
+        bOk = Run("spaces", bIncremental, "[a]\nk = v\n",
+            false, true, "[a]\nk=v\n") && bOk;
+        bOk = Run("multi-line", bIncremental, "[a]\nk = <<<END\nx\ny\nEND\n",
+            true, false, "[a]\nk = x\ny\n") && bOk;
+    }
+    remove(s_pszFile);
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Soak test of value updates. One key is updated a million times with
+// values of changing length, and the resident memory after the updates
+// must be within 1 MB of what it was after the first 10,000. Returns 1 if
+// memory grew.
+//
+//   g++ -O2 -fpermissive -I.. update_soak.cpp -o update_soak
+//
+// On other than Windows SimpleIni.h uses SI_CONVERT_GENERIC, which needs
+// ConvertUTF.h from the SimpleIni distribution. GCC needs -fpermissive for
+// the calls that Converter makes to its dependent base class. Resident
+// memory is read from /proc on Linux and from GetProcessMemoryInfo() on
+// Windows.
+
+#include "SimpleIni.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <psapi.h>
+# pragma comment(lib, "psapi.lib")
+#else
+# include <unistd.h>
+#endif
+
+/** Resident memory of this process in KB */
+static long ResidentKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (long) (pmc.WorkingSetSize / 1024);
+#else
+    long lPages = 0, lResident = 0;
+    FILE * fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &lPages, &lResident) != 2) {
+        lResident = 0;
+    }
+    fclose(fp);
+    return lResident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+/** The value of update n. Its length changes so that values are both
+    reused in place and replaced by a larger copy. */
+static void MakeValue(char * a_pszValue, int n) {
+    sprintf(a_pszValue, "%d%s", n, (n % 16 == 0) ? " (sixteenth update)" : "");
+}
+
+template<class SI_INI>
+static bool Run(const char * a_pszName) {
+    const int nUpdates = 1000000;
+    const long lLimitKB = 1024;
+
+    SI_INI ini;
+    ini.LoadData("[heartbeat]\ncounter = 0\nstatus = ok\n");
+    char szValue[64];
+    long lStartKB = 0;
+    for (int n = 1; n <= nUpdates; ++n) {
+        MakeValue(szValue, n);
+        ini.SetValue("heartbeat", "counter", szValue,
+            (n % 3 == 0) ? "; updated" : NULL);
+        if (n == 10000) {
+            lStartKB = ResidentKB();
+        }
+    }
+    long lEndKB = ResidentKB();
+
+    MakeValue(szValue, nUpdates);
+    bool bOk = strcmp(ini.GetValue("heartbeat", "counter", ""), szValue) == 0
+        && strcmp(ini.GetValue("heartbeat", "status", ""), "ok") == 0;
+    bool bFlat = lEndKB - lStartKB <= lLimitKB;
+    printf("%-12s %d updates, resident %ld KB -> %ld KB: %s\n", a_pszName,
+        nUpdates, lStartKB, lEndKB, !bOk ? "WRONG VALUE" : bFlat ? "ok" : "GREW");
+    return bOk && bFlat;
+}
+
+int main() {
+    bool bOk = Run<CSimpleIniA>("CSimpleIniA");
+    bOk = Run<CSimpleIniArenaA>("arena") && bOk;
+    return bOk ? 0 : 1;
+}
@@ -40,6 +40,824 @@ DllMain(
 	return true;
 }
 
+/* ---------------------------------------------------------------------------------------
+	Asynchronous Log
+   --------------------------------------------------------------------------------------- */
+
+IniLog::IniLog(
+	)
+{
+	m_Cells = new IniLogCell[ INI_LOG_QUEUE ];
+	for ( LONG i = 0; i < INI_LOG_QUEUE; i++ ) {
+		m_Cells[i].nSequence = i;
+	}
+	m_nHead = 0;
+	m_nTail = 0;
+	m_nDropped = 0;
+	m_bStop = FALSE;
+	m_hWake = NULL;
+	m_hThread = NULL;
+	m_nMainThread = GetCurrentThreadId();
+}
+
+IniLog::~IniLog(
+	)
+{
+	Stop();
+	delete[] m_Cells;
+}
+
+bool
+IniLog::Start(
+	)
+{
+	// Without a thread, messages are logged as they are written.
+	m_hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+	if ( !m_hWake ) {
+		return false;
+	}
+	m_bStop = FALSE;
+	m_hThread = CreateThread( NULL, 0, Run, this, 0, NULL );
+	if ( !m_hThread ) {
+		CloseHandle( m_hWake );
+		m_hWake = NULL;
+		return false;
+	}
+	return true;
+}
+
+void
+IniLog::Stop(
+	)
+{
+	if ( !m_hThread ) {
+		// Log what other threads queued while there was no log thread.
+		if ( GetCurrentThreadId() == m_nMainThread ) {
+			Drain();
+		}
+		return;
+	}
+
+	// The thread logs whatever is left before it exits.
+	InterlockedExchange( &m_bStop, TRUE );
+	SetEvent( m_hWake );
+	WaitForSingleObject( m_hThread, INFINITE );
+	CloseHandle( m_hThread );
+	CloseHandle( m_hWake );
+	m_hThread = NULL;
+	m_hWake = NULL;
+}
+
+void
+IniLog::Write(
+	const char* psFormat,
+	...
+	)
+{
+	va_list args;
+	va_start( args, psFormat );
+
+	// Log directly if there is no thread, but only on the main thread, as
+	// wx doesn't allow logging from others. Their messages stay queued until
+	// the log thread starts or the main thread logs.
+	if ( !m_hThread && GetCurrentThreadId() == m_nMainThread ) {
+		Drain();
+		char sText[ INI_LOG_LINE ];
+		_vsnprintf_s( sText, INI_LOG_LINE, _TRUNCATE, psFormat, args );
+		va_end( args );
+		wxLogMessage( wxT( "%s" ), sText );
+		return;
+	}
+
+	// Claim a cell. It is free when its sequence equals our position; if it
+	// is behind, the log thread hasn't caught up and the queue is full.
+	IniLogCell* cell;
+	LONG pos = m_nHead;
+	for ( ;; ) {
+		cell = &m_Cells[ pos & ( INI_LOG_QUEUE - 1 ) ];
+		LONG diff = (LONG) ( (unsigned long) cell->nSequence - (unsigned long) pos );
+		if ( diff == 0 ) {
+			if ( InterlockedCompareExchange( &m_nHead, pos + 1, pos ) == pos ) {
+				break;
+			}
+		} else if ( diff < 0 ) {
+			va_end( args );
+			InterlockedIncrement( &m_nDropped );
+			return;
+		}
+		pos = m_nHead;
+	}
+
+	// Fill it and hand it to the log thread.
+	_vsnprintf_s( cell->sText, INI_LOG_LINE, _TRUNCATE, psFormat, args );
+	va_end( args );
+	InterlockedExchange( &cell->nSequence, pos + 1 );
+
+	// The thread wakes up regularly anyway; only hurry it if the queue fills.
+	if ( m_hWake && (unsigned long) pos - (unsigned long) m_nTail >= INI_LOG_QUEUE / 2 ) {
+		SetEvent( m_hWake );
+	}
+}
+
+DWORD WINAPI
+IniLog::Run(
+	LPVOID pParam
+	)
+{
+	IniLog* log = (IniLog*) pParam;
+	for ( ;; ) {
+		WaitForSingleObject( log->m_hWake, 100 );
+		bool stop = ( log->m_bStop != FALSE );
+		log->Drain();
+		if ( stop ) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void
+IniLog::Drain(
+	)
+{
+	// Only one thread reads the queue, the log thread or the main thread
+	// when there is none, so the tail needs no interlocking.
+	for ( ;; ) {
+		IniLogCell* cell = &m_Cells[ m_nTail & ( INI_LOG_QUEUE - 1 ) ];
+		if ( cell->nSequence != m_nTail + 1 ) {
+			break;
+		}
+		wxLogMessage( wxT( "%s" ), cell->sText );
+		InterlockedExchange( &cell->nSequence, m_nTail + INI_LOG_QUEUE );
+		InterlockedIncrement( &m_nTail );
+	}
+
+	// Report lost messages.
+	LONG dropped = InterlockedExchange( &m_nDropped, 0 );
+	if ( dropped > 0 ) {
+		wxLogMessage( wxT( "! %ld log messages dropped, the log queue was full." ), dropped );
+	}
+}
+
+/* ---------------------------------------------------------------------------------------
+	Asynchronous Writer
+   --------------------------------------------------------------------------------------- */
+
+IniWriter::IniWriter(
+	)
+{
+	InitializeCriticalSection( &m_Lock );
+	m_hWake = NULL;
+	m_hWritten = NULL;
+	m_nFailed = 0;
+	m_bStop = FALSE;
+	m_hThread = NULL;
+	m_pLog = NULL;
+	m_pLogLevel = NULL;
+	m_pWatcher = NULL;
+}
+
+IniWriter::~IniWriter(
+	)
+{
+	Stop();
+	DeleteCriticalSection( &m_Lock );
+}
+
+bool
+IniWriter::Start(
+	IniLog* pLog,
+	const long* pLogLevel,
+	IniWatcher* pWatcher
+	)
+{
+	m_pLog = pLog;
+	m_pLogLevel = pLogLevel;
+	m_pWatcher = pWatcher;
+	m_hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+	m_hWritten = CreateEvent( NULL, FALSE, FALSE, NULL );
+	m_bStop = FALSE;
+	if ( m_hWake && m_hWritten ) {
+		m_hThread = CreateThread( NULL, 0, Run, this, 0, NULL );
+	}
+	if ( !m_hThread ) {
+		if ( m_hWake ) CloseHandle( m_hWake );
+		if ( m_hWritten ) CloseHandle( m_hWritten );
+		m_hWake = NULL;
+		m_hWritten = NULL;
+		return false;
+	}
+	return true;
+}
+
+void
+IniWriter::Stop(
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	// The thread writes everything queued before it exits.
+	InterlockedExchange( &m_bStop, TRUE );
+	SetEvent( m_hWake );
+	WaitForSingleObject( m_hThread, INFINITE );
+	CloseHandle( m_hThread );
+	CloseHandle( m_hWake );
+	CloseHandle( m_hWritten );
+	m_hThread = NULL;
+	m_hWake = NULL;
+	m_hWritten = NULL;
+}
+
+void
+IniWriter::Queue(
+	const std::string& sFile,
+	std::string& sData
+	)
+{
+	// Takes the data; anything still queued for the file is replaced.
+	EnterCriticalSection( &m_Lock );
+	m_Pending[ sFile ].swap( sData );
+	LeaveCriticalSection( &m_Lock );
+	SetEvent( m_hWake );
+}
+
+void
+IniWriter::Flush(
+	const std::string& sFile
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	// Wait until the file is neither queued nor being written.
+	while ( IsPending( sFile ) ) {
+		WaitForSingleObject( m_hWritten, 50 );
+	}
+}
+
+bool
+IniWriter::IsPending(
+	const std::string& sFile
+	)
+{
+	EnterCriticalSection( &m_Lock );
+	bool busy = m_Pending.count( sFile ) > 0 || m_Writing == sFile;
+	LeaveCriticalSection( &m_Lock );
+	return busy;
+}
+
+void
+IniWriter::TakeFailures(
+	std::vector<std::string>& vFiles
+	)
+{
+	EnterCriticalSection( &m_Lock );
+	vFiles.assign( m_Failed.begin(), m_Failed.end() );
+	m_Failed.clear();
+	InterlockedExchange( &m_nFailed, 0 );
+	LeaveCriticalSection( &m_Lock );
+}
+
+DWORD WINAPI
+IniWriter::Run(
+	LPVOID pParam
+	)
+{
+	IniWriter* writer = (IniWriter*) pParam;
+	for ( ;; ) {
+		WaitForSingleObject( writer->m_hWake, INFINITE );
+		bool stop = ( writer->m_bStop != FALSE );
+		while ( writer->WriteNext() ) {
+		}
+		if ( stop ) {
+			break;
+		}
+	}
+	return 0;
+}
+
+bool
+IniWriter::WriteNext(
+	)
+{
+	// Take a file off the queue.
+	std::string file, data;
+	EnterCriticalSection( &m_Lock );
+	if ( m_Pending.empty() ) {
+		LeaveCriticalSection( &m_Lock );
+		return false;
+	}
+	PendingMap::iterator next = m_Pending.begin();
+	file = next->first;
+	data.swap( next->second );
+	m_Pending.erase( next );
+	m_Writing = file;
+	LeaveCriticalSection( &m_Lock );
+
+	// Write it, unless the file already holds the same bytes.
+	FILE* fp = NULL;
+	bool written = SI_FileEquals( file.c_str(), data.data(), data.size() );
+	if ( !written && fopen_s( &fp, file.c_str(), "wb" ) == 0 && fp ) {
+		written = ( fwrite( data.data(), 1, data.size(), fp ) == data.size() );
+		written = ( fclose( fp ) == 0 ) && written;
+	}
+	if ( !written && *m_pLogLevel >= INI_LOG_ERROR ) {
+		m_pLog->Write( wxT( "! Failed to save file: %s" ), file.c_str() );
+	}
+	if ( written ) {
+		m_pWatcher->Touch( file );
+	}
+
+	// A later write that succeeds makes up for one that failed.
+	EnterCriticalSection( &m_Lock );
+	m_Writing.clear();
+	if ( written ) {
+		m_Failed.erase( file );
+	} else {
+		m_Failed.insert( file );
+	}
+	InterlockedExchange( &m_nFailed, (LONG) m_Failed.size() );
+	LeaveCriticalSection( &m_Lock );
+	SetEvent( m_hWritten );
+	return true;
+}
+
+/* ---------------------------------------------------------------------------------------
+	Journal
+   --------------------------------------------------------------------------------------- */
+
+IniJournal::IniJournal(
+	)
+{
+	m_File = NULL;
+	m_nSize = 0;
+	m_nUnsynced = 0;
+	m_nSyncEvery = 0;
+}
+
+IniJournal::~IniJournal(
+	)
+{
+	Close();
+}
+
+long
+IniJournal::Open(
+	const std::string& sFile,
+	CSimpleIniArenaA* pIniFile,
+	long nSyncEvery
+	)
+{
+	Close();
+	m_sPath = GetPath( sFile );
+	m_nSyncEvery = nSyncEvery;
+
+	// Read the journal, if there is one.
+	std::string data;
+	FILE* fp = NULL;
+	if ( fopen_s( &fp, m_sPath.c_str(), "rb" ) != 0 || !fp ) {
+		return 0;
+	}
+	char buffer[ 4096 ];
+	size_t read;
+	while ( ( read = fread( buffer, 1, sizeof( buffer ), fp ) ) > 0 ) {
+		data.append( buffer, read );
+	}
+	fclose( fp );
+
+	// Replay the whole records; a crash may have cut the last one short.
+	long replayed = 0;
+	size_t pos = 0;
+	while ( data.size() - pos >= sizeof( IniJournalRecord ) ) {
+		IniJournalRecord record;
+		memcpy( &record, data.data() + pos, sizeof( record ) );
+		const char* payload = data.data() + pos + sizeof( record );
+		if ( record.nLength > data.size() - pos - sizeof( record )
+			|| record.nLength < 4 || payload[0] != 'S'
+			|| Checksum( payload, record.nLength ) != record.nChecksum ) {
+			break;
+		}
+		const char* end = payload + record.nLength;
+		const char* section = payload + 1;
+		const char* key = (const char*) memchr( section, 0, end - section );
+		const char* value = NULL;
+		if ( key ) {
+			key++;
+			value = (const char*) memchr( key, 0, end - key );
+		}
+		if ( value ) {
+			value++;
+		}
+		if ( !value || !memchr( value, 0, end - value ) ) {
+			break;
+		}
+		pIniFile->SetValue( section, key, value );
+		++replayed;
+		pos += sizeof( record ) + record.nLength;
+	}
+
+	// New records go after the last whole one.
+	if ( fopen_s( &m_File, m_sPath.c_str(), "r+b" ) != 0 ) {
+		m_File = NULL;
+	}
+	if ( !m_File || !SI_TruncateFile( m_File, pos ) || fseek( m_File, (long) pos, SEEK_SET ) != 0 ) {
+		Close();
+		return -1;
+	}
+	m_nSize = (long) pos;
+	return replayed;
+}
+
+void
+IniJournal::Close(
+	)
+{
+	if ( m_File ) {
+		Sync();
+		fclose( m_File );
+		m_File = NULL;
+
+		// Nothing left to replay.
+		if ( m_nSize == 0 ) {
+			remove( m_sPath.c_str() );
+		}
+	}
+	m_nSize = 0;
+	m_nUnsynced = 0;
+}
+
+bool
+IniJournal::Append(
+	const char* psSection,
+	const char* psKey,
+	const char* psValue
+	)
+{
+	if ( !m_File && ( fopen_s( &m_File, m_sPath.c_str(), "wb" ) != 0 || !m_File ) ) {
+		m_File = NULL;
+		return false;
+	}
+
+	// 'S', then the names and value with their terminators.
+	std::string payload( 1, 'S' );
+	payload.append( psSection, strlen( psSection ) + 1 );
+	payload.append( psKey, strlen( psKey ) + 1 );
+	payload.append( psValue, strlen( psValue ) + 1 );
+	IniJournalRecord record;
+	record.nLength = (DWORD) payload.size();
+	record.nChecksum = Checksum( payload.data(), payload.size() );
+
+	// A record that was only partly written is removed, so the ones after
+	// it can still be replayed.
+	bool written = fwrite( &record, sizeof( record ), 1, m_File ) == 1
+		&& fwrite( payload.data(), 1, payload.size(), m_File ) == payload.size()
+		&& fflush( m_File ) == 0;
+	if ( !written ) {
+		SI_TruncateFile( m_File, m_nSize );
+		fseek( m_File, m_nSize, SEEK_SET );
+		return false;
+	}
+	m_nSize += (long) ( sizeof( record ) + payload.size() );
+	if ( m_nSyncEvery > 0 && ++m_nUnsynced >= m_nSyncEvery ) {
+		return Sync();
+	}
+	return true;
+}
+
+bool
+IniJournal::Reset(
+	)
+{
+	// Called once the file holds everything in the journal.
+	if ( !m_File ) {
+		return true;
+	}
+	m_nSize = 0;
+	return SI_TruncateFile( m_File, 0 ) && fseek( m_File, 0, SEEK_SET ) == 0 && Sync();
+}
+
+std::string
+IniJournal::GetPath(
+	const std::string& sFile
+	)
+{
+	return sFile + ".journal";
+}
+
+bool
+IniJournal::Sync(
+	)
+{
+	m_nUnsynced = 0;
+	return fflush( m_File ) == 0 && _commit( _fileno( m_File ) ) == 0;
+}
+
+DWORD
+IniJournal::Checksum(
+	const char* pData,
+	size_t nLength
+	)
+{
+	DWORD hash = 2166136261u;
+	for ( size_t i = 0; i < nLength; i++ ) {
+		hash = ( hash ^ (unsigned char) pData[i] ) * 16777619u;
+	}
+	return hash;
+}
+
+/* ---------------------------------------------------------------------------------------
+	Watcher
+   --------------------------------------------------------------------------------------- */
+
+IniWatcher::IniWatcher(
+	)
+{
+	InitializeCriticalSection( &m_Lock );
+	m_nReloads = 0;
+	m_bChanged = FALSE;
+	m_hWake = NULL;
+	m_bStop = FALSE;
+	m_hThread = NULL;
+	m_pPlugin = NULL;
+	m_pLog = NULL;
+	m_pLogLevel = NULL;
+}
+
+IniWatcher::~IniWatcher(
+	)
+{
+	Stop();
+	DeleteCriticalSection( &m_Lock );
+}
+
+bool
+IniWatcher::Start(
+	const INI* pPlugin,
+	IniLog* pLog,
+	const long* pLogLevel
+	)
+{
+	m_pPlugin = pPlugin;
+	m_pLog = pLog;
+	m_pLogLevel = pLogLevel;
+	m_hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+	m_bStop = FALSE;
+	m_bChanged = TRUE;
+	if ( m_hWake ) {
+		m_hThread = CreateThread( NULL, 0, Run, this, 0, NULL );
+	}
+	if ( !m_hThread ) {
+		if ( m_hWake ) CloseHandle( m_hWake );
+		m_hWake = NULL;
+		return false;
+	}
+	return true;
+}
+
+void
+IniWatcher::Stop(
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	InterlockedExchange( &m_bStop, TRUE );
+	SetEvent( m_hWake );
+	WaitForSingleObject( m_hThread, INFINITE );
+	CloseHandle( m_hThread );
+	CloseHandle( m_hWake );
+	m_hThread = NULL;
+	m_hWake = NULL;
+
+	// Drop what was never swapped in.
+	for ( size_t i = 0; i < m_Reloads.size(); i++ ) {
+		delete m_Reloads[i].pIniFile;
+	}
+	m_Reloads.clear();
+	m_Watches.clear();
+	m_nReloads = 0;
+}
+
+void
+IniWatcher::Watch(
+	int nHandle,
+	const IniWatch& stamp
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	// Start from the file as it was before it was loaded, so a change while
+	// it was parsed is still reloaded.
+	IniWatch watch = stamp;
+	size_t split = watch.sFile.find_last_of( "\\/" );
+	watch.sDirectory = ( split == std::string::npos ) ? std::string( "." ) : watch.sFile.substr( 0, split );
+	EnterCriticalSection( &m_Lock );
+	m_Watches[ nHandle ] = watch;
+	LeaveCriticalSection( &m_Lock );
+	InterlockedExchange( &m_bChanged, TRUE );
+	SetEvent( m_hWake );
+}
+
+void
+IniWatcher::Unwatch(
+	int nHandle
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	EnterCriticalSection( &m_Lock );
+	m_Watches.erase( nHandle );
+	LeaveCriticalSection( &m_Lock );
+	InterlockedExchange( &m_bChanged, TRUE );
+	SetEvent( m_hWake );
+}
+
+void
+IniWatcher::Touch(
+	const std::string& sFile
+	)
+{
+	if ( !m_hThread ) {
+		return;
+	}
+
+	// The plugin wrote the file itself; there is nothing to reload.
+	IniWatch stamp;
+	stamp.sFile = sFile;
+	if ( !GetStamp( stamp ) ) {
+		return;
+	}
+	EnterCriticalSection( &m_Lock );
+	for ( WatchMap::iterator i = m_Watches.begin(); i != m_Watches.end(); i++ ) {
+		if ( i->second.sFile == sFile ) {
+			i->second.uWritten = stamp.uWritten;
+			i->second.uSize = stamp.uSize;
+		}
+	}
+	LeaveCriticalSection( &m_Lock );
+}
+
+void
+IniWatcher::TakeReloads(
+	std::vector<IniReload>& vReloads
+	)
+{
+	EnterCriticalSection( &m_Lock );
+	vReloads.swap( m_Reloads );
+	m_Reloads.clear();
+	InterlockedExchange( &m_nReloads, 0 );
+	LeaveCriticalSection( &m_Lock );
+}
+
+DWORD WINAPI
+IniWatcher::Run(
+	LPVOID pParam
+	)
+{
+	IniWatcher* watcher = (IniWatcher*) pParam;
+	std::vector<HANDLE> handles;				// Wake event, then one per directory.
+	bool polling = false;
+	for ( ;; ) {
+		// Watch the directories of the watched files again whenever they change.
+		if ( InterlockedExchange( &watcher->m_bChanged, FALSE ) ) {
+			for ( size_t i = 1; i < handles.size(); i++ ) {
+				FindCloseChangeNotification( handles[i] );
+			}
+			handles.assign( 1, watcher->m_hWake );
+			std::set<std::string> directories;
+			EnterCriticalSection( &watcher->m_Lock );
+			for ( WatchMap::const_iterator i = watcher->m_Watches.begin(); i != watcher->m_Watches.end(); i++ ) {
+				directories.insert( i->second.sDirectory );
+			}
+			LeaveCriticalSection( &watcher->m_Lock );
+
+			// Directories beyond what one wait can take, or that can't be
+			// watched, are polled instead.
+			polling = false;
+			for ( std::set<std::string>::const_iterator i = directories.begin(); i != directories.end(); i++ ) {
+				HANDLE notification = INVALID_HANDLE_VALUE;
+				if ( handles.size() < MAXIMUM_WAIT_OBJECTS ) {
+					notification = FindFirstChangeNotification( i->c_str(), FALSE,
+						FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE );
+				}
+				if ( notification == INVALID_HANDLE_VALUE ) {
+					polling = true;
+				} else {
+					handles.push_back( notification );
+				}
+			}
+
+			// Catch what changed before the directories were watched.
+			LARGE_INTEGER now;
+			QueryPerformanceCounter( &now );
+			watcher->Scan( now );
+		}
+
+		DWORD result = WaitForMultipleObjects( (DWORD) handles.size(), &handles[0], FALSE, polling ? INI_WATCH_POLL : INFINITE );
+		if ( watcher->m_bStop ) {
+			break;
+		}
+		if ( result == WAIT_OBJECT_0 ) {
+			continue;
+		}
+		LARGE_INTEGER changed;
+		QueryPerformanceCounter( &changed );
+
+		// Editors write in several steps; wait until the directories are quiet.
+		while ( result > WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size() && !watcher->m_bStop ) {
+			FindNextChangeNotification( handles[ result - WAIT_OBJECT_0 ] );
+			result = WaitForMultipleObjects( (DWORD) handles.size() - 1, &handles[1], FALSE, INI_WATCH_SETTLE );
+			if ( result != WAIT_TIMEOUT ) {
+				result++;
+			}
+		}
+		watcher->Scan( changed );
+	}
+
+	for ( size_t i = 1; i < handles.size(); i++ ) {
+		FindCloseChangeNotification( handles[i] );
+	}
+	return 0;
+}
+
+void
+IniWatcher::Scan(
+	const LARGE_INTEGER& nChanged
+	)
+{
+	// Find the files whose stamp moved, without holding the lock over the disk.
+	EnterCriticalSection( &m_Lock );
+	WatchMap watches( m_Watches );
+	LeaveCriticalSection( &m_Lock );
+
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+	for ( WatchMap::const_iterator i = watches.begin(); i != watches.end(); i++ ) {
+		IniWatch stamp = i->second;
+		if ( !GetStamp( stamp ) || ( stamp.uWritten == i->second.uWritten && stamp.uSize == i->second.uSize ) ) {
+			continue;
+		}
+
+		// Parse it into fresh data. If it was written to meanwhile, the next
+		// change picks it up.
+		QueryPerformanceCounter( &start );
+		CSimpleIniArenaA* iniFile = m_pPlugin->LoadFile( stamp.sFile.c_str() );
+		QueryPerformanceCounter( &stop );
+		IniWatch after = stamp;
+		if ( !iniFile || !GetStamp( after ) || after.uWritten != stamp.uWritten || after.uSize != stamp.uSize ) {
+			if ( !iniFile && *m_pLogLevel >= INI_LOG_ERROR ) {
+				m_pLog->Write( wxT( "! Could not reload ini file: %s" ), stamp.sFile.c_str() );
+			}
+			delete iniFile;
+			continue;
+		}
+
+		// Keep it, unless the file was closed, reopened or saved by the plugin since.
+		IniReload reload;
+		reload.nHandle = i->first;
+		reload.sFile = stamp.sFile;
+		reload.pIniFile = iniFile;
+		reload.uWritten = stamp.uWritten;
+		reload.uSize = stamp.uSize;
+		reload.nChanged = nChanged;
+		reload.dMilliseconds = 1000.0 * ( stop.QuadPart - start.QuadPart ) / frequency.QuadPart;
+		EnterCriticalSection( &m_Lock );
+		WatchMap::iterator watch = m_Watches.find( i->first );
+		if ( watch != m_Watches.end() && watch->second.sFile == stamp.sFile
+			&& watch->second.uWritten == i->second.uWritten && watch->second.uSize == i->second.uSize ) {
+			watch->second.uWritten = stamp.uWritten;
+			watch->second.uSize = stamp.uSize;
+			m_Reloads.push_back( reload );
+			InterlockedExchange( &m_nReloads, (LONG) m_Reloads.size() );
+			iniFile = NULL;
+		}
+		LeaveCriticalSection( &m_Lock );
+		delete iniFile;
+	}
+}
+
+bool
+IniWatcher::GetStamp(
+	IniWatch& watch
+	)
+{
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if ( !GetFileAttributesEx( watch.sFile.c_str(), GetFileExInfoStandard, &info ) ) {
+		return false;
+	}
+	watch.uWritten = ( (ULONGLONG) info.ftLastWriteTime.dwHighDateTime << 32 ) | info.ftLastWriteTime.dwLowDateTime;
+	watch.uSize = ( (ULONGLONG) info.nFileSizeHigh << 32 ) | info.nFileSizeLow;
+	return true;
+}
+
 /* ---------------------------------------------------------------------------------------
 	Implementation of INI Plugin
    --------------------------------------------------------------------------------------- */
@@ -64,14 +882,36 @@ INI::INI(
 
 	// Write version.
 	version		=	NWNX_PLUGIN_INI_VERSION;
+
+	// Log file operations until Init reads the configured level.
+	m_LogLevel	=	INI_LOG_INFO;
+	m_IncrementalSave	=	false;
+	m_Journal	=	false;
+	m_JournalSync	=	16;
+	m_JournalLimit	=	1048576;
+	m_MemoryBudget	=	0;
+	m_UseCount	=	0;
+	m_BudgetHits	=	0;
+	m_BudgetEvictions	=	0;
+	m_BudgetReloads	=	0;
 }
 
 INI::~INI(
 	)
 {
-	// Close maps.
-	for ( IniMap::iterator i = m_IniFiles.begin(); i != m_IniFiles.end(); i++ ) {
-		delete i->second;
+	// Stop reloading, finish writing saved files, then flush the log.
+	m_Watcher.Stop();
+	m_Writer.Stop();
+	m_Log.Stop();
+
+	// Close files.
+	for ( IniSlotTable::iterator i = m_IniSlots.begin(); i != m_IniSlots.end(); i++ ) {
+		ReleaseFile( *i );
+		delete i->pJournal;
+	}
+	if ( m_MemoryBudget > 0 ) {
+		wxLogMessage( wxT( "* Memory budget: %lu uses of loaded files, %lu evictions, %lu reloads." ),
+			m_BudgetHits, m_BudgetEvictions, m_BudgetReloads );
 	}
 
 	wxLogMessage( wxT( "* Plugin unloaded." ) );
@@ -104,8 +944,74 @@ INI::Init(
 	wxLogTrace( TRACE_VERBOSE, wxT( "* reading inifile %s" ), inifile );
 	m_Config = new wxFileConfig( wxEmptyString, wxEmptyString, inifile, wxEmptyString, wxCONFIG_USE_LOCAL_FILE | wxCONFIG_USE_NO_ESCAPE_CHARACTERS );
 
+	// Cache parsed ini files, if a cache directory is configured.
+	wxString cacheDir;
+	if ( m_Config->Read( wxT( "CacheDir" ), &cacheDir ) && !cacheDir.IsEmpty() ) {
+		if ( !wxDirExists( cacheDir ) ) {
+			wxMkdir( cacheDir );
+		}
+		m_CacheDir = cacheDir.mb_str();
+		wxLogMessage( wxT( "* Caching ini files in %s" ), m_CacheDir.c_str() );
+	}
+
+	// Log level.
+	m_Config->Read( wxT( "LogLevel" ), &m_LogLevel, INI_LOG_INFO );
+	wxLogMessage( wxT( "* Log level %ld." ), m_LogLevel );
+
+	// Remember section positions of loaded files, so saves only rewrite what changed.
+	m_Config->Read( wxT( "IncrementalSave" ), &m_IncrementalSave, false );
+	if ( m_IncrementalSave ) {
+		wxLogMessage( wxT( "* Saving changed sections only." ) );
+	}
+
+	// Journal set values, so they persist without saving the whole file.
+	m_Config->Read( wxT( "Journal" ), &m_Journal, false );
+	m_Config->Read( wxT( "JournalSync" ), &m_JournalSync, 16 );
+	m_Config->Read( wxT( "JournalLimit" ), &m_JournalLimit, 1048576 );
+	if ( m_Journal ) {
+		wxLogMessage( wxT( "* Journaling set values, syncing every %ld records, saving files at %ld bytes of journal." ), m_JournalSync, m_JournalLimit );
+	}
+
+	// Evict the least recently used files beyond this many bytes of ini data.
+	m_Config->Read( wxT( "MemoryBudget" ), &m_MemoryBudget, 0 );
+	if ( m_MemoryBudget > 0 ) {
+		wxLogMessage( wxT( "* Keeping at most %ld bytes of ini data loaded." ), m_MemoryBudget );
+	}
+
+	// Reload opened files when they change on disk, if configured. Started
+	// first so preloaded files are watched too.
+	bool watch = false;
+	m_Config->Read( wxT( "Watch" ), &watch );
+	if ( watch ) {
+		if ( m_Watcher.Start( this, &m_Log, &m_LogLevel ) ) {
+			wxLogMessage( wxT( "* Reloading opened files when they change." ) );
+		} else {
+			wxLogMessage( wxT( "! Could not start the watcher thread, not reloading files." ) );
+		}
+	}
+
+	// Open the configured files before the module starts.
+	Preload();
+
+	// Save files on a background thread, if configured.
+	bool asyncSave = false;
+	m_Config->Read( wxT( "AsyncSave" ), &asyncSave );
+	if ( asyncSave ) {
+		if ( m_Writer.Start( &m_Log, &m_LogLevel, &m_Watcher ) ) {
+			wxLogMessage( wxT( "* Saving files in the background." ) );
+		} else {
+			wxLogMessage( wxT( "! Could not start the writer thread, saving directly." ) );
+		}
+	}
+
 	// Conclude initialization.
 	wxLogMessage( wxT( "* Plugin initialized." ) );
+
+	// Write the log on a thread of its own, so calls don't wait for the file.
+	// From here on, everything is logged through m_Log.
+	if ( !m_Log.Start() ) {
+		wxLogMessage( wxT( "! Could not start the log thread, logging directly." ) );
+	}
 	return true;
 }
 
@@ -129,7 +1035,7 @@ INI::GetInt(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin GetInt( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
+	INI_TRACE( wxT( "* Plugin GetInt( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
 
 	// Special cases.
 	switch ( nFlag ) {
@@ -159,44 +1065,34 @@ INI::GetInt(
 
 	// Error Check: Data specified?
 	if ( psFileID == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: File not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not specified." ) );
 		return 0;
 	} else if ( psKey == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: Setting not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Setting not specified." ) );
 		return 0;
 	}
 
 	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return false;
 	}
 
 	// Get value.
 	try {
-		// Get data.
-		CSimpleIniA* iniFile = m_IniFiles[psFileID];
-		std::string section = GetSection( psKey );
-		std::string key = GetKey( psKey );
-
-		// Check data.
-		if ( section == "" || key == "" ) {
-			wxLogMessage( wxT( "! Error: Section or key invalid." ) );
-			return 0;
-		}
-
 		// Key exists?
-		if ( !ValidKey( iniFile, section.c_str(), key.c_str() ) ) {
+		const char* value = GetRawValue( handle, psKey );
+		if ( !value ) {
 			return 0;
 		}
 
 		// Return value.
-		std::string value = iniFile->GetValue( section.c_str(), key.c_str(), "" );
-		return atol( value.c_str() );
+		return atol( value );
 	} catch ( std::exception& e ) {
-		wxLogMessage( wxT( "! Error: %s" ), e.what() );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: %s" ), e.what() );
 	} catch ( ... ) {
-		wxLogMessage( wxT( "! Error: Unknown exception in INI::GetInt." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Unknown exception in INI::GetInt." ) );
 	}
 	return 0;
 }
@@ -210,7 +1106,7 @@ INI::SetInt(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin SetInt( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = %d )" ), psFileID, psKey, nFlag, nValue );
+	INI_TRACE( wxT( "* Plugin SetInt( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = %d )" ), psFileID, psKey, nFlag, nValue );
 	
 	// Special cases.
 	switch ( nFlag ) {
@@ -230,30 +1126,30 @@ INI::SetInt(
 
 	// Error Check: Data specified?
 	if ( psFileID == wxT( "" ) ) {
-		wxLogMessage( wxT( "* File not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "* File not specified." ) );
 		return;
 	} else if ( psKey == wxT( "" ) ) {
-		wxLogMessage( wxT( "* Setting not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "* Setting not specified." ) );
 		return;
 	}
 
 	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return;
 	}
 	
 	// Write value.
 	try {
-		CSimpleIniA* iniFile = m_IniFiles[psFileID];
-		std::string section = GetSection( psKey );
-		std::string key = GetKey( psKey );
-		iniFile->SetLongValue( section.c_str(), key.c_str(), nValue );
+		char value[ 32 ];
+		sprintf_s( value, sizeof( value ), "%d", nValue );
+		SetValue( handle, psKey, value );
 	} catch ( std::exception& e ) {
-		wxLogMessage( wxT( "! Error: %s" ), e.what() );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: %s" ), e.what() );
 		return;
 	} catch ( ... ) {
-		wxLogMessage( wxT( "! Error: Unknown exception in INI::GetInt." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Unknown exception in INI::GetInt." ) );
 		return;
 	}
 }
@@ -266,43 +1162,38 @@ INI::GetFloat(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin GetFloat( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
+	INI_TRACE( wxT( "* Plugin GetFloat( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
 
 	// Error Check: Data specified?
 	if ( psFileID == wxT( "" ) ) {
-		wxLogMessage( wxT( "* File not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "* File not specified." ) );
 		return 0.0f;
 	} else if ( psKey == wxT( "" ) ) {
-		wxLogMessage( wxT( "* Setting not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "* Setting not specified." ) );
 		return 0.0f;
 	}
 
 	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return 0.0f;
 	}
 
 	// Get value.
 	try {
-		// Get data.
-		CSimpleIniA* iniFile = m_IniFiles[psFileID];
-		std::string section = GetSection( psKey );
-		std::string key = GetKey( psKey );
-
 		// Key exists?
-		if ( !ValidKey( iniFile, section.c_str(), key.c_str() ) ) {
-			wxLogMessage( wxT( "! Error: Section or key invalid." ) );
+		const char* value = GetRawValue( handle, psKey );
+		if ( !value ) {
 			return 0.0f;
 		}
 
 		// Return value.
-		std::string value = iniFile->GetValue( section.c_str(), key.c_str(), "" );
-		return atof( value.c_str() );
+		return atof( value );
 	} catch ( std::exception& e ) {
-		wxLogMessage( wxT( "! Error: %s" ), e.what() );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: %s" ), e.what() );
 	} catch ( ... ) {
-		wxLogMessage( wxT( "! Error: Unknown exception in INI::GetInt." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Unknown exception in INI::GetInt." ) );
 	}
 	return 0.0f;
 }
@@ -316,28 +1207,28 @@ INI::SetFloat(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin SetFloat( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = %f )" ), psFileID, psKey, nFlag, fValue );
+	INI_TRACE( wxT( "* Plugin SetFloat( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = %f )" ), psFileID, psKey, nFlag, fValue );
 
 	// Error Check: Data specified?
 	if ( psFileID == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: psFileID not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: psFileID not specified." ) );
 		return;
 	} else if ( psKey == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: psKey not specified." ) );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: psKey not specified." ) );
 		return;
 	}
 
 	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return;
 	}
 
 	// Write value.
-	CSimpleIniA* iniFile = m_IniFiles[psFileID];
-	std::string section = GetSection( psKey );
-	std::string key = GetKey( psKey );
-	iniFile->SetDoubleValue( section.c_str(), key.c_str(), fValue );
+	char value[ 64 ];
+	sprintf_s( value, sizeof( value ), "%f", fValue );
+	SetValue( handle, psKey, value );
 }
 
 char*
@@ -348,172 +1239,655 @@ INI::GetString(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin GetString( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
+	INI_TRACE( wxT( "* Plugin GetString( psFileID = \"%s\", psKey = \"%s\", nFlag = %d )" ), psFileID, psKey, nFlag );
+
+	// Special cases.
+	switch ( nFlag ) {
+		case FLAG_GET_PATH:
+			return GetFilePath( psFileID );
+		case FLAG_GET_BATCH:
+			return GetBatch( psFileID, psKey );
+	};
+
+	// File opened?
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
+		return false;
+	}
+
+	// Get value.
+	try {
+		// Key exists?
+		const char* value = GetRawValue( handle, psKey );
+		if ( !value ) {
+			return "";
+		}
+
+		// Return value.
+		sprintf_s( returnBuffer, MAX_BUFFER, "%s", value );
+		return returnBuffer;
+	} catch ( std::exception& e ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: %s" ), e.what() );
+	} catch ( ... ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Unknown exception in INI::GetInt." ) );
+	}
+	return "";
+}
+
+void
+INI::SetString(
+	char* psFileID,
+	char* psKey,
+	int nFlag,
+	char* psValue
+	)
+{
+	// Log the NWNX4 string for debugging purposes.
+	INI_TRACE( wxT( "* Plugin SetString( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = \"%s\" )" ), psFileID, psKey, nFlag, psValue );
+
+	// Error Check: Data specified?
+	if ( psFileID == wxT( "" ) ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not specified." ) );
+		return;
+	} else if ( psKey == wxT( "" ) ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Setting not specified." ) );
+		return;
+	}
+	
+	// File opened?
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
+		return;
+	}
+
+	// Write value.
+	SetValue( handle, psKey, psValue );
+}
+
+void
+INI::WriteNWN2String(
+	char* pszNWN2String
+	)
+{
+	nwnxcpy( returnBuffer, pszNWN2String );
+}
+
+// -------------------------------------------------------------------- //
+//	SECTION/KEY PARSING													//
+// -------------------------------------------------------------------- //
+
+IniKeyName::IniKeyName(
+	const char* psInput
+	)
+{
+	// Format: "<section>|<key>".
+	const char* psSplit = strchr( psInput, '|' );
+	if ( !psSplit ) {
+		m_pSection = psInput;
+		m_pKey = "";
+		return;
+	}
+
+	// Copy the section so it can be terminated.
+	size_t length = psSplit - psInput;
+	if ( length < sizeof( m_Buffer ) ) {
+		memcpy( m_Buffer, psInput, length );
+		m_Buffer[ length ] = '\0';
+		m_pSection = m_Buffer;
+	} else {
+		m_LongSection.assign( psInput, length );
+		m_pSection = m_LongSection.c_str();
+	}
+	m_pKey = psSplit + 1;
+}
+
+const char*
+INI::GetRawValue(
+	int nHandle,
+	const char* psKey
+	)
+{
+	IniSlot& slot = m_IniSlots[nHandle];
+	CSimpleIniArenaA* iniFile = slot.pIniFile;
+
+	// Recently used? Scripts tend to read the same keys over and over.
+	unsigned int hash = 2166136261u;
+	for ( const char* p = psKey; *p; p++ ) {
+		hash = ( hash ^ (unsigned char) *p ) * 16777619u;
+	}
+	if ( slot.vMemo.empty() ) {
+		slot.vMemo.resize( INI_MEMO_SIZE );
+	}
+	IniMemo& memo = slot.vMemo[ hash & ( INI_MEMO_SIZE - 1 ) ];
+	if ( memo.pValue && memo.uGeneration == iniFile->GetGeneration() && memo.uHash == hash && memo.sKey == psKey ) {
+		return memo.pValue;
+	}
+
+	// Check data.
+	IniKeyName name( psKey );
+	if ( *name.Section() == '\0' || *name.Key() == '\0' || !ValidKey( iniFile, name.Section(), name.Key() ) ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Section or key invalid." ) );
+		return NULL;
+	}
+
+	// Look up and remember the value. A lazily loaded section is parsed
+	// by the lookup, so the generation is read afterwards.
+	const char* value = iniFile->GetValue( name.Section(), name.Key(), NULL );
+	if ( value ) {
+		memo.sKey = psKey;
+		memo.uHash = hash;
+		memo.uGeneration = iniFile->GetGeneration();
+		memo.pValue = value;
+	}
+	return value;
+}
+
+char*
+INI::GetBatch(
+	char* psFileID,
+	char* psKeys
+	)
+{
+	// File opened?
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
+		return "";
+	}
+	CSimpleIniArenaA* iniFile = m_IniSlots[handle].pIniFile;
+
+	try {
+		// Each group looks up its section once, then each key within it.
+		const CSimpleIniArenaA::TKeyVal* keys = NULL;
+		std::string name;
+		bool section = true;
+		bool first = true;
+		size_t length = 0;
+		const char* p = psKeys;
+		for ( ;; ) {
+			// Read a name, up to an unescaped '|', ';' or the end.
+			name.clear();
+			for ( ; *p && *p != '|' && *p != ';'; p++ ) {
+				if ( *p == '\\' && p[1] ) {
+					p++;
+				}
+				name += *p;
+			}
+			char end = *p;
+
+			if ( section ) {
+				// Trailing ';'.
+				if ( name.empty() && end == '\0' ) {
+					break;
+				}
+				keys = iniFile->GetSection( name.c_str() );
+				if ( !keys ) {
+					INI_LOG( INI_LOG_ERROR, wxT( "! Error: Section invalid: %s" ), name.c_str() );
+				}
+				section = false;
+			} else {
+				const char* value = "";
+				if ( keys ) {
+					CSimpleIniArenaA::TKeyVal::const_iterator i = keys->find( CSimpleIniArenaA::Entry( name.c_str() ) );
+					if ( i != keys->end() ) {
+						value = i->second;
+					}
+				}
+				bool fits = first || length + 1 < MAX_BUFFER;
+				if ( fits && !first ) {
+					returnBuffer[ length++ ] = ';';
+				}
+				if ( !fits || !AppendBatchValue( length, value ) ) {
+					INI_LOG( INI_LOG_ERROR, wxT( "! Error: Batch values don't fit in %d bytes." ), MAX_BUFFER );
+					return "";
+				}
+				first = false;
+			}
+
+			// Next name.
+			if ( end == '\0' ) {
+				break;
+			}
+			if ( end == ';' ) {
+				section = true;
+			}
+			p++;
+		}
+		returnBuffer[ length ] = '\0';
+		return returnBuffer;
+	} catch ( std::exception& e ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: %s" ), e.what() );
+	} catch ( ... ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Unknown exception in INI::GetBatch." ) );
+	}
+	return "";
+}
+
+bool
+INI::AppendBatchValue(
+	size_t& nLength,
+	const char* psValue
+	)
+{
+	// Escape the separator and the escape character. A byte is always kept
+	// for the terminator.
+	for ( const char* p = psValue; *p; p++ ) {
+		if ( *p == ';' || *p == '\\' ) {
+			if ( nLength + 2 >= MAX_BUFFER ) {
+				return false;
+			}
+			returnBuffer[ nLength++ ] = '\\';
+		} else if ( nLength + 1 >= MAX_BUFFER ) {
+			return false;
+		}
+		returnBuffer[ nLength++ ] = *p;
+	}
+	return true;
+}
+
+void
+INI::SetValue(
+	int nHandle,
+	const char* psKey,
+	const char* psValue
+	)
+{
+	IniSlot& slot = m_IniSlots[nHandle];
+	if ( !UnshareFile( slot ) ) {
+		return;
+	}
+	IniKeyName name( psKey );
+	if ( slot.pIniFile->SetValue( name.Section(), name.Key(), psValue ) < SI_OK ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: Could not set %s." ), psKey );
+		return;
+	}
+
+	// Journal the value; once the journal has grown, save the file instead.
+	if ( slot.pJournal ) {
+		if ( !slot.pJournal->Append( name.Section(), name.Key(), psValue ) ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not write the journal of %s" ), slot.sFile.c_str() );
+		} else if ( m_JournalLimit > 0 && slot.pJournal->Size() > m_JournalLimit ) {
+			CompactJournal( slot );
+		}
+	}
+}
+
+bool
+INI::ValidKey(
+	CSimpleIniArenaA* iniFile,
+	const char* psSection,
+	const char* psKey
+	)
+{
+	// Check section.
+	if ( iniFile->GetSectionSize( psSection ) == -1 ) {
+		return false;
+	}
+
+	// Sections exists. Return true.
+	return true;
+}
+
+// -------------------------------------------------------------------- //
+//	FILE I/O															//
+// -------------------------------------------------------------------- //
+
+int
+INI::OpenFile(
+	char* psFileID,
+	char* psFile
+	)
+{
+	INI_LOG( INI_LOG_INFO, wxT( "* OpenFile( psFileID = \"%s\", psFile = \"%s\" )" ), psFileID, psFile );
+
+	// Read the file after any save of it still queued.
+	m_Writer.Flush( psFile );
+
+	// Check if file exists.
+	if ( !wxFile::Exists( psFile ) ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "* File does not exist." ) );
+		return 0;
+	}
 
-	// Special Case: Get File Path
-	if ( nFlag == FLAG_GET_PATH ) {
-		return GetFilePath( psFileID );
+	// Handles are written "#<handle>", so file IDs may not look like one.
+	if ( psFileID[0] == '#' ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File ID may not start with '#'." ) );
+		return 0;
 	}
 
-	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
-		return false;
+	// Use the data of another file ID that opened the same, unchanged file.
+	std::string path = GetCanonicalPath( psFile );
+	IniShare* share = FindShare( path, psFile );
+	int handle;
+	if ( share ) {
+		INI_LOG( INI_LOG_INFO, wxT( "* Sharing %s with %ld other file IDs." ), psFile, share->nRefs );
+		handle = AddFile( psFileID, psFile, share->pIniFile, GetStamp( share, psFile ), share );
+	} else {
+		// Load the ini file.
+		IniWatch stamp;
+		CSimpleIniArenaA* iniFile = LoadFile( psFile, INI_SETTING_DEFAULT, &stamp );
+		if ( !iniFile ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not load ini file: %s" ), psFile );
+			return 0;
+		}
+		handle = AddFile( psFileID, psFile, iniFile, stamp );
+		ShareFile( m_IniSlots[handle], path, stamp );
 	}
 
-	// Get value.
-	try {
-		// Get data.
-		CSimpleIniA* iniFile = m_IniFiles[psFileID];
-		std::string section = GetSection( psKey );
-		std::string key = GetKey( psKey );
+	// Make room for it.
+	EnforceBudget( handle );
+	return handle;
+}
 
-		// Key exists?
-		if ( !ValidKey( iniFile, section.c_str(), key.c_str() ) ) {
-			wxLogMessage( wxT( "! Error: Section or key invalid." ) );
-			return "";
+CSimpleIniArenaA*
+INI::LoadFile(
+	const char* psFile,
+	unsigned int uSettings,
+	IniWatch* pStamp
+	) const
+{
+	// Stamp the file before reading it, so a change while it is parsed
+	// doesn't pass for the data. Unknown if it is 0.
+	if ( pStamp ) {
+		pStamp->sFile = psFile;
+		if ( !IniWatcher::GetStamp( *pStamp ) ) {
+			pStamp->uWritten = 0;
+			pStamp->uSize = 0;
 		}
+	}
 
-		// Return value.
-		std::string value = iniFile->GetValue( section.c_str(), key.c_str(), "" );
-		sprintf_s( returnBuffer, MAX_BUFFER, "%s", value.c_str() );
-		return returnBuffer;
-	} catch ( std::exception& e ) {
-		wxLogMessage( wxT( "! Error: %s" ), e.what() );
-	} catch ( ... ) {
-		wxLogMessage( wxT( "! Error: Unknown exception in INI::GetInt." ) );
+	// Called by the preload threads too, so this only reads settings. The
+	// settings are applied first, as the storage format can't change once loaded.
+	CSimpleIniArenaA* iniFile = new CSimpleIniArenaA( true, false, true );
+	SetSettings( iniFile, uSettings );
+	// Scripts only touch a few sections, so parse each one when first used.
+	iniFile->SetLazyLoad();
+	iniFile->SetIncrementalSave( m_IncrementalSave );
+	SI_Error state;
+	// Only the cache of the usual settings is kept, so it isn't replaced back and forth.
+	if ( m_CacheDir.empty() || uSettings != INI_SETTING_DEFAULT ) {
+		state = iniFile->LoadFile( psFile );
+	} else {
+		state = iniFile->LoadFileCached( psFile, GetCachePath( psFile ).c_str() );
 	}
-	return "";
+	if ( state < SI_OK ) {
+		delete iniFile;
+		return NULL;
+	}
+	return iniFile;
 }
 
-void
-INI::SetString(
-	char* psFileID,
-	char* psKey,
-	int nFlag,
-	char* psValue
+int
+INI::AddFile(
+	const char* psFileID,
+	const char* psFile,
+	CSimpleIniArenaA* iniFile,
+	const IniWatch& stamp,
+	IniShare* pShare
 	)
 {
-	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin SetString( psFileID = \"%s\", psKey = \"%s\", nFlag = %d, psValue = \"%s\" )" ), psFileID, psKey, nFlag, psValue );
-
-	// Error Check: Data specified?
-	if ( psFileID == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: File not specified." ) );
-		return;
-	} else if ( psKey == wxT( "" ) ) {
-		wxLogMessage( wxT( "! Error: Setting not specified." ) );
-		return;
+	// Counted first, in case the file ID being reopened holds the last reference.
+	if ( pShare ) {
+		pShare->nRefs++;
 	}
-	
-	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
-		return;
+
+	// Reopening a file ID replaces its data but keeps its handle.
+	int handle = FindHandle( psFileID );
+	if ( handle != 0 ) {
+		ReleaseFile( m_IniSlots[handle] );
+		delete m_IniSlots[handle].pJournal;
+		m_IniSlots[handle].pJournal = NULL;
+	} else if ( !m_FreeSlots.empty() ) {
+		handle = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+	} else {
+		// Slot 0 stays unused, so a handle of 0 means failure.
+		if ( m_IniSlots.empty() ) {
+			m_IniSlots.resize( 1 );
+		}
+		handle = (int) m_IniSlots.size();
+		m_IniSlots.resize( handle + 1 );
 	}
+	IniSlot& slot = m_IniSlots[handle];
+	slot.pIniFile = iniFile;
+	slot.pShare = pShare;
+	slot.uLastUsed = ++m_UseCount;
+	slot.bEvicted = false;
+	slot.uSettings = 0;
+	slot.sFileID = psFileID;
+	slot.sFile = psFile;
+	slot.vMemo.clear();
+	m_IniFiles[slot.sFileID] = handle;
+	m_Watcher.Watch( handle, stamp );
+
+	// Apply the values journaled since the file was last saved. Only one
+	// file ID may append to a file's journal.
+	if ( m_Journal ) {
+		for ( IniSlotTable::iterator i = m_IniSlots.begin(); i != m_IniSlots.end(); i++ ) {
+			if ( i->pJournal && i->sFile == slot.sFile ) {
+				INI_LOG( INI_LOG_ERROR, wxT( "! %s is journaled under another file ID, %s is not." ), psFile, psFileID );
+				return handle;
+			}
+		}
 
-	// Write value.
-	CSimpleIniA* iniFile = m_IniFiles[psFileID];
-	std::string section = GetSection( psKey );
-	std::string key = GetKey( psKey );
-	iniFile->SetValue( section.c_str(), key.c_str(), psValue );
+		// Replaying into shared data would change it for the other file IDs.
+		if ( wxFile::Exists( IniJournal::GetPath( slot.sFile ).c_str() ) && !UnshareFile( slot ) ) {
+			return handle;
+		}
+		slot.pJournal = new IniJournal();
+		long replayed = slot.pJournal->Open( slot.sFile, slot.pIniFile, m_JournalSync );
+		if ( replayed < 0 ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not open the journal of %s" ), psFile );
+		} else if ( replayed > 0 ) {
+			INI_LOG( INI_LOG_INFO, wxT( "* Replayed %ld journal records of %s" ), replayed, psFile );
+		}
+	}
+	return handle;
 }
 
-void
-INI::WriteNWN2String(
-	char* pszNWN2String
+IniShare*
+INI::FindShare(
+	const std::string& sPath,
+	const char* psFile
 	)
 {
-	nwnxcpy( returnBuffer, pszNWN2String );
-}
+	IniShareMap::iterator i = m_Shares.find( sPath );
+	if ( i == m_Shares.end() ) {
+		return NULL;
+	}
 
-// -------------------------------------------------------------------- //
-//	SECTION/KEY PARSING													//
-// -------------------------------------------------------------------- //
+	// Changed on disk since? The slots using it keep it, but new ones load the file.
+	IniShare* share = i->second;
+	IniWatch stamp;
+	stamp.sFile = psFile;
+	if ( !IniWatcher::GetStamp( stamp ) || stamp.uWritten != share->uWritten || stamp.uSize != share->uSize ) {
+		m_Shares.erase( i );
+		return NULL;
+	}
+	return share;
+}
 
-std::string
-INI::GetSection(
-	char* psInput
+IniWatch
+INI::GetStamp(
+	const IniShare* share,
+	const char* psFile
 	)
 {
-	// Format: "<section>|<key>".
-	std::string base( psInput );
-	return base.substr( 0, base.find( "|" ) );
+	IniWatch stamp;
+	stamp.sFile = psFile;
+	stamp.uWritten = share->uWritten;
+	stamp.uSize = share->uSize;
+	return stamp;
 }
 
-std::string
-INI::GetKey(
-	char* psInput
+void
+INI::ShareFile(
+	IniSlot& slot,
+	const std::string& sPath,
+	const IniWatch& stamp
 	)
 {
-	// Format: "<section>|<key>".
-	std::string base( psInput );
-	unsigned int sectionLength = GetSection( psInput).length() + 1;
-	return base.substr( sectionLength, base.length() - sectionLength );
+	// Only data as it is on disk is shared, one copy per file. The stamp is
+	// from before the file was read, so a change while it was parsed makes
+	// the share stale rather than fresh.
+	if ( slot.pShare || slot.pIniFile->IsModified() || m_Shares.count( sPath ) || stamp.uWritten == 0 ) {
+		return;
+	}
+	IniShare* share = new IniShare;
+	share->pIniFile = slot.pIniFile;
+	share->sPath = sPath;
+	share->nRefs = 1;
+	share->uWritten = stamp.uWritten;
+	share->uSize = stamp.uSize;
+	m_Shares[sPath] = share;
+	slot.pShare = share;
 }
 
 bool
-INI::ValidKey(
-	CSimpleIniA* iniFile,
-	const char* psSection,
-	const char* psKey
+INI::UnshareFile(
+	IniSlot& slot
 	)
 {
-	// Check section.
-	if ( iniFile->GetSectionSize( psSection ) == -1 ) {
-		return false;
+	IniShare* share = slot.pShare;
+	if ( !share ) {
+		return true;
 	}
 
-	// Sections exists. Return true.
+	// The last slot using it takes it over.
+	if ( share->nRefs == 1 ) {
+		IniShareMap::iterator i = m_Shares.find( share->sPath );
+		if ( i != m_Shares.end() && i->second == share ) {
+			m_Shares.erase( i );
+		}
+		delete share;
+		slot.pShare = NULL;
+		return true;
+	}
+
+	// Otherwise it gets a copy, with the same settings.
+	CSimpleIniArenaA* shared = share->pIniFile;
+	CSimpleIniArenaA* iniFile = new CSimpleIniArenaA( shared->IsUnicode(), shared->IsMultiKey(), shared->IsMultiLine() );
+	iniFile->SetSpaces( shared->UsingSpaces() );
+	iniFile->SetIncrementalSave( m_IncrementalSave );
+	std::string data;
+	if ( shared->Save( data, false ) < SI_OK || iniFile->LoadData( data ) < SI_OK ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Could not copy the shared data of %s" ), slot.sFile.c_str() );
+		delete iniFile;
+		return false;
+	}
+	share->nRefs--;
+	slot.pShare = NULL;
+	slot.pIniFile = iniFile;
+	slot.vMemo.clear();
+	INI_TRACE( wxT( "* Copied the shared data of %s for %s" ), slot.sFile.c_str(), slot.sFileID.c_str() );
 	return true;
 }
 
-// -------------------------------------------------------------------- //
-//	FILE I/O															//
-// -------------------------------------------------------------------- //
+void
+INI::ReleaseFile(
+	IniSlot& slot
+	)
+{
+	IniShare* share = slot.pShare;
+	if ( !share ) {
+		delete slot.pIniFile;
+	} else if ( --share->nRefs == 0 ) {
+		IniShareMap::iterator i = m_Shares.find( share->sPath );
+		if ( i != m_Shares.end() && i->second == share ) {
+			m_Shares.erase( i );
+		}
+		delete share->pIniFile;
+		delete share;
+	}
+	slot.pIniFile = NULL;
+	slot.pShare = NULL;
+}
 
 bool
-INI::OpenFile(
-	char* psFileID,
-	char* psFile
+INI::SaveFile(
+	char* psFileID
 	)
 {
-	wxLogMessage( wxT( "* OpenFile( psFileID = \"%s\", psFile = \"%s\" )" ), psFileID, psFile );
+	INI_LOG( INI_LOG_INFO, wxT( "* SaveFile( psFileID = \"%s\" )" ), psFileID );
 
-	// Check if file exists.
-	if ( !wxFile::Exists( psFile ) ) {
-		wxLogMessage( wxT( "* File does not exist." ) );
+	// File opened?
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return false;
 	}
 
-	// Load the ini file.
-	std::string fileID = psFileID;
-	CSimpleIniA* iniFile = new CSimpleIniA( true, false, true );
-	iniFile->SetUnicode();
-	if ( iniFile->LoadFile( psFile ) < SI_OK ) {
-		wxLogMessage( wxT( "! Could not load ini file: %s" ), psFile );
+	// Nothing changed since it was loaded or saved?
+	IniSlot& slot = m_IniSlots[handle];
+	if ( !slot.pIniFile->IsModified() ) {
+		INI_TRACE( wxT( "* File unchanged, not saved." ) );
+		return true;
+	}
+
+	// Serialize here and leave the writing to the writer thread. Journaled
+	// files are written now, as the journal is dropped once they are.
+	if ( m_Writer.IsRunning() && !slot.pJournal ) {
+		std::string data;
+		if ( slot.pIniFile->Save( data, true ) < SI_OK ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "* Failed to save file." ) );
+			return false;
+		}
+		slot.pIniFile->SetModified( false );
+		m_Writer.Queue( slot.sFile, data );
+		return true;
+	}
+
+	SI_Error state = WriteFile( slot );
+	if ( state < SI_OK ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "* Failed to save file." ) );
 		return false;
 	}
-	m_IniFiles[fileID] = iniFile;
-	m_IniFileNames[fileID] = psFile;
+	if ( state == SI_OK ) {
+		INI_TRACE( wxT( "* File content unchanged, not written." ) );
+	}
+
 	return true;
 }
 
-bool
-INI::SaveFile(
-	char* psFileID
+SI_Error
+INI::WriteFile(
+	IniSlot& slot
 	)
 {
-	wxLogMessage( wxT( "* SaveFile( psFileID = \"%s\" )" ), psFileID );
+	// Splice the changed sections into the file, or create output if the file's content differs.
+	SI_Error state = m_IncrementalSave
+		? slot.pIniFile->SaveFileIncremental( slot.sFile.c_str() )
+		: slot.pIniFile->SaveFileIfModified( slot.sFile.c_str() );
 
-	// Create output.
-	SI_Error state = m_IniFiles[psFileID]->SaveFile( m_IniFileNames[psFileID].c_str() );
-	if ( state < SI_OK ) {
-		wxLogMessage( wxT( "* Failed to save file." ) );
-		return false;
+	if ( state >= SI_OK ) {
+		m_Watcher.Touch( slot.sFile );
+	}
+
+	// The file holds everything journaled now; drop the journal once it is on disk.
+	if ( state >= SI_OK && slot.pJournal ) {
+		FILE* fp = NULL;
+		bool synced = ( fopen_s( &fp, slot.sFile.c_str(), "r+b" ) == 0 && fp && _commit( _fileno( fp ) ) == 0 );
+		if ( fp ) {
+			fclose( fp );
+		}
+		if ( !synced || !slot.pJournal->Reset() ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not clear the journal of %s" ), slot.sFile.c_str() );
+		}
+	}
+	return state;
+}
+
+void
+INI::CompactJournal(
+	IniSlot& slot
+	)
+{
+	INI_LOG( INI_LOG_INFO, wxT( "* Journal of %s has %ld bytes, saving the file." ), slot.sFile.c_str(), slot.pJournal->Size() );
+	if ( WriteFile( slot ) < SI_OK ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "* Failed to save file." ) );
 	}
-		
-	return true;
 }
 
 bool
@@ -521,9 +1895,27 @@ INI::CloseFile(
 	char* psFileID
 	)
 {
-	wxLogMessage( wxT( "* CloseFile( psFileID = \"%s\" )" ), psFileID );
-	delete m_IniFiles[psFileID];
-	m_IniFiles.erase( psFileID );
+	INI_LOG( INI_LOG_INFO, wxT( "* CloseFile( psFileID = \"%s\" )" ), psFileID );
+
+	// File opened?
+	int handle = FindHandle( psFileID );
+	if ( handle == 0 ) {
+		return false;
+	}
+
+	// Free the slot; its handle may be reused by the next OpenFile.
+	IniSlot& slot = m_IniSlots[handle];
+	m_Writer.Flush( slot.sFile );
+	m_Watcher.Unwatch( handle );
+	m_IniFiles.erase( slot.sFileID );
+	ReleaseFile( slot );
+	slot.bEvicted = false;
+	delete slot.pJournal;
+	slot.pJournal = NULL;
+	slot.sFileID.clear();
+	slot.sFile.clear();
+	slot.vMemo.clear();
+	m_FreeSlots.push_back( handle );
 	return true;
 }
 
@@ -532,7 +1924,7 @@ INI::CreateFile(
 	char* psFile
 	)
 {
-	wxLogMessage( wxT( "* CreateFile( psFile = \"%s\" )" ), psFile );
+	INI_LOG( INI_LOG_INFO, wxT( "* CreateFile( psFile = \"%s\" )" ), psFile );
 	
 	// Check if file exists.
 	if ( wxFile::Exists( psFile ) ) return false;
@@ -540,7 +1932,7 @@ INI::CreateFile(
 	// Create file.
 	wxFile f( psFile, wxFile::read_write );
 	if ( !f.Create( psFile ) ) {
-		wxLogMessage( wxT( "! Could not create file: %s" ), psFile );
+		INI_LOG( INI_LOG_ERROR, wxT( "! Could not create file: %s" ), psFile );
 		return false;
 	}
 	f.Close();
@@ -552,8 +1944,20 @@ INI::DeleteFile(
 	char* psFile
 	)
 {
-	wxLogMessage( wxT( "* DeleteFile( psFile = \"%s\" )" ), psFile );
+	INI_LOG( INI_LOG_INFO, wxT( "* DeleteFile( psFile = \"%s\" )" ), psFile );
 	
+	// A queued save would bring it back, and so would a journal.
+	m_Writer.Flush( psFile );
+	for ( IniSlotTable::iterator i = m_IniSlots.begin(); i != m_IniSlots.end(); i++ ) {
+		if ( i->pJournal && i->sFile == psFile ) {
+			i->pJournal->Reset();
+		}
+	}
+	std::string journal = IniJournal::GetPath( psFile );
+	if ( wxFile::Exists( journal.c_str() ) ) {
+		wxRemoveFile( journal.c_str() );
+	}
+
 	// Check if file exists.
 	if ( !wxFile::Exists( psFile ) ) return false;
 
@@ -567,20 +1971,363 @@ INI::GetFilePath(
 	)
 {
 	// Log the NWNX4 string for debugging purposes.
-	wxLogMessage( wxT( "* Plugin GetFilePath( psFileID = \"%s\" )" ), psFileID );
+	INI_TRACE( wxT( "* Plugin GetFilePath( psFileID = \"%s\" )" ), psFileID );
 
 	// File opened?
-	if ( !FileOpened( psFileID ) ) {
-		wxLogMessage( wxT( "! Error: File not opened." ) );
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 ) {
+		INI_LOG( INI_LOG_ERROR, wxT( "! Error: File not opened." ) );
 		return false;
 	}
 
 	// Get path.
-	std::string path = m_IniFileNames[psFileID];
-	sprintf_s( returnBuffer, MAX_BUFFER, "%s", path.c_str() );
+	sprintf_s( returnBuffer, MAX_BUFFER, "%s", m_IniSlots[handle].sFile.c_str() );
 	return returnBuffer;
 }
+
+std::string
+INI::GetCachePath(
+	const char* psFile
+	) const
+{
+	// Format: "<cache dir>\<file path with separators replaced>.cache".
+	std::string name( psFile );
+	for ( unsigned int i = 0; i < name.length(); i++ ) {
+		if ( name[i] == '\\' || name[i] == '/' || name[i] == ':' ) {
+			name[i] = '_';
+		}
+	}
+	return m_CacheDir + "\\" + name + ".cache";
+}
+
+std::string
+INI::GetCanonicalPath(
+	const char* psFile
+	) const
+{
+	// Windows paths are case insensitive, and either slash separates them.
+	char buffer[ MAX_PATH ];
+	DWORD length = GetFullPathName( psFile, MAX_PATH, buffer, NULL );
+	std::string path = ( length > 0 && length < MAX_PATH ) ? std::string( buffer, length ) : std::string( psFile );
+	for ( size_t i = 0; i < path.length(); i++ ) {
+		path[i] = ( path[i] == '/' ) ? '\\' : (char) tolower( (unsigned char) path[i] );
+	}
+	return path;
+}
+
+bool
+INI::RestoreFile(
+	int nHandle
+	)
+{
+	// Read the file after any save of it still queued.
+	IniSlot& slot = m_IniSlots[nHandle];
+	m_Writer.Flush( slot.sFile );
+	std::string path = GetCanonicalPath( slot.sFile.c_str() );
+	IniShare* share = FindShare( path, slot.sFile.c_str() );
+	IniWatch stamp;
+	if ( share && GetSettings( share->pIniFile ) == slot.uSettings ) {
+		share->nRefs++;
+		slot.pIniFile = share->pIniFile;
+		slot.pShare = share;
+		stamp = GetStamp( share, slot.sFile.c_str() );
+	} else {
+		// Settings changed by scripts need data of its own, parsed with them.
+		slot.pIniFile = LoadFile( slot.sFile.c_str(), slot.uSettings, &stamp );
+		if ( !slot.pIniFile ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not reload evicted ini file: %s" ), slot.sFile.c_str() );
+			return false;
+		}
+		if ( slot.uSettings == INI_SETTING_DEFAULT ) {
+			ShareFile( slot, path, stamp );
+		}
+	}
+	slot.bEvicted = false;
+	m_Watcher.Watch( nHandle, stamp );
+	m_BudgetReloads++;
+	INI_LOG( INI_LOG_INFO, wxT( "* Reloaded evicted \"%s\" as \"%s\"" ), slot.sFile.c_str(), slot.sFileID.c_str() );
+	EnforceBudget( nHandle );
+	return true;
+}
+
+void
+INI::EvictFile(
+	int nHandle
+	)
+{
+	// The slot keeps its file ID, handle and journal; only the data goes.
+	IniSlot& slot = m_IniSlots[nHandle];
+	INI_LOG( INI_LOG_INFO, wxT( "* Evicting \"%s\" as \"%s\", unused for %lu file uses." ),
+		slot.sFile.c_str(), slot.sFileID.c_str(), m_UseCount - slot.uLastUsed );
+	slot.uSettings = GetSettings( slot.pIniFile );
+	m_Watcher.Unwatch( nHandle );
+	ReleaseFile( slot );
+	slot.vMemo.clear();
+	slot.bEvicted = true;
+	m_BudgetEvictions++;
+}
+
+void
+INI::EnforceBudget(
+	int nKeep
+	)
+{
+	if ( m_MemoryBudget <= 0 ) {
+		return;
+	}
+
+	// Shared data counts once. Files with unsaved changes are never evicted,
+	// nor are files still being saved in the background, as the save may fail.
+	if ( m_Writer.HasFailures() ) {
+		ApplyWriteFailures();
+	}
+	size_t used = 0;
+	std::set<const IniShare*> counted;
+	std::vector< std::pair<unsigned long, int> > candidates;
+	for ( size_t i = 1; i < m_IniSlots.size(); i++ ) {
+		IniSlot& slot = m_IniSlots[i];
+		if ( !slot.pIniFile ) {
+			continue;
+		}
+		if ( !slot.pShare || counted.insert( slot.pShare ).second ) {
+			used += slot.pIniFile->GetMemoryUsage();
+		}
+		if ( (int) i != nKeep && !slot.pIniFile->IsModified() && !m_Writer.IsPending( slot.sFile ) ) {
+			candidates.push_back( std::make_pair( slot.uLastUsed, (int) i ) );
+		}
+	}
+	if ( used <= (size_t) m_MemoryBudget ) {
+		return;
+	}
+
+	// Least recently used first. Shared data is only freed with its last slot.
+	std::sort( candidates.begin(), candidates.end() );
+	for ( size_t i = 0; i < candidates.size() && used > (size_t) m_MemoryBudget; i++ ) {
+		IniSlot& slot = m_IniSlots[ candidates[i].second ];
+		if ( !slot.pShare || slot.pShare->nRefs == 1 ) {
+			used -= slot.pIniFile->GetMemoryUsage();
+		}
+		EvictFile( candidates[i].second );
+	}
+	if ( used > (size_t) m_MemoryBudget ) {
+		INI_TRACE( wxT( "* %lu bytes of ini data loaded, over the budget; the rest is in use or changed." ), (unsigned long) used );
+	}
+}
+
+unsigned int
+INI::GetSettings(
+	const CSimpleIniArenaA* iniFile
+	)
+{
+	return ( iniFile->IsUnicode() ? INI_SETTING_UNICODE : 0 )
+		| ( iniFile->IsMultiKey() ? INI_SETTING_MULTIKEY : 0 )
+		| ( iniFile->IsMultiLine() ? INI_SETTING_MULTILINE : 0 )
+		| ( iniFile->UsingSpaces() ? INI_SETTING_SPACES : 0 );
+}
+
+void
+INI::SetSettings(
+	CSimpleIniArenaA* iniFile,
+	unsigned int uSettings
+	)
+{
+	iniFile->SetUnicode( ( uSettings & INI_SETTING_UNICODE ) != 0 );
+	iniFile->SetMultiKey( ( uSettings & INI_SETTING_MULTIKEY ) != 0 );
+	iniFile->SetMultiLine( ( uSettings & INI_SETTING_MULTILINE ) != 0 );
+	iniFile->SetSpaces( ( uSettings & INI_SETTING_SPACES ) != 0 );
+}
 	
+void
+INI::Preload(
+	)
+{
+	// Format: "<file ID prefix>=<directory>\<wildcard>" in [Preload]. Each
+	// matching file is opened as "<file ID prefix><name without extension>".
+	std::vector<IniPreload> files;
+	m_Config->SetPath( wxT( "/Preload" ) );
+	wxString prefix;
+	long index;
+	for ( bool more = m_Config->GetFirstEntry( prefix, index ); more; more = m_Config->GetNextEntry( prefix, index ) ) {
+		// Handles are written "#<handle>", so file IDs may not look like one.
+		if ( !prefix.IsEmpty() && prefix[0] == wxT( '#' ) ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Preload %s: file ID prefix may not start with '#'." ), prefix.c_str() );
+			continue;
+		}
+		wxString pattern;
+		m_Config->Read( prefix, &pattern );
+		std::string path( pattern.mb_str() );
+		size_t split = path.find_last_of( "\\/" );
+		if ( split == std::string::npos ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Preload %s: no directory in %s" ), prefix.c_str(), path.c_str() );
+			continue;
+		}
+		wxArrayString found;
+		wxDir::GetAllFiles( path.substr( 0, split ), &found, path.substr( split + 1 ), wxDIR_FILES );
+		for ( size_t i = 0; i < found.GetCount(); i++ ) {
+			IniPreload file;
+			file.sFile = found[i].mb_str();
+			size_t name = file.sFile.find_last_of( "\\/" ) + 1;
+			size_t extension = file.sFile.find_last_of( '.' );
+			if ( extension == std::string::npos || extension < name ) {
+				extension = file.sFile.length();
+			}
+			file.sFileID = std::string( prefix.mb_str() ) + file.sFile.substr( name, extension - name );
+			file.pIniFile = NULL;
+			file.nBytes = 0;
+			file.dMilliseconds = 0.0;
+			files.push_back( file );
+		}
+	}
+	m_Config->SetPath( wxT( "/" ) );
+	if ( files.empty() ) {
+		return;
+	}
+
+	// One thread per processor unless configured, never more than files.
+	long threads = 0;
+	m_Config->Read( wxT( "PreloadThreads" ), &threads, 0 );
+	if ( threads <= 0 ) {
+		threads = SI_CpuCount();
+	}
+	if ( threads > (long) files.size() ) {
+		threads = (long) files.size();
+	}
+
+	// Each thread takes the next file until there are none left.
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &start );
+	IniPreloadQueue queue;
+	queue.pPlugin = this;
+	queue.pFiles = &files;
+	queue.nNext = 0;
+	std::vector<SI_Task> tasks( threads );
+	for ( long i = 0; i < threads; i++ ) {
+		tasks[i].pfnRun = PreloadThread;
+		tasks[i].pArg = &queue;
+	}
+	SI_RunTasks( &tasks[0], (int) threads );
+	QueryPerformanceCounter( &stop );
+
+	// Report and keep the results.
+	size_t loaded = 0, bytes = 0;
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		IniPreload& file = files[i];
+		if ( !file.pIniFile ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! Could not preload ini file: %s" ), file.sFile.c_str() );
+			continue;
+		}
+		INI_LOG( INI_LOG_INFO, wxT( "* Preloaded \"%s\" as \"%s\": %lu bytes in %.1f ms." ),
+			file.sFile.c_str(), file.sFileID.c_str(), (unsigned long) file.nBytes, file.dMilliseconds );
+		int handle = AddFile( file.sFileID.c_str(), file.sFile.c_str(), file.pIniFile, file.stamp );
+		ShareFile( m_IniSlots[handle], GetCanonicalPath( file.sFile.c_str() ), file.stamp );
+		loaded++;
+		bytes += file.nBytes;
+	}
+	EnforceBudget( 0 );
+	wxLogMessage( wxT( "* Preloaded %lu of %lu files, %lu bytes, in %.1f ms on %ld threads." ),
+		(unsigned long) loaded, (unsigned long) files.size(), (unsigned long) bytes,
+		1000.0 * ( stop.QuadPart - start.QuadPart ) / frequency.QuadPart, threads );
+}
+
+void
+INI::PreloadThread(
+	void* pParam
+	)
+{
+	IniPreloadQueue* queue = (IniPreloadQueue*) pParam;
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+	for ( ;; ) {
+		LONG next = InterlockedIncrement( &queue->nNext ) - 1;
+		if ( next >= (LONG) queue->pFiles->size() ) {
+			break;
+		}
+		IniPreload& file = ( *queue->pFiles )[ next ];
+		QueryPerformanceCounter( &start );
+		file.pIniFile = queue->pPlugin->LoadFile( file.sFile.c_str(), INI_SETTING_DEFAULT, &file.stamp );
+		QueryPerformanceCounter( &stop );
+		file.dMilliseconds = 1000.0 * ( stop.QuadPart - start.QuadPart ) / frequency.QuadPart;
+		file.nBytes = (size_t) file.stamp.uSize;
+	}
+}
+
+void
+INI::ApplyWriteFailures(
+	)
+{
+	// Saved data is marked unchanged when it is queued. If the write failed,
+	// mark it changed again, so it is saved again and not lost to a reload or
+	// an eviction. Shared data is as it is on disk, so it wasn't saved.
+	std::vector<std::string> files;
+	m_Writer.TakeFailures( files );
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		for ( IniSlotTable::iterator j = m_IniSlots.begin(); j != m_IniSlots.end(); j++ ) {
+			if ( j->pIniFile && !j->pShare && j->sFile == files[i] ) {
+				j->pIniFile->SetModified();
+				INI_LOG( INI_LOG_ERROR, wxT( "! \"%s\" was not saved, it is marked as changed again." ), j->sFileID.c_str() );
+			}
+		}
+	}
+}
+
+void
+INI::ApplyReloads(
+	)
+{
+	std::vector<IniReload> reloads;
+	m_Watcher.TakeReloads( reloads );
+	LARGE_INTEGER frequency, now;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &now );
+	for ( size_t i = 0; i < reloads.size(); i++ ) {
+		IniReload& reload = reloads[i];
+
+		// Closed or reopened since?
+		IniSlot* slot = ( reload.nHandle < (int) m_IniSlots.size() ) ? &m_IniSlots[ reload.nHandle ] : NULL;
+		if ( !slot || !slot->pIniFile || slot->sFile != reload.sFile ) {
+			delete reload.pIniFile;
+			continue;
+		}
+
+		// Scripts' unsaved changes win over the file.
+		if ( slot->pIniFile->IsModified() ) {
+			INI_LOG( INI_LOG_ERROR, wxT( "! %s changed on disk, not reloaded over unsaved changes." ), reload.sFile.c_str() );
+			delete reload.pIniFile;
+			continue;
+		}
+
+		// Swap it in with the file's settings; remembered lookups point into the old data.
+		// The data is what is on disk, so carrying the settings over is no change.
+		CSimpleIniArenaA* old = slot->pIniFile;
+		SetSettings( reload.pIniFile, GetSettings( old ) );
+		reload.pIniFile->SetModified( false );
+		if ( slot->pShare ) {
+			// Every file ID sharing the data moves to the new data.
+			IniShare* share = slot->pShare;
+			share->pIniFile = reload.pIniFile;
+			share->uWritten = reload.uWritten;
+			share->uSize = reload.uSize;
+			for ( IniSlotTable::iterator j = m_IniSlots.begin(); j != m_IniSlots.end(); j++ ) {
+				if ( j->pShare == share ) {
+					j->pIniFile = reload.pIniFile;
+					j->vMemo.clear();
+				}
+			}
+			if ( !m_Shares.count( share->sPath ) ) {
+				m_Shares[ share->sPath ] = share;
+			}
+		} else {
+			slot->pIniFile = reload.pIniFile;
+			slot->vMemo.clear();
+		}
+		delete old;
+		INI_LOG( INI_LOG_INFO, wxT( "* Reloaded \"%s\" as \"%s\": parsed in %.1f ms, live %.1f ms after the change." ),
+			reload.sFile.c_str(), slot->sFileID.c_str(), reload.dMilliseconds,
+			1000.0 * ( now.QuadPart - reload.nChanged.QuadPart ) / frequency.QuadPart );
+	}
+}
+
 // -------------------------------------------------------------------- //
 //	SETTINGS															//
 // -------------------------------------------------------------------- //
@@ -590,8 +2337,9 @@ INI::GetIsUnicode(
 	char* psFileID
 	)
 {
-	if ( !FileOpened( psFileID ) ) return false;
-	return m_IniFiles[psFileID]->IsUnicode();
+	CSimpleIniArenaA* iniFile = GetFile( psFileID );
+	if ( !iniFile ) return false;
+	return iniFile->IsUnicode();
 }
 
 void
@@ -600,8 +2348,9 @@ INI::SetUnicode(
 	bool bUnicode
 	)
 {
-	if ( !FileOpened( psFileID ) ) return;
-	m_IniFiles[psFileID]->SetUnicode( bUnicode );
+	CSimpleIniArenaA* iniFile = GetWritableFile( psFileID );
+	if ( !iniFile ) return;
+	iniFile->SetUnicode( bUnicode );
 }
 
 bool
@@ -609,8 +2358,9 @@ INI::GetIsMultikey(
 	char* psFileID
 	)
 {
-	if ( !FileOpened( psFileID ) ) return false;
-	return m_IniFiles[psFileID]->IsMultiKey();
+	CSimpleIniArenaA* iniFile = GetFile( psFileID );
+	if ( !iniFile ) return false;
+	return iniFile->IsMultiKey();
 }
 
 void
@@ -619,8 +2369,9 @@ INI::SetMultikey(
 	bool bMultikey
 	)
 {
-	if ( !FileOpened( psFileID ) ) return;
-	m_IniFiles[psFileID]->SetMultiKey( bMultikey );
+	CSimpleIniArenaA* iniFile = GetWritableFile( psFileID );
+	if ( !iniFile ) return;
+	iniFile->SetMultiKey( bMultikey );
 }
 	
 bool
@@ -628,8 +2379,9 @@ INI::GetIsMultiline(
 	char* psFileID
 	)
 {
-	if ( !FileOpened( psFileID ) ) return false;
-	return m_IniFiles[psFileID]->IsMultiLine();
+	CSimpleIniArenaA* iniFile = GetFile( psFileID );
+	if ( !iniFile ) return false;
+	return iniFile->IsMultiLine();
 }
 
 void
@@ -638,8 +2390,9 @@ INI::SetMultiline(
 	bool bMultiline
 	)
 {
-	if ( !FileOpened( psFileID ) ) return;
-	m_IniFiles[psFileID]->SetMultiLine( bMultiline );
+	CSimpleIniArenaA* iniFile = GetWritableFile( psFileID );
+	if ( !iniFile ) return;
+	iniFile->SetMultiLine( bMultiline );
 }
 	
 bool
@@ -647,8 +2400,9 @@ INI::GetUseSpaces(
 	char* psFileID
 	)
 {
-	if ( !FileOpened( psFileID ) ) return false;
-	return m_IniFiles[psFileID]->UsingSpaces();
+	CSimpleIniArenaA* iniFile = GetFile( psFileID );
+	if ( !iniFile ) return false;
+	return iniFile->UsingSpaces();
 }
 
 void
@@ -657,8 +2411,9 @@ INI::SetUseSpaces(
 	bool bUseSpaces
 	)
 {
-	if ( !FileOpened( psFileID ) ) return;
-	m_IniFiles[psFileID]->SetSpaces( bUseSpaces );
+	CSimpleIniArenaA* iniFile = GetWritableFile( psFileID );
+	if ( !iniFile ) return;
+	iniFile->SetSpaces( bUseSpaces );
 }
 	
 // -------------------------------------------------------------------- //
@@ -670,7 +2425,85 @@ INI::FileOpened(
 	char* psFileID
 	)
 {
-	return ( m_IniFiles.count(psFileID) > 0 );
+	return ( FindHandle( psFileID ) != 0 );
+}
+
+int
+INI::FindHandle(
+	const char* psFileID
+	)
+{
+	// Handle: "#<handle>", indexes the slot table directly.
+	if ( psFileID[0] == '#' && psFileID[1] != '\0' ) {
+		unsigned int handle = 0;
+		const char* p = psFileID + 1;
+		for ( ; *p >= '0' && *p <= '9' && handle < m_IniSlots.size(); p++ ) {
+			handle = handle * 10 + ( *p - '0' );
+		}
+		if ( *p == '\0' && handle > 0 && handle < m_IniSlots.size() && ( m_IniSlots[handle].pIniFile || m_IniSlots[handle].bEvicted ) ) {
+			return (int) handle;
+		}
+		return 0;
+	}
+
+	// File ID.
+	IniMap::const_iterator i = m_IniFiles.find( psFileID );
+	if ( i == m_IniFiles.end() ) {
+		return 0;
+	}
+	return i->second;
+}
+
+int
+INI::GetHandle(
+	const char* psFileID
+	)
+{
+	// Mark files that failed to save in the background as changed, then swap
+	// in files changed on disk, before anything is looked up.
+	if ( m_Writer.HasFailures() ) {
+		ApplyWriteFailures();
+	}
+	if ( m_Watcher.HasReloads() ) {
+		ApplyReloads();
+	}
+
+	int handle = FindHandle( psFileID );
+	if ( handle == 0 ) {
+		return 0;
+	}
+
+	// Evicted files are loaded again when used.
+	IniSlot& slot = m_IniSlots[handle];
+	slot.uLastUsed = ++m_UseCount;
+	if ( !slot.bEvicted ) {
+		m_BudgetHits++;
+	} else if ( !RestoreFile( handle ) ) {
+		return 0;
+	}
+	return handle;
+}
+
+CSimpleIniArenaA*
+INI::GetFile(
+	const char* psFileID
+	)
+{
+	int handle = GetHandle( psFileID );
+	return ( handle != 0 ) ? m_IniSlots[handle].pIniFile : NULL;
+}
+
+CSimpleIniArenaA*
+INI::GetWritableFile(
+	const char* psFileID
+	)
+{
+	// Changing shared data would change it for the other file IDs too.
+	int handle = GetHandle( psFileID );
+	if ( handle == 0 || !UnshareFile( m_IniSlots[handle] ) ) {
+		return NULL;
+	}
+	return m_IniSlots[handle].pIniFile;
 }
 
 bool
@@ -678,6 +2511,7 @@ INI::GetIsEmpty(
 	char* psFileID
 	)
 {
-	if ( !FileOpened( psFileID ) ) return false;
-	return m_IniFiles[psFileID]->IsEmpty();
+	CSimpleIniArenaA* iniFile = GetFile( psFileID );
+	if ( !iniFile ) return false;
+	return iniFile->IsEmpty();
 }
\ No newline at end of file
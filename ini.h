@@ -40,17 +40,470 @@
 #include "wx/hashset.h"
 #include "wx/filefn.h"
 #include "wx/fileconf.h"
+#include "wx/dir.h"
 #include "strsafe.h"
+#include <sys/stat.h>
+#include <io.h>
+#define SI_SUPPORT_MMAP
+#define SI_SUPPORT_THREADS
 #include "SimpleIni.h"
 #include <vector>
+#include <set>
+#include <algorithm>
 #include <fstream>
 #include <string>
 
-typedef std::map<std::string, CSimpleIniA*> IniMap;
-typedef std::map<std::string, std::string> IniFilenameMap;
+// Log levels, set by "LogLevel" in the plugin's ini file. Each level includes
+// the ones below it.
+#define INI_LOG_NONE	0		// Nothing after start up.
+#define INI_LOG_ERROR	1		// Failed calls.
+#define INI_LOG_INFO	2		// File operations. The default.
+#define INI_LOG_TRACE	3		// Every call, with its parameters.
+
+// Log a message from an INI member function if its level is enabled. The text
+// is formatted on the calling thread and written by the log thread.
+#define INI_LOG( nLevel, ... ) \
+	do { if ( ( nLevel ) <= m_LogLevel ) m_Log.Write( __VA_ARGS__ ); } while ( 0 )
+
+// Per-call tracing. Define INI_NO_TRACE to compile it out entirely.
+#ifdef INI_NO_TRACE
+#define INI_TRACE( ... ) ( (void) 0 )
+#else
+#define INI_TRACE( ... ) INI_LOG( INI_LOG_TRACE, __VA_ARGS__ )
+#endif
+
+// Log queue size in messages, a power of two, and the longest message kept.
+#define INI_LOG_QUEUE	1024
+#define INI_LOG_LINE	256
+
+// A queued log message. Its sequence number says whose turn it is: a writer
+// may fill the cell when it equals the writer's position, and the log thread
+// may read it when it is one more.
+struct IniLogCell {
+	volatile LONG							nSequence;				// Position the cell is ready for.
+	char									sText[ INI_LOG_LINE ];	// Formatted message.
+};
+
+// Lock-free queue of log messages, written to the log file by a background
+// thread. Any thread may write; a full queue drops messages and counts them.
+// Without the thread, the main thread logs directly and also logs what the
+// other threads queued, as wx only allows logging from the main thread.
+class IniLog {
+
+public:
+
+	IniLog(
+		);
+
+	~IniLog(
+		);
+
+	bool
+	Start(
+		);
+
+	void
+	Stop(
+		);
+
+	void
+	Write(
+		const char* psFormat,
+		...
+		);
+
+private:
+
+	static DWORD WINAPI
+	Run(
+		LPVOID pParam
+		);
+
+	void
+	Drain(
+		);
+
+	IniLogCell							  * m_Cells;				// Queue, INI_LOG_QUEUE cells.
+	volatile LONG							m_nHead;				// Next position to write.
+	volatile LONG							m_nTail;				// Next position to log.
+	volatile LONG							m_nDropped;				// Messages lost to a full queue.
+	volatile LONG							m_bStop;				// Should the log thread exit?
+	HANDLE									m_hWake;				// Wakes the log thread early.
+	HANDLE									m_hThread;				// Log thread, NULL if logging directly.
+	DWORD									m_nMainThread;			// The only thread that may log directly.
+
+};
+
+class IniWatcher;
+
+// Writes saved files on a background thread. The data is serialized by the
+// caller; a file saved again before it is written only has its latest data
+// written. Files that fail to be written are kept for the caller to mark as
+// changed again.
+class IniWriter {
+
+public:
+
+	IniWriter(
+		);
+
+	~IniWriter(
+		);
+
+	bool
+	Start(
+		IniLog* pLog,
+		const long* pLogLevel,
+		IniWatcher* pWatcher
+		);
+
+	void
+	Stop(
+		);
+
+	bool
+	IsRunning(
+		) const { return m_hThread != NULL; }
+
+	void
+	Queue(
+		const std::string& sFile,
+		std::string& sData
+		);
+
+	void
+	Flush(
+		const std::string& sFile
+		);
+
+	bool
+	IsPending(
+		const std::string& sFile
+		);
+
+	bool
+	HasFailures(
+		) const { return m_nFailed != 0; }
+
+	void
+	TakeFailures(
+		std::vector<std::string>& vFiles
+		);
+
+private:
+
+	static DWORD WINAPI
+	Run(
+		LPVOID pParam
+		);
+
+	bool
+	WriteNext(
+		);
+
+	typedef std::map<std::string, std::string> PendingMap;
+
+	CRITICAL_SECTION						m_Lock;					// Guards m_Pending, m_Writing and m_Failed.
+	PendingMap								m_Pending;				// Map: FilePath->Data, not yet written.
+	std::string								m_Writing;				// File being written, empty for none.
+	std::set<std::string>					m_Failed;				// Files whose last write failed.
+	volatile LONG							m_nFailed;				// Size of m_Failed.
+	HANDLE									m_hWake;				// Set when a save is queued.
+	HANDLE									m_hWritten;				// Set when a file has been written.
+	volatile LONG							m_bStop;				// Should the thread exit?
+	HANDLE									m_hThread;				// Writer thread, NULL if not running.
+	IniLog								  * m_pLog;					// Log for write errors.
+	const long							  * m_pLogLevel;			// Plugin log level.
+	IniWatcher							  * m_pWatcher;				// Told about written files.
+
+};
+
+// Header of a journal record. It is followed by nLength bytes: 'S', then the
+// section, key and value, each NULL terminated.
+struct IniJournalRecord {
+	DWORD									nLength;				// Bytes after the header.
+	DWORD									nChecksum;				// FNV-1a hash of those bytes.
+};
+
+// Journal of the values set in an opened file, kept beside it in
+// "<file>.journal". Every record is handed to the OS as it is written, and
+// forced to disk every few records. The records are replayed when the file
+// is opened again, and dropped once the file has been saved.
+class IniJournal {
+
+public:
+
+	IniJournal(
+		);
+
+	~IniJournal(
+		);
+
+	long
+	Open(
+		const std::string& sFile,
+		CSimpleIniArenaA* pIniFile,
+		long nSyncEvery
+		);
+
+	void
+	Close(
+		);
+
+	bool
+	Append(
+		const char* psSection,
+		const char* psKey,
+		const char* psValue
+		);
+
+	bool
+	Reset(
+		);
+
+	long
+	Size(
+		) const { return m_nSize; }
+
+	static std::string
+	GetPath(
+		const std::string& sFile
+		);
+
+private:
+
+	bool
+	Sync(
+		);
+
+	static DWORD
+	Checksum(
+		const char* pData,
+		size_t nLength
+		);
+
+	FILE								  * m_File;					// Open journal, NULL until there is one.
+	std::string								m_sPath;				// Journal path.
+	long									m_nSize;				// Bytes of whole records.
+	long									m_nUnsynced;			// Records written since the last sync.
+	long									m_nSyncEvery;			// Records per sync, 0 to leave it to the OS.
+
+};
+
+// Milliseconds a directory must be quiet before its changed files are parsed,
+// and between checks of files whose directory can't be watched.
+#define INI_WATCH_SETTLE	100
+#define INI_WATCH_POLL		1000
+
+// Last write time and size of a watched file.
+struct IniWatch {
+	std::string								sFile;					// File path.
+	std::string								sDirectory;				// Directory holding it.
+	ULONGLONG								uWritten;				// Last write time.
+	ULONGLONG								uSize;					// Size in bytes.
+};
+
+// A watched file that changed on disk, parsed again and waiting to be
+// swapped in for the opened one.
+struct IniReload {
+	int										nHandle;				// Slot of the opened file.
+	std::string								sFile;					// File path.
+	CSimpleIniArenaA					  * pIniFile;				// Fresh ini data.
+	ULONGLONG								uWritten;				// Last write time of the file parsed.
+	ULONGLONG								uSize;					// Size of the file parsed.
+	LARGE_INTEGER							nChanged;				// When the change was noticed.
+	double									dMilliseconds;			// Parse time.
+};
+
+class INI;
+
+// Watches the directories of opened files for changes, and parses changed
+// files again on its own thread. The plugin swaps the results in between
+// calls, so scripts never see a file half loaded.
+class IniWatcher {
+
+public:
+
+	IniWatcher(
+		);
+
+	~IniWatcher(
+		);
+
+	bool
+	Start(
+		const INI* pPlugin,
+		IniLog* pLog,
+		const long* pLogLevel
+		);
+
+	void
+	Stop(
+		);
+
+	bool
+	IsRunning(
+		) const { return m_hThread != NULL; }
+
+	void
+	Watch(
+		int nHandle,
+		const IniWatch& stamp
+		);
+
+	void
+	Unwatch(
+		int nHandle
+		);
+
+	void
+	Touch(
+		const std::string& sFile
+		);
+
+	bool
+	HasReloads(
+		) const { return m_nReloads != 0; }
+
+	void
+	TakeReloads(
+		std::vector<IniReload>& vReloads
+		);
+
+	static bool
+	GetStamp(
+		IniWatch& watch
+		);
+
+private:
+
+	static DWORD WINAPI
+	Run(
+		LPVOID pParam
+		);
+
+	void
+	Scan(
+		const LARGE_INTEGER& nChanged
+		);
+
+	typedef std::map<int, IniWatch> WatchMap;
+
+	CRITICAL_SECTION						m_Lock;					// Guards m_Watches and m_Reloads.
+	WatchMap								m_Watches;				// Map: Handle->IniWatch.
+	std::vector<IniReload>					m_Reloads;				// Parsed files, not yet swapped in.
+	volatile LONG							m_nReloads;				// Size of m_Reloads.
+	volatile LONG							m_bChanged;				// Have the watched directories changed?
+	HANDLE									m_hWake;				// Set when the watched files change.
+	volatile LONG							m_bStop;				// Should the thread exit?
+	HANDLE									m_hThread;				// Watcher thread, NULL if not running.
+	const INI							  * m_pPlugin;				// Plugin, to load files with its settings.
+	IniLog								  * m_pLog;					// Log for reload errors.
+	const long							  * m_pLogLevel;			// Plugin log level.
+
+};
+
+// Number of "section|key" lookups remembered per file; a power of two.
+#define INI_MEMO_SIZE 64
+
+// A remembered "section|key" lookup. It is only used while the generation
+// of the ini data is unchanged, as the value may have moved since.
+struct IniMemo {
+	std::string								sKey;					// Raw "section|key" string.
+	unsigned int							uHash;					// Hash of sKey.
+	unsigned long							uGeneration;			// Generation of the ini data when resolved.
+	const char							  * pValue;					// Value, NULL if unused.
+};
+
+// A "section|key" string split without allocating. The key points into the
+// input and the section is copied to a stack buffer, or to the heap if it is
+// unusually long.
+class IniKeyName {
+
+public:
+
+	IniKeyName(
+		const char* psInput
+		);
+
+	const char*
+	Section(
+		) const { return m_pSection; }
+
+	const char*
+	Key(
+		) const { return m_pKey; }
+
+private:
+
+	char									m_Buffer[ 256 ];		// Section, if it fits.
+	std::string								m_LongSection;			// Section, if it doesn't.
+	const char							  * m_pSection;				// Section name.
+	const char							  * m_pKey;					// Key name, "" if there is no '|'.
+
+};
+
+// Ini data parsed once for every file ID that opens the same, unchanged
+// file. Slots alias it until one of them changes it, which gives that slot
+// a copy of its own.
+struct IniShare {
+	CSimpleIniArenaA					  * pIniFile;				// Shared ini data, never modified.
+	std::string								sPath;					// Canonical path.
+	long									nRefs;					// Slots using it.
+	ULONGLONG								uWritten;				// Last write time of the file when parsed.
+	ULONGLONG								uSize;					// Size of the file when parsed.
+};
+
+// Settings scripts may change on an opened file, kept while its data is
+// evicted.
+#define INI_SETTING_UNICODE		1
+#define INI_SETTING_MULTIKEY	2
+#define INI_SETTING_MULTILINE	4
+#define INI_SETTING_SPACES		8
+
+// Settings of a file as it is opened.
+#define INI_SETTING_DEFAULT		( INI_SETTING_UNICODE | INI_SETTING_MULTILINE | INI_SETTING_SPACES )
+
+// An opened ini file. Scripts address it by its file ID or by the handle
+// returned from OpenFile, written as "#<handle>"; the handle indexes the
+// slot table directly and so skips the file ID lookup.
+struct IniSlot {
+	CSimpleIniArenaA					  * pIniFile;				// Ini data, NULL if the slot is free.
+	std::string								sFileID;				// File ID given to OpenFile.
+	std::string								sFile;					// File path.
+	std::vector<IniMemo>					vMemo;					// Recent lookups, indexed by hash.
+	IniJournal							  * pJournal;				// Journal of set values, NULL if not journaled.
+	IniShare							  * pShare;					// Data shared with other file IDs, NULL if the slot's own.
+	unsigned long							uLastUsed;				// Use count when last used, for eviction.
+	bool									bEvicted;				// Data dropped for the memory budget, loaded again when used.
+	unsigned int							uSettings;				// INI_SETTING_* flags of the evicted data.
+};
+
+// A file opened by Preload, filled in by one of its threads.
+struct IniPreload {
+	std::string								sFileID;				// File ID to open it as.
+	std::string								sFile;					// File path.
+	CSimpleIniArenaA					  * pIniFile;				// Ini data, NULL if it failed to load.
+	IniWatch								stamp;					// File stamp from before it was loaded.
+	size_t									nBytes;					// File size.
+	double									dMilliseconds;			// Load time.
+};
+
+// Files for the preload threads to share out.
+struct IniPreloadQueue {
+	INI									  * pPlugin;				// Plugin, for its settings.
+	std::vector<IniPreload>				  * pFiles;					// Files to load.
+	volatile LONG							nNext;					// Index of the next file to take.
+};
+
+typedef std::map<std::string, int> IniMap;
+typedef std::vector<IniSlot> IniSlotTable;
+typedef std::map<std::string, IniShare*> IniShareMap;
 
 class INI : public Plugin {
 
+	friend class IniWatcher;
+
 public:
 
 	enum Flags {
@@ -71,6 +524,7 @@ public:
 		FLAG_SET_USESPACES,
 		FLAG_GET_PATH,
 		FLAG_FILE_EMPTY,
+		FLAG_GET_BATCH,
 		FLAG_INVALID
 	};
 	
@@ -158,19 +612,38 @@ private:
 	//	SECTION/KEY PARSING													//
 	// -------------------------------------------------------------------- //
 
-	std::string
-	GetSection(
-		char* psInput
+	const char*
+	GetRawValue(
+		int nHandle,
+		const char* psKey
 		);
 
-	std::string
-	GetKey(
-		char* psInput
+	// Batch read, FLAG_GET_BATCH: psKeys is "<section>|<key>|<key>;<section>|<key>"
+	// and the values come back in the same order, separated by ';'. A missing
+	// key gives an empty value. In both, '\' escapes the next character, so
+	// names and values may contain '\', '|' and ';'.
+	char*
+	GetBatch(
+		char* psFileID,
+		char* psKeys
+		);
+
+	bool
+	AppendBatchValue(
+		size_t& nLength,
+		const char* psValue
+		);
+
+	void
+	SetValue(
+		int nHandle,
+		const char* psKey,
+		const char* psValue
 		);
 
 	bool
 	ValidKey(
-		CSimpleIniA* iniFile,
+		CSimpleIniArenaA* iniFile,
 		const char* psSection,
 		const char* psKey
 		);
@@ -179,17 +652,120 @@ private:
 	//	FILE I/O															//
 	// -------------------------------------------------------------------- //
 
-	bool
+	int
 	OpenFile(
 		char* psFileID,
 		char* psFile
 		);
 
+	CSimpleIniArenaA*
+	LoadFile(
+		const char* psFile,
+		unsigned int uSettings = INI_SETTING_DEFAULT,
+		IniWatch* pStamp = NULL
+		) const;
+
+	int
+	AddFile(
+		const char* psFileID,
+		const char* psFile,
+		CSimpleIniArenaA* iniFile,
+		const IniWatch& stamp,
+		IniShare* pShare = NULL
+		);
+
+	IniShare*
+	FindShare(
+		const std::string& sPath,
+		const char* psFile
+		);
+
+	static IniWatch
+	GetStamp(
+		const IniShare* share,
+		const char* psFile
+		);
+
+	void
+	ShareFile(
+		IniSlot& slot,
+		const std::string& sPath,
+		const IniWatch& stamp
+		);
+
+	bool
+	UnshareFile(
+		IniSlot& slot
+		);
+
+	void
+	ReleaseFile(
+		IniSlot& slot
+		);
+
+	std::string
+	GetCanonicalPath(
+		const char* psFile
+		) const;
+
+	bool
+	RestoreFile(
+		int nHandle
+		);
+
+	void
+	EvictFile(
+		int nHandle
+		);
+
+	void
+	EnforceBudget(
+		int nKeep
+		);
+
+	static unsigned int
+	GetSettings(
+		const CSimpleIniArenaA* iniFile
+		);
+
+	static void
+	SetSettings(
+		CSimpleIniArenaA* iniFile,
+		unsigned int uSettings
+		);
+
+	void
+	Preload(
+		);
+
+	static void
+	PreloadThread(
+		void* pParam
+		);
+
+	void
+	ApplyWriteFailures(
+		);
+
+	void
+	ApplyReloads(
+		);
+
 	bool
 	SaveFile(
 		char* psFileID
 		);
 
+	SI_Error
+	WriteFile(
+		IniSlot& slot
+		);
+
+	void
+	CompactJournal(
+		IniSlot& slot
+		);
+
 	bool
 	CloseFile(
 		char* psFileID
@@ -209,6 +785,11 @@ private:
 	GetFilePath(
 		char* psFileID
 		);
+
+	std::string
+	GetCachePath(
+		const char* psFile
+		) const;
 	
 	// -------------------------------------------------------------------- //
 	//	SETTINGS															//
@@ -267,6 +848,26 @@ private:
 		char* psFileID
 		);
 
+	int
+	FindHandle(
+		const char* psFileID
+		);
+
+	int
+	GetHandle(
+		const char* psFileID
+		);
+
+	CSimpleIniArenaA*
+	GetFile(
+		const char* psFileID
+		);
+
+	CSimpleIniArenaA*
+	GetWritableFile(
+		const char* psFileID
+		);
+
 	bool
 	GetIsEmpty(
 		char* psFileID
@@ -283,9 +884,37 @@ private:
 	PROCESS_INFORMATION						m_ProcessInfo;			// Process Information structure.
 	char									m_CommandLine[ 2000 ];	// BIC Function's command-line (2000 bytes).
 
+	// Logging.
+	IniLog									m_Log;					// Queue for the log thread.
+	long									m_LogLevel;				// INI_LOG_* level.
+
+	// Saving.
+	IniWriter								m_Writer;				// Background writer, if AsyncSave is set.
+	bool									m_IncrementalSave;		// Rewrite only the changed sections of files.
+
+	// Reloading.
+	IniWatcher								m_Watcher;				// Reloads changed files, if Watch is set.
+
+	// Journaling.
+	bool									m_Journal;				// Journal set values of opened files.
+	long									m_JournalSync;			// Journal records per sync to disk.
+	long									m_JournalLimit;			// Journal bytes that trigger a save of the file.
+
+	// Memory budget.
+	long									m_MemoryBudget;			// Bytes of ini data to keep loaded, 0 for no limit.
+	unsigned long							m_UseCount;				// Number of file uses, for least recently used order.
+	unsigned long							m_BudgetHits;			// Uses of loaded files.
+	unsigned long							m_BudgetEvictions;		// Files evicted.
+	unsigned long							m_BudgetReloads;		// Evicted files loaded again.
+
+	// Cache files.
+	std::string								m_CacheDir;				// Directory of parsed ini caches, empty for none.
+
 	// Stored ini files.
-	IniFilenameMap							m_IniFileNames;			// Map: FileKey->FilePath.
-	IniMap									m_IniFiles;				// Map: FileKey->IniData.
+	IniSlotTable							m_IniSlots;				// Table: Handle->IniSlot, slot 0 unused.
+	std::vector<int>						m_FreeSlots;			// Handles of closed files, for reuse.
+	IniMap									m_IniFiles;				// Map: FileKey->Handle.
+	IniShareMap								m_Shares;				// Map: Canonical path->IniShare, for files opened unchanged.
 
 };
 